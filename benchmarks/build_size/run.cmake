@@ -0,0 +1,128 @@
+# benchmarks/build_size/run.cmake
+#
+# Compiles one generated translation unit with DEFERS guards per mode and reports what deferral
+# adds to the object file:
+#  - baseline: the cleanup code is called by hand at the end of each scope, without guards,
+#  - default:  the `defer` macros,
+#  - minimal:  the `defer` macros with DEFERRAL_MINIMAL_INSTANTIATION.
+#
+# For each mode and optimization level it prints the number of DWARF entries naming a deferral
+# template instantiation, the number of out-of-line deferral symbols, and the `.text*` and
+# `.debug_info` bytes. The `+` columns are the difference from the baseline.
+#
+#   cmake -DDEFERRAL_SOURCE_DIR=<repo> -DBINARY_DIR=<dir> [-DCXX_COMPILER=<c++>]
+#         [-DREADELF=<readelf>] [-DNM=<nm>] [-DDEFERS=50] -P run.cmake
+
+cmake_minimum_required(VERSION 3.15)
+
+if(NOT DEFINED DEFERRAL_SOURCE_DIR OR NOT DEFINED BINARY_DIR)
+  message(FATAL_ERROR "DEFERRAL_SOURCE_DIR and BINARY_DIR are required")
+endif()
+if(NOT DEFINED CXX_COMPILER)
+  set(CXX_COMPILER c++)
+endif()
+if(NOT DEFINED READELF OR NOT READELF)
+  set(READELF readelf)
+endif()
+if(NOT DEFINED NM OR NOT NM)
+  set(NM nm)
+endif()
+if(NOT DEFINED DEFERS)
+  set(DEFERS 50)
+endif()
+
+file(MAKE_DIRECTORY "${BINARY_DIR}")
+
+# Generate the guarded and the hand-written sources.
+set(guarded "")
+set(manual "")
+math(EXPR last_defer "${DEFERS} - 1")
+foreach(d RANGE ${last_defer})
+  math(EXPR kind "${d} % 4")
+  if(kind EQUAL 0)
+    string(APPEND guarded "void f${d}(int x) {\n  defer { sink(x + ${d}); };\n  work(x);\n}\n")
+  elseif(kind EQUAL 1)
+    string(APPEND guarded
+      "void f${d}(int x) {\n  defer_(d) { sink(x + ${d}); };\n  if(work(x)) d.release();\n}\n")
+  elseif(kind EQUAL 2)
+    string(APPEND guarded "void f${d}(int x) {\n  defer_fail { sink(x + ${d}); };\n  work(x);\n}\n")
+  else()
+    string(APPEND guarded
+      "void f${d}(int x) {\n  defer_success { sink(x + ${d}); };\n  work(x);\n}\n")
+  endif()
+  if(kind EQUAL 1)
+    string(APPEND manual "void f${d}(int x) {\n  if(!work(x)) sink(x + ${d});\n}\n")
+  else()
+    string(APPEND manual "void f${d}(int x) {\n  work(x);\n  sink(x + ${d});\n}\n")
+  endif()
+endforeach()
+set(prototypes "void sink(int) noexcept;\nbool work(int);\n\n")
+file(WRITE "${BINARY_DIR}/guarded.cc" "#include \"deferral.hh\"\n\n${prototypes}${guarded}")
+file(WRITE "${BINARY_DIR}/manual.cc" "${prototypes}${manual}")
+
+# Sets <prefix>_text, <prefix>_debug_info, <prefix>_instantiations and <prefix>_symbols.
+function(measure prefix object)
+  execute_process(COMMAND "${READELF}" -S -W "${object}" OUTPUT_VARIABLE sections)
+  set(text 0)
+  set(debug_info 0)
+  string(REGEX MATCHALL " \\.(text|debug_info)[^ ]* +[A-Z_]+ +[0-9a-f]+ [0-9a-f]+ ([0-9a-f]+)"
+         rows "${sections}")
+  foreach(row IN LISTS rows)
+    string(REGEX MATCH " \\.(text|debug_info)[^ ]* +[A-Z_]+ +[0-9a-f]+ [0-9a-f]+ ([0-9a-f]+)"
+           row "${row}")
+    math(EXPR bytes "0x${CMAKE_MATCH_2}")
+    if(CMAKE_MATCH_1 STREQUAL "text")
+      math(EXPR text "${text} + ${bytes}")
+    else()
+      math(EXPR debug_info "${debug_info} + ${bytes}")
+    endif()
+  endforeach()
+
+  execute_process(COMMAND "${READELF}" --debug-dump=info "${object}" OUTPUT_VARIABLE dwarf)
+  string(REGEX MATCHALL
+         "DW_AT_name[^\n]*[ :](Defer[A-Za-z]*|Guard|MinimalGuard|make_defer_[a-z]+|operator\\+)<"
+         instantiations "${dwarf}")
+  list(LENGTH instantiations instantiation_count)
+
+  execute_process(COMMAND "${NM}" -C --defined-only "${object}" OUTPUT_VARIABLE symbols)
+  string(REGEX MATCHALL "deferral::[^\n]*" deferral_symbols "${symbols}")
+  list(LENGTH deferral_symbols symbol_count)
+
+  set(${prefix}_text ${text} PARENT_SCOPE)
+  set(${prefix}_debug_info ${debug_info} PARENT_SCOPE)
+  set(${prefix}_instantiations ${instantiation_count} PARENT_SCOPE)
+  set(${prefix}_symbols ${symbol_count} PARENT_SCOPE)
+endfunction()
+
+message(STATUS "${DEFERS} guards; instantiation DIEs, out-of-line symbols, .text and .debug_info "
+               "bytes (+ difference from baseline)")
+foreach(opt IN ITEMS -O0 -O2)
+  foreach(mode IN ITEMS baseline default minimal)
+    set(source "${BINARY_DIR}/guarded.cc")
+    set(defines "")
+    if(mode STREQUAL "baseline")
+      set(source "${BINARY_DIR}/manual.cc")
+    elseif(mode STREQUAL "minimal")
+      set(defines -DDEFERRAL_MINIMAL_INSTANTIATION=1)
+    endif()
+    set(object "${BINARY_DIR}/${mode}${opt}.o")
+    execute_process(
+      COMMAND "${CXX_COMPILER}" -std=c++17 ${opt} -g ${defines} "-I${DEFERRAL_SOURCE_DIR}/include"
+              -c "${source}" -o "${object}"
+      RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+      message(FATAL_ERROR "${mode} ${opt}: compilation failed")
+    endif()
+
+    measure(m "${object}")
+    if(mode STREQUAL "baseline")
+      set(base_text ${m_text})
+      set(base_debug_info ${m_debug_info})
+    endif()
+    math(EXPR text_delta "${m_text} - ${base_text}")
+    math(EXPR debug_info_delta "${m_debug_info} - ${base_debug_info}")
+    message(STATUS "${opt} ${mode}: ${m_instantiations} instantiation DIEs, ${m_symbols} symbols, "
+                   ".text ${m_text} (+${text_delta}), "
+                   ".debug_info ${m_debug_info} (+${debug_info_delta})")
+  endforeach()
+endforeach()
@@ -0,0 +1,103 @@
+# benchmarks/build_time/run.cmake
+#
+# Builds the generated project in this directory once per mode and prints, for each mode:
+#  - the number of lines in one preprocessed translation unit,
+#  - the wall-clock time of a clean build,
+#  - with Clang, the sum of the `-ftime-trace` "Total ExecuteCompiler" and "Total Frontend" times.
+#
+#   cmake -DDEFERRAL_SOURCE_DIR=<repo> -DBINARY_DIR=<dir> [-DGENERATOR=<gen>]
+#         [-DCXX_COMPILER=<c++>] [-DCXX_COMPILER_ID=<id>] [-DMODES=header;core;module]
+#         [-DTUS=1000] [-DDEFERS=50]
+#         -P run.cmake
+
+cmake_minimum_required(VERSION 3.15)
+
+if(NOT DEFINED DEFERRAL_SOURCE_DIR OR NOT DEFINED BINARY_DIR)
+  message(FATAL_ERROR "DEFERRAL_SOURCE_DIR and BINARY_DIR are required")
+endif()
+if(NOT DEFINED MODES)
+  set(MODES header core module)
+endif()
+if(NOT DEFINED TUS)
+  set(TUS 1000)
+endif()
+if(NOT DEFINED DEFERS)
+  set(DEFERS 50)
+endif()
+if(NOT DEFINED CXX_COMPILER)
+  set(CXX_COMPILER c++)
+endif()
+
+set(configure_args "-DCMAKE_CXX_COMPILER=${CXX_COMPILER}")
+if(DEFINED GENERATOR)
+  list(APPEND configure_args -G "${GENERATOR}")
+endif()
+set(time_trace OFF)
+if(CXX_COMPILER_ID MATCHES "Clang")
+  set(time_trace ON)
+endif()
+
+# Sums the `dur` (microseconds) of every trace event named `event` in the given -ftime-trace files.
+function(sum_time_trace out_var event)
+  set(total 0)
+  foreach(trace IN LISTS ARGN)
+    file(READ "${trace}" content)
+    string(REGEX MATCH "\"dur\":([0-9]+),\"name\":\"${event}\"" match "${content}")
+    if(match)
+      math(EXPR total "${total} + ${CMAKE_MATCH_1}")
+    endif()
+  endforeach()
+  math(EXPR total "${total} / 1000")
+  set(${out_var} ${total} PARENT_SCOPE)
+endfunction()
+
+foreach(mode IN LISTS MODES)
+  if(mode STREQUAL "module" AND CMAKE_VERSION VERSION_LESS 3.28)
+    message(STATUS "${mode}: skipped, C++20 modules require CMake 3.28 or later")
+    continue()
+  endif()
+
+  set(dir "${BINARY_DIR}/${mode}")
+  file(REMOVE_RECURSE "${dir}")
+  execute_process(
+    COMMAND "${CMAKE_COMMAND}" -S "${CMAKE_CURRENT_LIST_DIR}" -B "${dir}" ${configure_args}
+            "-DDEFERRAL_SOURCE_DIR=${DEFERRAL_SOURCE_DIR}" "-DDEFERRAL_MODE=${mode}"
+            "-DDEFERRAL_TUS=${TUS}" "-DDEFERRAL_DEFERS=${DEFERS}"
+            "-DDEFERRAL_TIME_TRACE=${time_trace}"
+    OUTPUT_QUIET
+    RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${mode}: configure failed")
+  endif()
+
+  set(lines "n/a")
+  if(NOT mode STREQUAL "module")
+    execute_process(
+      COMMAND "${CXX_COMPILER}" -std=c++20 -E -P "-I${DEFERRAL_SOURCE_DIR}/include" "${dir}/tu_0.cc"
+      OUTPUT_VARIABLE preprocessed
+      RESULT_VARIABLE result)
+    if(result EQUAL 0)
+      string(REGEX MATCHALL "\n" newlines "${preprocessed}")
+      list(LENGTH newlines lines)
+    endif()
+  endif()
+
+  string(TIMESTAMP start "%s%f")
+  execute_process(COMMAND "${CMAKE_COMMAND}" --build "${dir}" OUTPUT_QUIET RESULT_VARIABLE result)
+  string(TIMESTAMP stop "%s%f")
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${mode}: build failed")
+  endif()
+  math(EXPR elapsed_ms "(${stop} - ${start}) / 1000")
+
+  set(trace_summary "")
+  if(time_trace)
+    file(GLOB_RECURSE traces "${dir}/CMakeFiles/deferral_build_time.dir/tu_*.json")
+    sum_time_trace(compiler_ms "Total ExecuteCompiler" ${traces})
+    sum_time_trace(frontend_ms "Total Frontend" ${traces})
+    set(trace_summary ", time-trace compiler ${compiler_ms} ms, frontend ${frontend_ms} ms")
+  endif()
+
+  message(STATUS "${mode}: ${TUS} TUs x ${DEFERS} guards, ${lines} preprocessed lines per TU, "
+                 "built in ${elapsed_ms} ms${trace_summary}")
+endforeach()
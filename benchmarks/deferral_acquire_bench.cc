@@ -0,0 +1,70 @@
+// Acquiring four resources all or nothing, at -O2.
+//
+//  - BM_FailLadder: acquire, then a named `defer_fail` guard per resource, each released once all
+//    four are acquired: four exception count snapshots and four releases.
+//  - BM_AcquireAll: one `acquire_all` guard with four steps and a single `commit()`.
+//  - BM_AcquireAllRefused: `acquire_all` whose last step returns `false`, so the first three are
+//    rolled back in reverse order.
+
+#include "deferral.hh"
+#include "deferral_acquire.hh"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+__attribute__((noinline)) void take(int& x) {
+  ++x;
+}
+
+__attribute__((noinline)) void give(int& x) noexcept {
+  --x;
+}
+
+void BM_FailLadder(benchmark::State& state) {
+  int a = 0, b = 0, c = 0, d = 0;
+  for(auto _ : state) {
+    take(a);
+    defer_fail_(ga) { give(a); };
+    take(b);
+    defer_fail_(gb) { give(b); };
+    take(c);
+    defer_fail_(gc) { give(c); };
+    take(d);
+    defer_fail_(gd) { give(d); };
+    ga.release();
+    gb.release();
+    gc.release();
+    gd.release();
+    benchmark::DoNotOptimize(a + b + c + d);
+  }
+}
+BENCHMARK(BM_FailLadder);
+
+void BM_AcquireAll(benchmark::State& state) {
+  int a = 0, b = 0, c = 0, d = 0;
+  for(auto _ : state) {
+    auto g = deferral::acquire_all(deferral::step([&]() { take(a); }, [&]() noexcept { give(a); }),
+        deferral::step([&]() { take(b); }, [&]() noexcept { give(b); }),
+        deferral::step([&]() { take(c); }, [&]() noexcept { give(c); }),
+        deferral::step([&]() { take(d); }, [&]() noexcept { give(d); }));
+    g.commit();
+    benchmark::DoNotOptimize(a + b + c + d);
+  }
+}
+BENCHMARK(BM_AcquireAll);
+
+void BM_AcquireAllRefused(benchmark::State& state) {
+  int a = 0, b = 0, c = 0, d = 0;
+  for(auto _ : state) {
+    auto g = deferral::acquire_all(deferral::step([&]() { take(a); }, [&]() noexcept { give(a); }),
+        deferral::step([&]() { take(b); }, [&]() noexcept { give(b); }),
+        deferral::step([&]() { take(c); }, [&]() noexcept { give(c); }),
+        deferral::step([&]() { return d != 0; }, [&]() noexcept { give(d); }));
+    benchmark::DoNotOptimize(g.acquired());
+    benchmark::DoNotOptimize(a + b + c + d);
+  }
+}
+BENCHMARK(BM_AcquireAllRefused);
+
+} // namespace
@@ -0,0 +1,76 @@
+// `DeferAny` versus guards built on `std::function` and `std::move_only_function`, at -O2.
+//
+// The function captures three references (24 bytes on 64-bit targets), which `DeferAny<>` stores
+// in place and which exceeds the small-buffer of `std::function` in libstdc++ and libc++.
+//  - BM_Guard: one guard constructed and run per iteration.
+//  - BM_Vector: 16 guards appended to a reserved vector, then run by `clear()`.
+// `std::move_only_function` is measured where the standard library provides it (C++23).
+
+#include "deferral_any.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace {
+
+__attribute__((noinline)) void undo(int& a, int& b, int& c) noexcept {
+  a += b + c;
+}
+
+// A guard that runs a `std::function`-like wrapper on destruction.
+template <typename functionT>
+struct FunctionGuard {
+  functionT f;
+
+  template <typename F>
+  explicit FunctionGuard(F&& func) : f{std::forward<F>(func)} {}
+  FunctionGuard(FunctionGuard&& other) noexcept : f{std::move(other.f)} { other.f = nullptr; }
+  ~FunctionGuard() {
+    if(f) { f(); }
+  }
+};
+
+using Any = deferral::DeferAny<>;
+using Function = FunctionGuard<std::function<void()>>;
+#if defined(__cpp_lib_move_only_function)
+using MoveOnlyFunction = FunctionGuard<std::move_only_function<void()>>;
+#endif // defined(__cpp_lib_move_only_function)
+
+template <typename guardT>
+void BM_Guard(benchmark::State& state) {
+  int a = 0, b = 1, c = 2;
+  for(auto _ : state) {
+    guardT g{[&]() { undo(a, b, c); }};
+    benchmark::DoNotOptimize(g);
+  }
+  benchmark::DoNotOptimize(a);
+}
+
+template <typename guardT>
+void BM_Vector(benchmark::State& state) {
+  int a = 0, b = 1, c = 2;
+  std::vector<guardT> guards;
+  guards.reserve(16);
+  for(auto _ : state) {
+    for(int i = 0; i < 16; ++i) { guards.emplace_back([&]() { undo(a, b, c); }); }
+    guards.clear();
+  }
+  benchmark::DoNotOptimize(a);
+}
+
+BENCHMARK_TEMPLATE(BM_Guard, Any);
+BENCHMARK_TEMPLATE(BM_Guard, Function);
+#if defined(__cpp_lib_move_only_function)
+BENCHMARK_TEMPLATE(BM_Guard, MoveOnlyFunction);
+#endif // defined(__cpp_lib_move_only_function)
+
+BENCHMARK_TEMPLATE(BM_Vector, Any);
+BENCHMARK_TEMPLATE(BM_Vector, Function);
+#if defined(__cpp_lib_move_only_function)
+BENCHMARK_TEMPLATE(BM_Vector, MoveOnlyFunction);
+#endif // defined(__cpp_lib_move_only_function)
+
+} // namespace
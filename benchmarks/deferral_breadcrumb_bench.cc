@@ -0,0 +1,73 @@
+// The success path of a three-level call with context at each level, at -O2.
+//
+//  - BM_Success<None>: no context.
+//  - BM_Success<Breadcrumb>: a `DEFER_BREADCRUMB` guard per level; nothing is formatted.
+//  - BM_Success<Snprintf>: the context formatted eagerly into a stack buffer with `snprintf`.
+//  - BM_Success<String>: the context built eagerly as a `std::string`.
+//  - BM_Failure: the failure path with breadcrumbs, throwing and catching once per iteration.
+
+#include "deferral_breadcrumb.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+const char* const kFile = "records/2024-01-01.csv";
+
+__attribute__((noinline)) void work(int record, bool fail) {
+  benchmark::DoNotOptimize(record);
+  if(fail) { throw std::runtime_error("bad record"); }
+}
+
+enum Context { None, Breadcrumb, Snprintf, String };
+
+template <Context context>
+__attribute__((noinline)) void level(int depth, int record, bool fail) {
+  if(context == Breadcrumb) {
+    DEFER_BREADCRUMB("while parsing record {} of {} at depth {}", record, kFile, depth);
+    depth == 0 ? work(record, fail) : level<context>(depth - 1, record, fail);
+  } else if(context == Snprintf) {
+    char buf[128];
+    std::snprintf(buf, sizeof(buf), "while parsing record %d of %s at depth %d", record, kFile,
+        depth);
+    benchmark::DoNotOptimize(buf);
+    depth == 0 ? work(record, fail) : level<context>(depth - 1, record, fail);
+  } else if(context == String) {
+    std::string s = "while parsing record " + std::to_string(record) + " of " + kFile +
+                    " at depth " + std::to_string(depth);
+    benchmark::DoNotOptimize(s.data());
+    depth == 0 ? work(record, fail) : level<context>(depth - 1, record, fail);
+  } else {
+    depth == 0 ? work(record, fail) : level<context>(depth - 1, record, fail);
+  }
+}
+
+template <Context context>
+void BM_Success(benchmark::State& state) {
+  int record = 0;
+  for(auto _ : state) { level<context>(2, ++record, false); }
+}
+
+void BM_Failure(benchmark::State& state) {
+  int record = 0;
+  for(auto _ : state) {
+    try {
+      level<Breadcrumb>(2, ++record, true);
+    } catch(const std::runtime_error&) {
+      benchmark::DoNotOptimize(deferral::breadcrumbs().size());
+      deferral::clear_breadcrumbs();
+    }
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_Success, None);
+BENCHMARK_TEMPLATE(BM_Success, Breadcrumb);
+BENCHMARK_TEMPLATE(BM_Success, Snprintf);
+BENCHMARK_TEMPLATE(BM_Success, String);
+BENCHMARK(BM_Failure);
+
+} // namespace
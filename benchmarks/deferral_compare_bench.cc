@@ -0,0 +1,127 @@
+// Deferral compared with other scope guards, at -O2.
+//
+// For each library and guard kind (exit, fail, success) it measures a guard that is constructed
+// and executed at scope exit (`BM_Exit`), and one that is constructed and released (`BM_Release`).
+// The `bytes` counter is the size of the guard object. The libraries are:
+//  - Deferral: `DeferExit`, `DeferFail`, `DeferSuccess`,
+//  - DeferralScope: the <experimental/scope> compatible guards in deferral_scope.hh,
+//  - Reference: the minimal guards in reference_guards.hh,
+//  - StdExperimental: `std::experimental::scope_exit`, `scope_fail`, `scope_success`, when the
+//    standard library provides <experimental/scope>.
+//
+// The `bench_compare_csv` target writes the results to deferral_compare.csv.
+
+#include "deferral.hh"
+#include "deferral_scope.hh"
+#include "reference_guards.hh"
+
+#include <benchmark/benchmark.h>
+
+#if defined(__has_include)
+#if __has_include(<experimental/scope>)
+#include <experimental/scope>
+#define DEFERRAL_BENCH_HAS_EXPERIMENTAL_SCOPE 1
+#endif
+#endif // defined(__has_include)
+
+namespace {
+
+struct Increment {
+  int* x;
+  void operator()() const noexcept { ++*x; }
+};
+
+struct Deferral {
+  template <typename F>
+  using exit_t = deferral::DeferExit<F>;
+  template <typename F>
+  using fail_t = deferral::DeferFail<F>;
+  template <typename F>
+  using success_t = deferral::DeferSuccess<F>;
+};
+
+struct DeferralScope {
+  template <typename F>
+  using exit_t = deferral::scope_exit<F>;
+  template <typename F>
+  using fail_t = deferral::scope_fail<F>;
+  template <typename F>
+  using success_t = deferral::scope_success<F>;
+};
+
+struct Reference {
+  template <typename F>
+  using exit_t = reference::scope_exit<F>;
+  template <typename F>
+  using fail_t = reference::scope_fail<F>;
+  template <typename F>
+  using success_t = reference::scope_success<F>;
+};
+
+#if defined(DEFERRAL_BENCH_HAS_EXPERIMENTAL_SCOPE)
+struct StdExperimental {
+  template <typename F>
+  using exit_t = std::experimental::scope_exit<F>;
+  template <typename F>
+  using fail_t = std::experimental::scope_fail<F>;
+  template <typename F>
+  using success_t = std::experimental::scope_success<F>;
+};
+#endif // defined(DEFERRAL_BENCH_HAS_EXPERIMENTAL_SCOPE)
+
+struct Exit {
+  template <typename libT, typename F>
+  using guard_t = typename libT::template exit_t<F>;
+};
+
+struct Fail {
+  template <typename libT, typename F>
+  using guard_t = typename libT::template fail_t<F>;
+};
+
+struct Success {
+  template <typename libT, typename F>
+  using guard_t = typename libT::template success_t<F>;
+};
+
+template <typename libT, typename kindT>
+void BM_Exit(benchmark::State& state) {
+  using guard_t = typename kindT::template guard_t<libT, Increment>;
+  int x         = 0;
+  for(auto _ : state) {
+    guard_t g{Increment{&x}};
+    benchmark::DoNotOptimize(x);
+  }
+  benchmark::DoNotOptimize(x);
+  state.counters["bytes"] = static_cast<double>(sizeof(guard_t));
+}
+
+template <typename libT, typename kindT>
+void BM_Release(benchmark::State& state) {
+  using guard_t = typename kindT::template guard_t<libT, Increment>;
+  int x         = 0;
+  for(auto _ : state) {
+    guard_t g{Increment{&x}};
+    benchmark::DoNotOptimize(x);
+    g.release();
+  }
+  benchmark::DoNotOptimize(x);
+  state.counters["bytes"] = static_cast<double>(sizeof(guard_t));
+}
+
+#define DEFERRAL_COMPARE(lib)                                                                      \
+  BENCHMARK_TEMPLATE(BM_Exit, lib, Exit);                                                          \
+  BENCHMARK_TEMPLATE(BM_Exit, lib, Fail);                                                          \
+  BENCHMARK_TEMPLATE(BM_Exit, lib, Success);                                                       \
+  BENCHMARK_TEMPLATE(BM_Release, lib, Exit);                                                       \
+  BENCHMARK_TEMPLATE(BM_Release, lib, Fail);                                                       \
+  BENCHMARK_TEMPLATE(BM_Release, lib, Success)
+
+DEFERRAL_COMPARE(Deferral);
+DEFERRAL_COMPARE(DeferralScope);
+DEFERRAL_COMPARE(Reference);
+#if defined(DEFERRAL_BENCH_HAS_EXPERIMENTAL_SCOPE)
+DEFERRAL_COMPARE(StdExperimental);
+#endif // defined(DEFERRAL_BENCH_HAS_EXPERIMENTAL_SCOPE)
+
+} // namespace
@@ -0,0 +1,104 @@
+// Guard construction and destruction cost in unoptimized builds.
+//
+// This file is built at -O0 and -Og. Every deferral guard is expected to cost no more than the
+// hand-written RAII struct below: the tag operator, factory function, constructor and policy are
+// all forced inline, so the only call left is the deferred lambda itself.
+
+#include "deferral.hh"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+template <typename funcT>
+struct HandRolledGuard {
+  funcT func;
+  ~HandRolledGuard() { func(); }
+};
+
+void BM_NoGuard(benchmark::State& state) {
+  int x = 0;
+  for(auto _ : state) {
+    {
+      benchmark::DoNotOptimize(x);
+      x += 1;
+    }
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_NoGuard);
+
+void BM_HandRolled(benchmark::State& state) {
+  int x = 0;
+  for(auto _ : state) {
+    {
+      auto f = [&]() { x += 1; };
+      HandRolledGuard<decltype(f)> g{f};
+      benchmark::DoNotOptimize(x);
+    }
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_HandRolled);
+
+void BM_Defer(benchmark::State& state) {
+  int x = 0;
+  for(auto _ : state) {
+    {
+      defer { x += 1; };
+      benchmark::DoNotOptimize(x);
+    }
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_Defer);
+
+void BM_DeferNamed(benchmark::State& state) {
+  int x = 0;
+  for(auto _ : state) {
+    {
+      defer_(d) { x += 1; };
+      benchmark::DoNotOptimize(x);
+    }
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_DeferNamed);
+
+void BM_DeferFail(benchmark::State& state) {
+  int x = 0;
+  for(auto _ : state) {
+    {
+      defer_fail { x += 1; };
+      benchmark::DoNotOptimize(x);
+    }
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_DeferFail);
+
+void BM_DeferSuccess(benchmark::State& state) {
+  int x = 0;
+  for(auto _ : state) {
+    {
+      defer_success { x += 1; };
+      benchmark::DoNotOptimize(x);
+    }
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_DeferSuccess);
+
+void BM_MakeDeferExit(benchmark::State& state) {
+  int x = 0;
+  for(auto _ : state) {
+    {
+      auto d = deferral::make_defer_exit([&]() { x += 1; });
+      benchmark::DoNotOptimize(x);
+    }
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_MakeDeferExit);
+
+} // namespace
@@ -0,0 +1,77 @@
+// Denormal-heavy kernels with and without `DeferFloatMode`, at -O2.
+//
+//  - BM_Kernel: y[i] = x[i] * 0.5f over 4096 floats. With denormal inputs (and results), each
+//    operation takes a microcode assist unless the guard flushes denormals to zero.
+//  - BM_Enter: entering and leaving the guard alone, when it changes the mode and when the mode is
+//    already in effect, compared with `fegetenv`, a direct MXCSR write and `fesetenv`.
+
+#include "deferral_fpenv.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <cfenv>
+#include <cfloat>
+#include <vector>
+
+namespace {
+
+constexpr int kSize = 4096;
+
+__attribute__((noinline)) void kernel(const float* x, float* y, int n) {
+  for(int i = 0; i < n; ++i) { y[i] = x[i] * 0.5f; }
+}
+
+enum Mode { Normal, Denormal, DenormalFlushed };
+
+template <Mode mode>
+void BM_Kernel(benchmark::State& state) {
+  std::vector<float> x(kSize, mode == Normal ? 1.0f : FLT_MIN / 8), y(kSize);
+  for(auto _ : state) {
+    if(mode == DenormalFlushed) {
+      deferral::DeferFloatMode ftz{deferral::FloatMode::flush_denormals()};
+      kernel(x.data(), y.data(), kSize);
+    } else {
+      kernel(x.data(), y.data(), kSize);
+    }
+    benchmark::DoNotOptimize(y.data());
+  }
+  state.SetItemsProcessed(state.iterations() * kSize);
+}
+
+void BM_EnterChange(benchmark::State& state) {
+  for(auto _ : state) {
+    deferral::DeferFloatMode ftz{deferral::FloatMode::flush_denormals()};
+    benchmark::ClobberMemory();
+  }
+}
+
+void BM_EnterUnchanged(benchmark::State& state) {
+  deferral::DeferFloatMode outer{deferral::FloatMode::flush_denormals()};
+  for(auto _ : state) {
+    deferral::DeferFloatMode ftz{deferral::FloatMode::flush_denormals()};
+    benchmark::ClobberMemory();
+  }
+}
+
+#if defined(DEFERRAL_FP_X86)
+void BM_EnterFenv(benchmark::State& state) {
+  for(auto _ : state) {
+    std::fenv_t saved;
+    std::fegetenv(&saved);
+    _mm_setcsr(_mm_getcsr() | 0x8040u);
+    benchmark::ClobberMemory();
+    std::fesetenv(&saved);
+  }
+}
+#endif // defined(DEFERRAL_FP_X86)
+
+BENCHMARK_TEMPLATE(BM_Kernel, Normal);
+BENCHMARK_TEMPLATE(BM_Kernel, Denormal);
+BENCHMARK_TEMPLATE(BM_Kernel, DenormalFlushed);
+BENCHMARK(BM_EnterChange);
+BENCHMARK(BM_EnterUnchanged);
+#if defined(DEFERRAL_FP_X86)
+BENCHMARK(BM_EnterFenv);
+#endif // defined(DEFERRAL_FP_X86)
+
+} // namespace
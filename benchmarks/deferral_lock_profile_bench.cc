@@ -0,0 +1,54 @@
+// The cost of `DEFER_PROFILE_LOCK` on an uncontended `std::mutex`, at -O2.
+//
+//  - BM_LockGuard: `std::lock_guard`.
+//  - BM_PlainLock: `PlainLock`, the guard `DEFER_PROFILE_LOCK` creates with
+//    `DEFERRAL_NO_LOCK_PROFILE` defined.
+//  - BM_ProfiledLock: `DEFER_PROFILE_LOCK`, two clock reads and the counter updates.
+
+#include "deferral_lock_profile.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <mutex>
+
+namespace {
+
+__attribute__((noinline)) void work(int& x) {
+  ++x;
+}
+
+void BM_LockGuard(benchmark::State& state) {
+  std::mutex m;
+  int x = 0;
+  for(auto _ : state) {
+    std::lock_guard<std::mutex> lock{m};
+    work(x);
+  }
+  benchmark::DoNotOptimize(x);
+}
+
+void BM_PlainLock(benchmark::State& state) {
+  std::mutex m;
+  int x = 0;
+  for(auto _ : state) {
+    deferral::profile::PlainLock<std::mutex> lock{m};
+    work(x);
+  }
+  benchmark::DoNotOptimize(x);
+}
+
+void BM_ProfiledLock(benchmark::State& state) {
+  std::mutex m;
+  int x = 0;
+  for(auto _ : state) {
+    DEFER_PROFILE_LOCK("bench", m);
+    work(x);
+  }
+  benchmark::DoNotOptimize(x);
+}
+
+BENCHMARK(BM_LockGuard);
+BENCHMARK(BM_PlainLock);
+BENCHMARK(BM_ProfiledLock);
+
+} // namespace
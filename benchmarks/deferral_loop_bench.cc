@@ -0,0 +1,88 @@
+// A guard per loop iteration versus one re-armable guard, at -O2.
+//
+// The fresh guards are constructed and released in every iteration; the fail and success guards
+// also take a new exception count snapshot each time. The re-armable guards are constructed once
+// and only armed and disarmed in the loop.
+
+#include "deferral.hh"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+__attribute__((noinline)) void undo(int& x) noexcept {
+  x = 0;
+}
+
+void BM_FreshExit(benchmark::State& state) {
+  int x = 0;
+  for(auto _ : state) {
+    defer_(d) { undo(x); };
+    ++x;
+    benchmark::DoNotOptimize(x);
+    d.release();
+  }
+}
+BENCHMARK(BM_FreshExit);
+
+void BM_RearmExit(benchmark::State& state) {
+  int x = 0;
+  auto g = deferral::make_rearmable_exit([&]() { undo(x); });
+  g.disarm();
+  for(auto _ : state) {
+    g.arm();
+    ++x;
+    benchmark::DoNotOptimize(x);
+    g.disarm();
+  }
+}
+BENCHMARK(BM_RearmExit);
+
+void BM_FreshFail(benchmark::State& state) {
+  int x = 0;
+  for(auto _ : state) {
+    defer_fail { undo(x); };
+    ++x;
+    benchmark::DoNotOptimize(x);
+  }
+}
+BENCHMARK(BM_FreshFail);
+
+void BM_RearmFail(benchmark::State& state) {
+  int x = 0;
+  auto g = deferral::make_rearmable_fail([&]() noexcept { undo(x); });
+  g.disarm();
+  for(auto _ : state) {
+    g.arm();
+    ++x;
+    benchmark::DoNotOptimize(x);
+    g.disarm();
+  }
+}
+BENCHMARK(BM_RearmFail);
+
+void BM_FreshSuccess(benchmark::State& state) {
+  int x = 0;
+  for(auto _ : state) {
+    defer_success_(d) { undo(x); };
+    ++x;
+    benchmark::DoNotOptimize(x);
+    d.release();
+  }
+}
+BENCHMARK(BM_FreshSuccess);
+
+void BM_RearmSuccess(benchmark::State& state) {
+  int x = 0;
+  auto g = deferral::make_rearmable_success([&]() noexcept { undo(x); });
+  g.disarm();
+  for(auto _ : state) {
+    g.arm();
+    ++x;
+    benchmark::DoNotOptimize(x);
+    g.disarm();
+  }
+}
+BENCHMARK(BM_RearmSuccess);
+
+} // namespace
@@ -0,0 +1,94 @@
+// Page faults moved out of a measured region by `DeferPrefault`, at -O2.
+//
+// Each iteration maps 4 MiB of fresh anonymous memory outside of the timed region, then writes
+// one byte per page in the timed region, the first touch of a latency-critical loop.
+//  - BM_FirstTouch: no guard; every write takes a page fault.
+//  - BM_Prefaulted: a `DeferPrefault` guard created before the timed region.
+// The `faults` counter is the number of minor faults per iteration inside the timed region.
+//  - BM_Populate/BM_Lock: the cost of the guard itself, per 4 MiB.
+
+#include "deferral_prefault.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr std::size_t kSize = 4 << 20;
+
+unsigned char* map_fresh() {
+  return static_cast<unsigned char*>(
+      mmap(nullptr, kSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+}
+
+long minor_faults() {
+  rusage usage{};
+  getrusage(RUSAGE_THREAD, &usage);
+  return usage.ru_minflt;
+}
+
+__attribute__((noinline)) void touch(unsigned char* p, std::size_t n, std::size_t stride) {
+  for(std::size_t i = 0; i < n; i += stride) { p[i] = 1; }
+}
+
+template <bool prefault>
+void BM_Touch(benchmark::State& state) {
+  const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  long faults            = 0;
+  for(auto _ : state) {
+    state.PauseTiming();
+    unsigned char* p = map_fresh();
+    {
+      deferral::DeferPrefault g{p, prefault ? kSize : 0};
+      state.ResumeTiming();
+      const long before = minor_faults();
+      touch(p, kSize, page);
+      faults += minor_faults() - before;
+      state.PauseTiming();
+    }
+    munmap(p, kSize);
+    state.ResumeTiming();
+  }
+  state.counters["faults"] = benchmark::Counter(
+      static_cast<double>(faults), benchmark::Counter::kAvgIterations);
+}
+
+template <deferral::Prefault mode>
+void BM_Guard(benchmark::State& state) {
+  for(auto _ : state) {
+    state.PauseTiming();
+    unsigned char* p = map_fresh();
+    state.ResumeTiming();
+    {
+      deferral::DeferPrefault g{p, kSize, mode};
+      benchmark::DoNotOptimize(p);
+    }
+    state.PauseTiming();
+    munmap(p, kSize);
+    state.ResumeTiming();
+  }
+}
+
+void BM_FirstTouch(benchmark::State& state) {
+  BM_Touch<false>(state);
+}
+void BM_Prefaulted(benchmark::State& state) {
+  BM_Touch<true>(state);
+}
+void BM_Populate(benchmark::State& state) {
+  BM_Guard<deferral::Prefault::populate>(state);
+}
+void BM_Lock(benchmark::State& state) {
+  BM_Guard<deferral::Prefault::lock>(state);
+}
+
+BENCHMARK(BM_FirstTouch);
+BENCHMARK(BM_Prefaulted);
+BENCHMARK(BM_Populate);
+BENCHMARK(BM_Lock);
+
+} // namespace
@@ -0,0 +1,67 @@
+// The cost of `DEFER_PROFILE` on a hot path, at -O2.
+//
+//  - BM_Plain: the work with no guard.
+//  - BM_Defer: the work under a `defer` guard.
+//  - BM_Profile: the work under a `DEFER_PROFILE` guard at the default period of 1,000.
+//  - BM_ProfileEvery: the same with every span sampled, the cost of one sample.
+
+#include "deferral.hh"
+#include "deferral_profile.hh"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+__attribute__((noinline)) void work(int& x) {
+  ++x;
+}
+
+__attribute__((noinline)) void undo(int& x) noexcept {
+  --x;
+}
+
+void BM_Plain(benchmark::State& state) {
+  int x = 0;
+  for(auto _ : state) {
+    work(x);
+    undo(x);
+  }
+  benchmark::DoNotOptimize(x);
+}
+
+void BM_Defer(benchmark::State& state) {
+  int x = 0;
+  for(auto _ : state) {
+    defer { undo(x); };
+    work(x);
+  }
+  benchmark::DoNotOptimize(x);
+}
+
+void BM_Profile(benchmark::State& state) {
+  deferral::profile::set_sample_period(1000);
+  int x = 0;
+  for(auto _ : state) {
+    DEFER_PROFILE("bench") { undo(x); };
+    work(x);
+  }
+  benchmark::DoNotOptimize(x);
+}
+
+void BM_ProfileEvery(benchmark::State& state) {
+  deferral::profile::set_sample_period(1);
+  int x = 0;
+  for(auto _ : state) {
+    DEFER_PROFILE("bench.every") { undo(x); };
+    work(x);
+  }
+  benchmark::DoNotOptimize(x);
+  deferral::profile::set_sample_period(1000);
+}
+
+BENCHMARK(BM_Plain);
+BENCHMARK(BM_Defer);
+BENCHMARK(BM_Profile);
+BENCHMARK(BM_ProfileEvery);
+
+} // namespace
@@ -0,0 +1,88 @@
+// Reader/writer throughput of a read-mostly routing table, at -O2.
+//
+//  - BM_Publish: readers load a `std::atomic<Table*>` and look up a route; thread 0 is a writer
+//    that updates the table through `DeferPublish` every `kWriteEvery` iterations. Reclaimed
+//    versions are kept until the benchmark ends, in place of a grace period.
+//  - BM_SharedMutex: the same workload with the table behind a `std::shared_mutex`, updated in
+//    place under the exclusive lock.
+//
+// Run with --benchmark_filter and compare items per second across thread counts.
+
+#include "deferral_publish.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+namespace {
+
+constexpr int kRoutes     = 1024;
+constexpr int kWriteEvery = 1024;
+
+using Table = std::map<int, int>;
+
+Table initial_table() {
+  Table t;
+  for(int i = 0; i < kRoutes; ++i) { t[i] = i; }
+  return t;
+}
+
+std::atomic<Table*> shared_table{nullptr};
+std::mutex writer_mutex;
+std::vector<Table*> retired;
+
+struct Retire {
+  void operator()(Table* old) const noexcept { retired.push_back(old); }
+};
+
+void BM_Publish(benchmark::State& state) {
+  if(state.thread_index() == 0) { shared_table.store(new Table(initial_table())); }
+  int key = state.thread_index();
+  long n  = 0;
+  for(auto _ : state) {
+    key = (key * 31 + 7) % kRoutes;
+    if(state.thread_index() == 0 && ++n % kWriteEvery == 0) {
+      std::lock_guard<std::mutex> lock{writer_mutex};
+      auto next = deferral::make_defer_publish(shared_table, Retire{});
+      (*next)[key] += 1;
+    } else {
+      const Table* t = shared_table.load(std::memory_order_acquire);
+      benchmark::DoNotOptimize(t->find(key)->second);
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  if(state.thread_index() == 0) {
+    for(Table* t : retired) { delete t; }
+    retired.clear();
+    delete shared_table.exchange(nullptr);
+  }
+}
+
+Table locked_table;
+std::shared_mutex table_mutex;
+
+void BM_SharedMutex(benchmark::State& state) {
+  if(state.thread_index() == 0) { locked_table = initial_table(); }
+  int key = state.thread_index();
+  long n  = 0;
+  for(auto _ : state) {
+    key = (key * 31 + 7) % kRoutes;
+    if(state.thread_index() == 0 && ++n % kWriteEvery == 0) {
+      std::unique_lock<std::shared_mutex> lock{table_mutex};
+      locked_table[key] += 1;
+    } else {
+      std::shared_lock<std::shared_mutex> lock{table_mutex};
+      benchmark::DoNotOptimize(locked_table.find(key)->second);
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_Publish)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_SharedMutex)->ThreadRange(1, 8)->UseRealTime();
+
+} // namespace
@@ -0,0 +1,48 @@
+// Entering and leaving a `RealtimeSection`, at -O2.
+//
+//  - BM_Unchanged: the requested scheduling is already in effect, so the guard makes one call to
+//    read it and none on exit.
+//  - BM_Changed: SCHED_OTHER to SCHED_BATCH and back, one call to read, one to set and one to
+//    restore.
+//  - BM_HandWritten: the same change with `pthread_getschedparam` and two `pthread_setschedparam`.
+
+#include "deferral_realtime.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace {
+
+void BM_Unchanged(benchmark::State& state) {
+  for(auto _ : state) {
+    deferral::RealtimeSection rt{deferral::RealtimeConfig{}.scheduling(SCHED_OTHER, 0)};
+    benchmark::DoNotOptimize(rt);
+  }
+}
+
+void BM_Changed(benchmark::State& state) {
+  for(auto _ : state) {
+    deferral::RealtimeSection rt{deferral::RealtimeConfig{}.scheduling(SCHED_BATCH, 0)};
+    benchmark::DoNotOptimize(rt);
+  }
+}
+
+void BM_HandWritten(benchmark::State& state) {
+  const pthread_t self = pthread_self();
+  for(auto _ : state) {
+    int policy;
+    sched_param saved{};
+    pthread_getschedparam(self, &policy, &saved);
+    sched_param param{};
+    pthread_setschedparam(self, SCHED_BATCH, &param);
+    pthread_setschedparam(self, policy, &saved);
+  }
+}
+
+BENCHMARK(BM_Unchanged);
+BENCHMARK(BM_Changed);
+BENCHMARK(BM_HandWritten);
+
+} // namespace
@@ -0,0 +1,74 @@
+// Deep recursion with three guards per frame, at -O2.
+//
+// Each benchmark recurses to the depth given as its argument through a function that holds three
+// guards of one kind (none, a hand-written RAII struct, `defer`, `defer_fail` or `defer_success`),
+// the shape of a recursive-descent parser that undoes state on the way out. It reports the
+// throughput in frames per second, the stack bytes per frame measured from frame addresses, and
+// `max_depth`, the depth that fits in an 8 MiB stack (the Linux default for the main thread).
+
+#include "deferral.hh"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+constexpr double stack_bytes = 8.0 * 1024 * 1024;
+
+int sink_value = 0;
+char* leaf_frame = nullptr;
+
+__attribute__((noinline)) void sink(int x) noexcept {
+  benchmark::DoNotOptimize(sink_value += x);
+}
+
+__attribute__((noinline)) int leaf() noexcept {
+  leaf_frame = static_cast<char*>(__builtin_frame_address(0));
+  return 0;
+}
+
+struct Raii {
+  int& x;
+  ~Raii() { sink(x); }
+};
+
+#define DEFERRAL_RECURSIVE_FRAME(name, ...)                                                        \
+  __attribute__((noinline)) int name(int depth) {                                                  \
+    int a = depth + 1;                                                                             \
+    int b = depth * 2;                                                                             \
+    int c = depth - 3;                                                                             \
+    __VA_ARGS__                                                                                    \
+    if(depth == 0) { return leaf(); }                                                              \
+    int r = name(depth - 1);                                                                       \
+    benchmark::DoNotOptimize(r);                                                                   \
+    return r + a + b + c;                                                                          \
+  }
+
+DEFERRAL_RECURSIVE_FRAME(frame_none)
+DEFERRAL_RECURSIVE_FRAME(frame_raii, Raii g1{a}; Raii g2{b}; Raii g3{c};)
+DEFERRAL_RECURSIVE_FRAME(frame_defer, defer { sink(a); }; defer { sink(b); }; defer { sink(c); };)
+DEFERRAL_RECURSIVE_FRAME(frame_defer_fail, defer_fail { sink(a); }; defer_fail { sink(b); };
+                         defer_fail { sink(c); };)
+DEFERRAL_RECURSIVE_FRAME(frame_defer_success, defer_success { sink(a); };
+                         defer_success { sink(b); }; defer_success { sink(c); };)
+
+template <int (*frame)(int)>
+void BM_Recurse(benchmark::State& state) {
+  const int depth = static_cast<int>(state.range(0));
+  for(auto _ : state) { benchmark::DoNotOptimize(frame(depth)); }
+
+  char* const top = static_cast<char*>(__builtin_frame_address(0));
+  frame(depth);
+  const double bytes_per_frame = static_cast<double>(top - leaf_frame) / (depth + 1);
+  state.counters["frames"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) * (depth + 1), benchmark::Counter::kIsRate);
+  state.counters["bytes_per_frame"] = bytes_per_frame;
+  state.counters["max_depth"]       = stack_bytes / bytes_per_frame;
+}
+
+BENCHMARK_TEMPLATE(BM_Recurse, frame_none)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_Recurse, frame_raii)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_Recurse, frame_defer)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_Recurse, frame_defer_fail)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_Recurse, frame_defer_success)->Arg(1000);
+
+} // namespace
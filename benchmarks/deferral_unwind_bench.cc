@@ -0,0 +1,112 @@
+// Cost of unwinding through guards, at -O2.
+//
+// Each benchmark throws from the bottom of a chain of 1, 8 or 64 frames and catches at the top.
+// Every frame holds one guard of the given kind: none, a hand-written RAII struct, `defer`,
+// `defer_fail` or `defer_success`. Besides the time per throw, the `cycles` counter reports the
+// time stamp counter ticks per throw on x86. The landing pads each kind adds are reported by the
+// `bench_unwind_tables` target.
+//
+// The unwinder and personality routine come from the standard library the benchmark is built
+// with. To compare libstdc++ and libc++, configure a second build with `-stdlib=libc++` and a
+// Google Benchmark built against libc++.
+
+#include "deferral.hh"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+#if defined(__x86_64__) || defined(__i386__)
+inline unsigned long long cycle_count() {
+  return __builtin_ia32_rdtsc();
+}
+#else
+inline unsigned long long cycle_count() {
+  return 0;
+}
+#endif
+
+struct Error {};
+
+struct NoGuard {};
+struct Raii {};
+struct Defer {};
+struct DeferFail {};
+struct DeferSuccess {};
+
+struct RaiiGuard {
+  int& counter;
+  ~RaiiGuard() { ++counter; }
+};
+
+__attribute__((noinline)) void raise(int& counter) {
+  benchmark::DoNotOptimize(counter);
+  throw Error{};
+}
+
+template <typename kindT>
+__attribute__((noinline)) void frame(int depth, int& counter);
+
+template <typename kindT>
+inline void next(int depth, int& counter) {
+  if(depth > 1) {
+    frame<kindT>(depth - 1, counter);
+  } else {
+    raise(counter);
+  }
+  // Keeps the recursive call from becoming a tail call.
+  benchmark::DoNotOptimize(counter);
+}
+
+template <>
+__attribute__((noinline)) void frame<NoGuard>(int depth, int& counter) {
+  next<NoGuard>(depth, counter);
+}
+
+template <>
+__attribute__((noinline)) void frame<Raii>(int depth, int& counter) {
+  RaiiGuard g{counter};
+  next<Raii>(depth, counter);
+}
+
+template <>
+__attribute__((noinline)) void frame<Defer>(int depth, int& counter) {
+  defer { ++counter; };
+  next<Defer>(depth, counter);
+}
+
+template <>
+__attribute__((noinline)) void frame<DeferFail>(int depth, int& counter) {
+  defer_fail { ++counter; };
+  next<DeferFail>(depth, counter);
+}
+
+template <>
+__attribute__((noinline)) void frame<DeferSuccess>(int depth, int& counter) {
+  defer_success { ++counter; };
+  next<DeferSuccess>(depth, counter);
+}
+
+template <typename kindT>
+void BM_Throw(benchmark::State& state) {
+  const int depth           = static_cast<int>(state.range(0));
+  int counter               = 0;
+  unsigned long long cycles = 0;
+  for(auto _ : state) {
+    const unsigned long long start = cycle_count();
+    try {
+      frame<kindT>(depth, counter);
+    } catch(const Error&) {}
+    cycles += cycle_count() - start;
+  }
+  benchmark::DoNotOptimize(counter);
+  state.counters["cycles"] =
+      benchmark::Counter(static_cast<double>(cycles), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK_TEMPLATE(BM_Throw, NoGuard)->Arg(1)->Arg(8)->Arg(64);
+BENCHMARK_TEMPLATE(BM_Throw, Raii)->Arg(1)->Arg(8)->Arg(64);
+BENCHMARK_TEMPLATE(BM_Throw, Defer)->Arg(1)->Arg(8)->Arg(64);
+BENCHMARK_TEMPLATE(BM_Throw, DeferFail)->Arg(1)->Arg(8)->Arg(64);
+BENCHMARK_TEMPLATE(BM_Throw, DeferSuccess)->Arg(1)->Arg(8)->Arg(64);
+
+} // namespace
@@ -0,0 +1,70 @@
+// Throughput of `secure_wipe` at -O2, and its effect on the cache.
+//
+//  - BM_Wipe: bytes per second zeroed by `memset` (which the optimizer may remove in real code),
+//    the plain-store wipe, the non-temporal wipe and `secure_wipe`, which picks between the two at
+//    DEFERRAL_WIPE_NONTEMPORAL_THRESHOLD.
+//  - BM_WipeThenRead: wipes a 64 MiB buffer, then reads a 1 MiB working set, which plain stores
+//    evict from the cache and non-temporal stores do not.
+
+#include "deferral_wipe.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+namespace {
+
+struct Memset {
+  static void wipe(void* p, std::size_t n) noexcept {
+    std::memset(p, 0, n);
+    benchmark::ClobberMemory();
+  }
+};
+
+struct Plain {
+  static void wipe(void* p, std::size_t n) noexcept { deferral::internal::wipe_plain(p, n); }
+};
+
+#if defined(DEFERRAL_WIPE_X86)
+struct NonTemporal {
+  static void wipe(void* p, std::size_t n) noexcept { deferral::internal::wipe_nontemporal(p, n); }
+};
+#endif // defined(DEFERRAL_WIPE_X86)
+
+struct SecureWipe {
+  static void wipe(void* p, std::size_t n) noexcept { deferral::secure_wipe(p, n); }
+};
+
+template <typename wipeT>
+void BM_Wipe(benchmark::State& state) {
+  const auto size = static_cast<std::size_t>(state.range(0));
+  std::vector<unsigned char> buffer(size, 0xa5);
+  for(auto _ : state) { wipeT::wipe(buffer.data(), size); }
+  state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * size));
+}
+
+template <typename wipeT>
+void BM_WipeThenRead(benchmark::State& state) {
+  const auto size = static_cast<std::size_t>(state.range(0));
+  std::vector<unsigned char> buffer(size, 0xa5);
+  std::vector<long> working_set(1024 * 1024 / sizeof(long), 1);
+  for(auto _ : state) {
+    wipeT::wipe(buffer.data(), size);
+    long sum = 0;
+    for(long x : working_set) { sum += x; }
+    benchmark::DoNotOptimize(sum);
+  }
+}
+
+#define DEFERRAL_WIPE_BENCH(wipe)                                                                  \
+  BENCHMARK_TEMPLATE(BM_Wipe, wipe)->RangeMultiplier(4)->Range(4 << 10, 64 << 20);                 \
+  BENCHMARK_TEMPLATE(BM_WipeThenRead, wipe)->Arg(64 << 20)
+
+DEFERRAL_WIPE_BENCH(Memset);
+DEFERRAL_WIPE_BENCH(Plain);
+#if defined(DEFERRAL_WIPE_X86)
+DEFERRAL_WIPE_BENCH(NonTemporal);
+#endif // defined(DEFERRAL_WIPE_X86)
+DEFERRAL_WIPE_BENCH(SecureWipe);
+
+} // namespace
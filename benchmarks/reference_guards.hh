@@ -0,0 +1,72 @@
+// Minimal reference scope guards for the comparison benchmark.
+//
+// A plain implementation of `scope_exit`, `scope_fail` and `scope_success` as specified by the
+// Library Fundamentals TS v3 (<experimental/scope>): a stored function, an active flag, and for
+// the fail and success guards the `std::uncaught_exceptions()` count at construction. No forced
+// inlining and no other tuning, to serve as an in-house baseline.
+
+#pragma once
+
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+namespace reference {
+
+template <typename F>
+class scope_exit {
+public:
+  template <typename Fn>
+  explicit scope_exit(Fn&& fn) noexcept(std::is_nothrow_constructible<F, Fn>::value) :
+      func_(std::forward<Fn>(fn)) {}
+  scope_exit(const scope_exit&)            = delete;
+  scope_exit& operator=(const scope_exit&) = delete;
+  ~scope_exit() {
+    if(active_) func_();
+  }
+  void release() noexcept { active_ = false; }
+
+private:
+  F func_;
+  bool active_ = true;
+};
+
+template <typename F>
+class scope_fail {
+public:
+  template <typename Fn>
+  explicit scope_fail(Fn&& fn) noexcept(std::is_nothrow_constructible<F, Fn>::value) :
+      func_(std::forward<Fn>(fn)) {}
+  scope_fail(const scope_fail&)            = delete;
+  scope_fail& operator=(const scope_fail&) = delete;
+  ~scope_fail() {
+    if(active_ && std::uncaught_exceptions() > count_) func_();
+  }
+  void release() noexcept { active_ = false; }
+
+private:
+  F func_;
+  int count_   = std::uncaught_exceptions();
+  bool active_ = true;
+};
+
+template <typename F>
+class scope_success {
+public:
+  template <typename Fn>
+  explicit scope_success(Fn&& fn) noexcept(std::is_nothrow_constructible<F, Fn>::value) :
+      func_(std::forward<Fn>(fn)) {}
+  scope_success(const scope_success&)            = delete;
+  scope_success& operator=(const scope_success&) = delete;
+  ~scope_success() noexcept(noexcept(std::declval<F&>()())) {
+    if(active_ && std::uncaught_exceptions() <= count_) func_();
+  }
+  void release() noexcept { active_ = false; }
+
+private:
+  F func_;
+  int count_   = std::uncaught_exceptions();
+  bool active_ = true;
+};
+
+} // namespace reference
@@ -0,0 +1,111 @@
+# benchmarks/stack_usage/run.cmake
+#
+# Compiles one generated frame of a recursive-descent function per guard kind, with three guards
+# per frame, and reports the frame's stack usage from `-fstack-usage`:
+#  - none:          no guard,
+#  - raii, raii_exit, raii_fail, raii_success: hand-written RAII structs with the same state as the
+#                   deferral guard they are compared with (a reference to the captured local, plus an
+#                   active flag or the `std::uncaught_exceptions()` count at construction),
+#  - defer:         `defer`, compared with raii,
+#  - defer_exit:    `defer_(name)`, a `DeferExit`, compared with raii_exit,
+#  - defer_fail:    `defer_fail`, a `DeferFail`, compared with raii_fail,
+#  - defer_success: `defer_success`, a `DeferSuccess`, compared with raii_success.
+#
+# For each optimization level it prints the frame size, the bytes per guard over `none`, and the
+# difference with the RAII counterpart. The script fails if a deferral frame is larger than its
+# RAII counterpart at -O2; -O0 and -Og differences are reported only.
+#
+#   cmake -DDEFERRAL_SOURCE_DIR=<repo> -DBINARY_DIR=<dir> [-DCXX_COMPILER=<c++>] -P run.cmake
+
+cmake_minimum_required(VERSION 3.15)
+
+if(NOT DEFINED DEFERRAL_SOURCE_DIR OR NOT DEFINED BINARY_DIR)
+  message(FATAL_ERROR "DEFERRAL_SOURCE_DIR and BINARY_DIR are required")
+endif()
+if(NOT DEFINED CXX_COMPILER)
+  set(CXX_COMPILER c++)
+endif()
+
+file(MAKE_DIRECTORY "${BINARY_DIR}")
+
+set(kinds none raii raii_exit raii_fail raii_success defer defer_exit defer_fail defer_success)
+set(guards_per_frame 3)
+set(levels O0 Og O2)
+
+set(baseline_defer raii)
+set(baseline_defer_exit raii_exit)
+set(baseline_defer_fail raii_fail)
+set(baseline_defer_success raii_success)
+
+set(guard_none "")
+set(guard_raii "  Raii g1{a};\n  Raii g2{b};\n  Raii g3{c};\n")
+set(guard_raii_exit "  RaiiExit g1{a};\n  RaiiExit g2{b};\n  RaiiExit g3{c};\n")
+set(guard_raii_fail "  RaiiFail g1{a};\n  RaiiFail g2{b};\n  RaiiFail g3{c};\n")
+set(guard_raii_success "  RaiiSuccess g1{a};\n  RaiiSuccess g2{b};\n  RaiiSuccess g3{c};\n")
+set(guard_defer "  defer { sink(a); };\n  defer { sink(b); };\n  defer { sink(c); };\n")
+set(guard_defer_exit
+  "  defer_(g1) { sink(a); };\n  defer_(g2) { sink(b); };\n  defer_(g3) { sink(c); };\n")
+set(guard_defer_fail
+  "  defer_fail { sink(a); };\n  defer_fail { sink(b); };\n  defer_fail { sink(c); };\n")
+set(guard_defer_success
+  "  defer_success { sink(a); };\n  defer_success { sink(b); };\n  defer_success { sink(c); };\n")
+
+foreach(kind IN LISTS kinds)
+  file(WRITE "${BINARY_DIR}/${kind}.cc"
+    "#include \"deferral.hh\"\n\n"
+    "void sink(int) noexcept;\nint descend(int);\n\n"
+    "struct Raii {\n  int& x;\n  ~Raii() { sink(x); }\n};\n\n"
+    "struct RaiiExit {\n  int& x;\n  bool active = true;\n"
+    "  ~RaiiExit() {\n    if(active) sink(x);\n  }\n};\n\n"
+    "struct RaiiFail {\n  int& x;\n  int count = std::uncaught_exceptions();\n"
+    "  ~RaiiFail() {\n    if(std::uncaught_exceptions() > count) sink(x);\n  }\n};\n\n"
+    "struct RaiiSuccess {\n  int& x;\n  int count = std::uncaught_exceptions();\n"
+    "  ~RaiiSuccess() {\n    if(std::uncaught_exceptions() <= count) sink(x);\n  }\n};\n\n"
+    "int frame(int x) {\n  int a = x + 1;\n  int b = x * 2;\n  int c = x - 3;\n"
+    "${guard_${kind}}  return descend(x) + a + b + c;\n}\n")
+endforeach()
+
+# Sets <prefix>_bytes to the stack usage of `frame(int)` in the .su file `su_file`.
+function(frame_stack_usage prefix su_file)
+  file(READ "${su_file}" su)
+  if(NOT su MATCHES "frame\\(int\\)\t([0-9]+)\t")
+    message(FATAL_ERROR "no stack usage for frame(int) in ${su_file}")
+  endif()
+  set(${prefix}_bytes ${CMAKE_MATCH_1} PARENT_SCOPE)
+endfunction()
+
+set(failed "")
+message(STATUS "${guards_per_frame} guards per frame; frame stack bytes, bytes per guard over none")
+foreach(level IN LISTS levels)
+  file(MAKE_DIRECTORY "${BINARY_DIR}/${level}")
+  foreach(kind IN LISTS kinds)
+    # The .su file is written next to the object file.
+    execute_process(
+      COMMAND "${CXX_COMPILER}" -std=c++17 -${level} -fstack-usage
+              "-I${DEFERRAL_SOURCE_DIR}/include" -c "${BINARY_DIR}/${kind}.cc"
+              -o "${BINARY_DIR}/${level}/${kind}.o"
+      RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+      message(FATAL_ERROR "${kind} (-${level}): compilation failed")
+    endif()
+    frame_stack_usage(${kind} "${BINARY_DIR}/${level}/${kind}.su")
+  endforeach()
+
+  foreach(kind IN LISTS kinds)
+    math(EXPR per_guard "(${${kind}_bytes} - ${none_bytes}) / ${guards_per_frame}")
+    set(line "-${level} ${kind}: ${${kind}_bytes} bytes, ${per_guard} per guard")
+    if(DEFINED baseline_${kind})
+      set(baseline ${baseline_${kind}})
+      math(EXPR diff "${${kind}_bytes} - ${${baseline}_bytes}")
+      string(APPEND line ", ${diff} over ${baseline}")
+      if(level STREQUAL "O2" AND diff GREATER 0)
+        list(APPEND failed "${kind}")
+      endif()
+    endif()
+    message(STATUS "${line}")
+  endforeach()
+endforeach()
+
+if(failed)
+  message(FATAL_ERROR "deferral frames larger than hand-written RAII at -O2: ${failed}")
+endif()
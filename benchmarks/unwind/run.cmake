@@ -0,0 +1,118 @@
+# benchmarks/unwind/run.cmake
+#
+# Compiles one generated frame per guard kind, with a call that may throw, and reports what each
+# kind adds to the exception tables:
+#  - none:          no guard,
+#  - raii:          a hand-written RAII struct,
+#  - defer, defer_fail, defer_success: the deferral macros.
+#
+# For each kind and standard library it prints the number of call-site entries in the LSDA
+# (`.gcc_except_table`) that have a landing pad, and the `.gcc_except_table` bytes. Landing pads are
+# counted from the compiler's assembly output (GCC and Clang formats). libc++ is tried when the
+# compiler accepts `-stdlib=libc++`.
+#
+#   cmake -DDEFERRAL_SOURCE_DIR=<repo> -DBINARY_DIR=<dir> [-DCXX_COMPILER=<c++>]
+#         [-DREADELF=<readelf>] -P run.cmake
+
+cmake_minimum_required(VERSION 3.15)
+
+if(NOT DEFINED DEFERRAL_SOURCE_DIR OR NOT DEFINED BINARY_DIR)
+  message(FATAL_ERROR "DEFERRAL_SOURCE_DIR and BINARY_DIR are required")
+endif()
+if(NOT DEFINED CXX_COMPILER)
+  set(CXX_COMPILER c++)
+endif()
+if(NOT DEFINED READELF OR NOT READELF)
+  set(READELF readelf)
+endif()
+
+file(MAKE_DIRECTORY "${BINARY_DIR}")
+
+set(kinds none raii defer defer_fail defer_success)
+set(guard_none "")
+set(guard_raii "  Raii r{x};\n")
+set(guard_defer "  defer { sink(x); };\n")
+set(guard_defer_fail "  defer_fail { sink(x); };\n")
+set(guard_defer_success "  defer_success { sink(x); };\n")
+
+foreach(kind IN LISTS kinds)
+  file(WRITE "${BINARY_DIR}/${kind}.cc"
+    "#include \"deferral.hh\"\n\n"
+    "void sink(int) noexcept;\nvoid next(int);\n\n"
+    "struct Raii {\n  int x;\n  ~Raii() { sink(x); }\n};\n\n"
+    "void frame(int x) {\n${guard_${kind}}  next(x);\n}\n")
+endforeach()
+
+# Sets <prefix>_pads to the number of call sites with a landing pad in `assembly`.
+function(count_landing_pads prefix assembly)
+  set(pads 0)
+  # Clang annotates each call site with "jumps to <label>" or "has no landing pad".
+  string(REGEX MATCHALL "jumps to [.A-Za-z0-9_]+" clang_pads "${assembly}")
+  list(LENGTH clang_pads clang_count)
+  math(EXPR pads "${pads} + ${clang_count}")
+  # GCC emits each call-site table between .LLSDACSB<n> and .LLSDACSE<n> (with a C suffix for the
+  # cold part of a function) as groups of four `.uleb128` values: start, length, landing pad and
+  # action.
+  string(REGEX MATCHALL "\\.LLSDACSBC?[0-9]+:\n[^:]*\\.LLSDACSEC?" tables "${assembly}")
+  foreach(table IN LISTS tables)
+    string(REGEX MATCHALL "\\.uleb128[ \t]+[^\n]*" values "${table}")
+    list(LENGTH values value_count)
+    set(i 2)
+    while(i LESS value_count)
+      list(GET values ${i} pad)
+      if(NOT pad MATCHES "\\.uleb128[ \t]+0$")
+        math(EXPR pads "${pads} + 1")
+      endif()
+      math(EXPR i "${i} + 4")
+    endwhile()
+  endforeach()
+  set(${prefix}_pads ${pads} PARENT_SCOPE)
+endfunction()
+
+# Sets <prefix>_bytes to the size of .gcc_except_table in `object`.
+function(except_table_size prefix object)
+  execute_process(COMMAND "${READELF}" -S -W "${object}" OUTPUT_VARIABLE sections)
+  set(bytes 0)
+  if(sections MATCHES " \\.gcc_except_table[^ ]* +[A-Z_]+ +[0-9a-f]+ [0-9a-f]+ ([0-9a-f]+)")
+    math(EXPR bytes "0x${CMAKE_MATCH_1}")
+  endif()
+  set(${prefix}_bytes ${bytes} PARENT_SCOPE)
+endfunction()
+
+set(stdlibs default)
+file(WRITE "${BINARY_DIR}/libcxx_check.cc" "#include <string>\nint main() { return 0; }\n")
+execute_process(
+  COMMAND "${CXX_COMPILER}" -stdlib=libc++ "${BINARY_DIR}/libcxx_check.cc"
+          -o "${BINARY_DIR}/libcxx_check"
+  RESULT_VARIABLE libcxx_result OUTPUT_QUIET ERROR_QUIET)
+if(libcxx_result EQUAL 0)
+  list(APPEND stdlibs libc++)
+else()
+  message(STATUS "libc++ is not available with ${CXX_COMPILER}; measuring the default library only")
+endif()
+
+message(STATUS "One guard per frame; call sites with a landing pad, .gcc_except_table bytes")
+foreach(stdlib IN LISTS stdlibs)
+  set(stdlib_flags "")
+  if(stdlib STREQUAL "libc++")
+    set(stdlib_flags -stdlib=libc++)
+  endif()
+  foreach(kind IN LISTS kinds)
+    set(base "${BINARY_DIR}/${kind}-${stdlib}")
+    set(flags -std=c++17 -O2 ${stdlib_flags} "-I${DEFERRAL_SOURCE_DIR}/include")
+    execute_process(
+      COMMAND "${CXX_COMPILER}" ${flags} -S "${BINARY_DIR}/${kind}.cc" -o "${base}.s"
+      RESULT_VARIABLE s_result)
+    execute_process(
+      COMMAND "${CXX_COMPILER}" ${flags} -c "${BINARY_DIR}/${kind}.cc" -o "${base}.o"
+      RESULT_VARIABLE o_result)
+    if(NOT s_result EQUAL 0 OR NOT o_result EQUAL 0)
+      message(FATAL_ERROR "${kind} (${stdlib}): compilation failed")
+    endif()
+
+    file(READ "${base}.s" assembly)
+    count_landing_pads(k "${assembly}")
+    except_table_size(k "${base}.o")
+    message(STATUS "${stdlib} ${kind}: ${k_pads} landing pads, .gcc_except_table ${k_bytes}")
+  endforeach()
+endforeach()
@@ -0,0 +1,261 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// All-or-nothing acquisition of several resources with a single guard.
+//
+// Acquiring N resources where any step can fail is otherwise a ladder of N named `defer_fail`
+// guards: N exception count snapshots on the way in, and N `release()` calls once everything is
+// acquired. `acquire_all` runs the acquire functions in order and records each success as one bit
+// of a mask. If a step fails, or the scope exits before `commit()`, the release functions of the
+// acquired steps run in reverse order. `commit()` is a single store that clears the mask.
+
+#pragma once
+
+#include "deferral_core.hh"
+
+namespace deferral {
+namespace internal {
+
+// The smallest unsigned type with a bit per step.
+template <unsigned N>
+struct acquire_mask {
+  static_assert(N >= 1 && N <= 64, "acquire_all takes between 1 and 64 steps");
+  using type = typename conditional<(N <= 8), unsigned char,
+      typename conditional<(N <= 16), unsigned short,
+          typename conditional<(N <= 32), unsigned int, unsigned long long>::type>::type>::type;
+};
+
+// Calls an acquire function and returns whether it succeeded: a `void` function succeeds unless it
+// throws, a `bool` function returns the result. Other result types are rejected, so that e.g. a
+// file descriptor of -1 is not taken for success.
+template <typename resultT>
+struct AcquireCall {
+  static_assert(sizeof(resultT*) == 0, "an acquire function must return void or bool");
+};
+template <>
+struct AcquireCall<void> {
+  template <typename F>
+  DEFERRAL_ALWAYS_INLINE static bool call(F& f) {
+    f();
+    return true;
+  }
+};
+template <>
+struct AcquireCall<bool> {
+  template <typename F>
+  DEFERRAL_ALWAYS_INLINE static bool call(F& f) {
+    return f();
+  }
+};
+
+/**
+ * @brief One step of `acquire_all`: a function that acquires a resource and the function that
+ * releases it. Created by `deferral::step`.
+ */
+template <typename acquireT, typename releaseT>
+struct DEFERRAL_VISIBILITY_HIDDEN AcquireStep {
+  acquireT acquire;
+  releaseT release;
+};
+
+/**
+ * @brief The guard returned by `acquire_all`. The release functions are stored as base class
+ * subobjects, as the arguments of `BoundCall` are, next to the mask of acquired steps.
+ */
+template <typename indicesT, typename... releaseTs>
+class BasicAcquireAll;
+
+template <unsigned... Is, typename... releaseTs>
+class DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN BasicAcquireAll<index_list<Is...>, releaseTs...>
+    : BoundArg<Is, releaseTs>... {
+  static constexpr unsigned size = sizeof...(releaseTs);
+  using mask_t                   = typename acquire_mask<size>::type;
+
+  mask_t acquired_mask;
+
+  void* operator new(decltype(sizeof(0))) = delete;
+  void operator delete(void*)             = delete;
+
+  DEFERRAL_ALWAYS_INLINE static constexpr mask_t all_acquired() noexcept {
+    return static_cast<mask_t>(~0ull >> (64 - size));
+  }
+  DEFERRAL_ALWAYS_INLINE static constexpr mask_t bit(unsigned i) noexcept {
+    return static_cast<mask_t>(1ull << i);
+  }
+
+  struct init_tag {};
+
+  // Stores the release functions with no step acquired. The public constructor delegates to this
+  // one, so the guard is fully constructed before the first acquire function runs, and its
+  // destructor rolls back if one of them throws.
+  template <typename... Rs>
+  DEFERRAL_ALWAYS_INLINE BasicAcquireAll(init_tag, Rs&&... rs) noexcept(
+      all_of(__is_nothrow_constructible(releaseTs, Rs&&)...)) :
+      BoundArg<Is, releaseTs>{static_cast<Rs&&>(rs)}..., acquired_mask{0} {}
+
+  template <unsigned I>
+  DEFERRAL_ALWAYS_INLINE void acquire_each() noexcept {}
+
+  template <unsigned I, typename A, typename... As>
+  DEFERRAL_ALWAYS_INLINE void acquire_each(A& a, As&... as) {
+    if(__builtin_expect(!AcquireCall<decltype(a())>::call(a), false)) {
+      release_from(index_list<I>{});
+      acquired_mask = 0;
+      return;
+    }
+    acquired_mask |= bit(I);
+    acquire_each<I + 1>(as...);
+  }
+
+  template <unsigned I, typename R>
+  DEFERRAL_ALWAYS_INLINE static void call_release(BoundArg<I, R>& r) noexcept(noexcept(r.value())) {
+    static_cast<void>(r.value());
+  }
+
+  // Releases the acquired steps before step `I`, last to first.
+  DEFERRAL_ALWAYS_INLINE void release_from(index_list<0>) noexcept {}
+
+  template <unsigned I>
+  DEFERRAL_ALWAYS_INLINE void release_from(index_list<I>) noexcept(
+      all_of(noexcept(declval<releaseTs&>()())...)) {
+    if(acquired_mask & bit(I - 1)) { call_release<I - 1>(*this); }
+    release_from(index_list<I - 1>{});
+  }
+
+public:
+  /**
+   * @brief Runs the acquire functions of `steps` in order.
+   *
+   * If an acquire function throws, the acquired steps are released in reverse order and the
+   * exception propagates. If one returns `false`, the acquired steps are released and the guard
+   * is constructed with nothing acquired; see `acquired()`.
+   *
+   * @param steps The steps, created by `deferral::step`.
+   */
+  template <typename... As, typename... Rs>
+  DEFERRAL_ALWAYS_INLINE explicit BasicAcquireAll(AcquireStep<As, Rs>&&... steps) :
+      BasicAcquireAll(init_tag{}, static_cast<Rs&&>(steps.release)...) {
+    acquire_each<0>(steps.acquire...);
+  }
+
+  /**
+   * @brief Move constructs a `BasicAcquireAll` object. `other` no longer releases anything.
+   *
+   * @param other The other `BasicAcquireAll` object to be moved from.
+   */
+  DEFERRAL_ALWAYS_INLINE BasicAcquireAll(BasicAcquireAll&& other) noexcept(
+      all_of(__is_nothrow_constructible(releaseTs, releaseTs&&)...)) :
+      BoundArg<Is, releaseTs>{
+          static_cast<releaseTs&&>(static_cast<BoundArg<Is, releaseTs>&>(other).value)}...,
+      acquired_mask{other.acquired_mask} {
+    other.acquired_mask = 0;
+  }
+
+  BasicAcquireAll(const BasicAcquireAll&)            = delete;
+  BasicAcquireAll& operator=(const BasicAcquireAll&) = delete;
+  BasicAcquireAll& operator=(BasicAcquireAll&&)      = delete;
+
+  /**
+   * @brief Destructor.
+   *
+   * Unless committed, releases the acquired steps in reverse order.
+   */
+  DEFERRAL_ALWAYS_INLINE ~BasicAcquireAll() noexcept(all_of(noexcept(declval<releaseTs&>()())...)) {
+    if(__builtin_expect(acquired_mask != 0, false)) { release_from(index_list<size>{}); }
+  }
+
+  /**
+   * @brief Returns whether every step was acquired. Meaningful until `commit()`.
+   */
+  DEFERRAL_ALWAYS_INLINE bool acquired() const noexcept {
+    return acquired_mask == all_acquired();
+  }
+
+  /**
+   * @brief Keeps the acquired resources: nothing is released when the guard goes out of scope.
+   */
+  DEFERRAL_ALWAYS_INLINE void commit() noexcept { acquired_mask = 0; }
+}; // class BasicAcquireAll
+
+} // namespace internal
+
+/**
+ * @brief The guard type returned by `acquire_all`.
+ *
+ * @tparam releaseTs The types of the release functions, one per step.
+ */
+template <typename... releaseTs>
+using AcquireAll =
+    internal::BasicAcquireAll<typename internal::make_index_list<sizeof...(releaseTs)>::type,
+        releaseTs...>;
+
+/**
+ * @brief Creates a step for `acquire_all`.
+ *
+ * @param acquire The function that acquires the resource. It returns `void` and reports failure by
+ * throwing, or returns `bool` and reports failure with `false`.
+ * @param release The function that releases the resource.
+ * @return An `AcquireStep` object holding copies of both functions.
+ * @tparam acquireT The type of the acquire function.
+ * @tparam releaseT The type of the release function.
+ */
+template <typename acquireT, typename releaseT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE internal::AcquireStep<
+    typename internal::decay<acquireT>::type, typename internal::decay<releaseT>::type>
+step(acquireT&& acquire, releaseT&& release) noexcept(
+    __is_nothrow_constructible(typename internal::decay<acquireT>::type, acquireT&&) &&
+    __is_nothrow_constructible(typename internal::decay<releaseT>::type, releaseT&&)) {
+  return {static_cast<acquireT&&>(acquire), static_cast<releaseT&&>(release)};
+}
+
+/**
+ * @brief Acquires several resources, all or nothing.
+ *
+ * Runs the acquire function of each step in order. If one fails, by throwing or by returning
+ * `false`, the steps acquired so far are released in reverse order. The returned guard also
+ * releases every step in reverse order when it goes out of scope, unless `commit()` is called.
+ *
+ * @code
+ * auto g = deferral::acquire_all(
+ *     deferral::step([&]() { a.lock(); }, [&]() { a.unlock(); }),
+ *     deferral::step([&]() { return (fd = ::open(path, O_RDONLY)) >= 0; }, [&]() { ::close(fd); }),
+ *     deferral::step([&]() { slot = pool.reserve(); }, [&]() { pool.cancel(slot); }));
+ * if(!g.acquired()) { return false; }
+ * prepare(fd, slot);  // may throw; everything is released
+ * g.commit();
+ * @endcode
+ *
+ * @param steps The steps, created by `deferral::step`.
+ * @return An `AcquireAll` guard.
+ * @tparam acquireTs The types of the acquire functions.
+ * @tparam releaseTs The types of the release functions.
+ */
+template <typename... acquireTs, typename... releaseTs>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE AcquireAll<releaseTs...> acquire_all(
+    internal::AcquireStep<acquireTs, releaseTs>&&... steps) {
+  return AcquireAll<releaseTs...>{
+      static_cast<internal::AcquireStep<acquireTs, releaseTs>&&>(steps)...};
+}
+
+} // namespace deferral
@@ -0,0 +1,196 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// A guard of a fixed type, for class members and containers.
+//
+// The type of `DeferExit` and the other guards depends on the function, and they cannot be move
+// assigned or allocated with `new`, so they cannot be kept in a `std::vector` or as a member whose
+// type is declared ahead of the function. `DeferAny<Size>` stores any function of up to `Size`
+// bytes in place and dispatches through a single function pointer, which also marks the guard as
+// active. A function that does not fit is a compile-time error rather than a heap allocation.
+
+#pragma once
+
+#include "deferral_core.hh"
+
+#include <new>
+
+namespace deferral {
+namespace internal {
+
+enum class AnyAction { run, move, destroy };
+
+// The one function behind a `DeferAny` holding an `F`: runs and destroys the function, moves it to
+// `dst` and destroys the source, or only destroys it.
+template <typename F>
+struct DEFERRAL_VISIBILITY_HIDDEN AnyHandler {
+  static void handle(AnyAction action, void* self, void* dst) noexcept {
+    F& f = *static_cast<F*>(self);
+    if(__builtin_expect(action == AnyAction::run, true)) {
+      f();
+    } else if(action == AnyAction::move) {
+      ::new(dst) F(static_cast<F&&>(f));
+    }
+    f.~F();
+  }
+};
+
+} // namespace internal
+
+/**
+ * @brief A guard that executes any function of up to `Size` bytes when it goes out of scope.
+ *
+ * Unlike the other guards, `DeferAny` has one type for all functions of a given size, is default
+ * constructible (empty) and move assignable, and can be allocated, so it can be a class member or
+ * a container element. The function is stored in place; there is no heap allocation and no
+ * vtable. The guard is one function pointer plus the storage.
+ *
+ * The function runs from the destructor, which is `noexcept`: if it throws, `std::terminate` is
+ * called.
+ *
+ * @code
+ * struct Connection {
+ *   deferral::DeferAny<> on_close;
+ * };
+ * conn.on_close = deferral::DeferAny<>{[&]() { pool.give_back(conn); }};
+ * @endcode
+ *
+ * @tparam Size The size of the inline storage in bytes.
+ * @tparam Align The alignment of the inline storage.
+ */
+template <decltype(sizeof(0)) Size = 3 * sizeof(void*), decltype(sizeof(0)) Align = alignof(void*)>
+class DEFERRAL_NODISCARD DeferAny {
+  using handler_t = void (*)(internal::AnyAction, void*, void*);
+
+  handler_t handler;
+  alignas(Align) unsigned char storage[Size];
+
+  // Moves the function of `other`, if any, into the storage of this empty guard.
+  DEFERRAL_ALWAYS_INLINE void take(DeferAny& other) noexcept {
+    handler = other.handler;
+    if(handler != nullptr) {
+      handler(internal::AnyAction::move, other.storage, storage);
+      other.handler = nullptr;
+    }
+  }
+
+public:
+  /**
+   * @brief Returns whether a function of type `F` can be stored: it fits in `Size` bytes, its
+   * alignment divides `Align`, and it can be moved without throwing.
+   *
+   * @tparam F The type of the function.
+   */
+  template <typename F>
+  static constexpr bool fits() noexcept {
+    return sizeof(F) <= Size && Align % alignof(F) == 0 && __is_nothrow_constructible(F, F&&);
+  }
+
+  /**
+   * @brief Constructs an empty guard, which executes nothing.
+   */
+  DEFERRAL_ALWAYS_INLINE DeferAny() noexcept : handler{nullptr} {}
+
+  /**
+   * @brief Constructs a guard that executes `f`, stored in place.
+   *
+   * @param f The function to be executed.
+   * @tparam F The type of the function. It must satisfy `fits<F>()`.
+   */
+  template <typename F,
+      typename = typename internal::enable_if<
+          !internal::is_same<typename internal::decay<F>::type, DeferAny>::value>::type>
+  DEFERRAL_ALWAYS_INLINE explicit DeferAny(F&& f) noexcept(
+      __is_nothrow_constructible(typename internal::decay<F>::type, F&&)) {
+    using func_t = typename internal::decay<F>::type;
+    static_assert(internal::is_invocable<func_t>(nullptr), "deferral function must be callable");
+    static_assert(sizeof(func_t) <= Size, "the function does not fit in DeferAny; increase Size");
+    static_assert(Align % alignof(func_t) == 0,
+        "the function is over-aligned for DeferAny; increase Align");
+    static_assert(__is_nothrow_constructible(func_t, func_t&&),
+        "DeferAny requires a function that can be moved without throwing");
+    ::new(static_cast<void*>(storage)) func_t(static_cast<F&&>(f));
+    handler = &internal::AnyHandler<func_t>::handle;
+  }
+
+  /**
+   * @brief Move constructs a `DeferAny` object. `other` is left empty.
+   *
+   * @param other The other `DeferAny` object to be moved from.
+   */
+  DEFERRAL_ALWAYS_INLINE DeferAny(DeferAny&& other) noexcept { take(other); }
+
+  /**
+   * @brief Executes the pending function, if any, then takes over the function of `other`, which
+   * is left empty.
+   *
+   * @param other The other `DeferAny` object to be moved from.
+   * @return `*this`.
+   */
+  DEFERRAL_ALWAYS_INLINE DeferAny& operator=(DeferAny&& other) noexcept {
+    if(this != &other) {
+      execute();
+      take(other);
+    }
+    return *this;
+  }
+
+  DeferAny(const DeferAny&)            = delete;
+  DeferAny& operator=(const DeferAny&) = delete;
+
+  /**
+   * @brief Destructor.
+   *
+   * If the guard holds a function, executes it.
+   */
+  DEFERRAL_ALWAYS_INLINE ~DeferAny() { execute(); }
+
+  /**
+   * @brief Executes the function now, if any, and leaves the guard empty.
+   */
+  DEFERRAL_ALWAYS_INLINE void execute() noexcept {
+    if(__builtin_expect(handler != nullptr, true)) {
+      const handler_t h = handler;
+      handler           = nullptr;
+      h(internal::AnyAction::run, storage, nullptr);
+    }
+  }
+
+  /**
+   * @brief Destroys the function without executing it, and leaves the guard empty.
+   */
+  DEFERRAL_ALWAYS_INLINE void release() noexcept {
+    if(handler != nullptr) {
+      handler(internal::AnyAction::destroy, storage, nullptr);
+      handler = nullptr;
+    }
+  }
+
+  /**
+   * @brief Returns whether the guard holds a function.
+   */
+  DEFERRAL_ALWAYS_INLINE explicit operator bool() const noexcept { return handler != nullptr; }
+}; // class DeferAny
+
+} // namespace deferral
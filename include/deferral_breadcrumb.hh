@@ -0,0 +1,292 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Exception breadcrumbs.
+//
+// `DEFER_BREADCRUMB("parsing record {} of {}", i, path);` is a `DEFER_FAIL` guard that keeps the
+// format string and the arguments, integers and pointers only, by value. If an exception unwinds
+// through the scope, the guard formats the message and appends it to a thread-local trail that the
+// catch site reads with `breadcrumbs()`. On the success path nothing is formatted: the guard costs
+// the stores of its arguments and the exception count snapshot of `DEFER_FAIL`.
+//
+// The trail is a fixed-size buffer, so recording a breadcrumb never allocates while unwinding. A
+// message that does not fit is truncated; once the buffer is full, further breadcrumbs are counted
+// in `BreadcrumbView::dropped()`. The catch site clears the trail with `clear_breadcrumbs()`.
+
+#pragma once
+
+#include "deferral_core.hh"
+#include "deferral_macros.hh"
+
+#include <cstring>
+#include <type_traits>
+
+// The size in bytes of the breadcrumb trail of each thread.
+#if !defined(DEFERRAL_BREADCRUMB_CAPACITY)
+#define DEFERRAL_BREADCRUMB_CAPACITY 1024
+#endif // !defined(DEFERRAL_BREADCRUMB_CAPACITY)
+
+namespace deferral {
+namespace internal {
+
+// The trail of a thread: messages separated by '\0', innermost scope first. Zero-initialized, so
+// that the thread-local needs no initialization guard.
+struct BreadcrumbTrail {
+  unsigned size;
+  unsigned count;
+  unsigned dropped;
+  char text[DEFERRAL_BREADCRUMB_CAPACITY];
+};
+
+inline BreadcrumbTrail& breadcrumb_trail() noexcept {
+  static thread_local BreadcrumbTrail trail;
+  return trail;
+}
+
+// One formatting argument. The conversions accept integers, unscoped enums, `bool`, `char`,
+// strings and other object pointers, and nothing that could need a copy or an allocation.
+struct BreadcrumbArg {
+  enum Kind { kSigned, kUnsigned, kBool, kChar, kString, kPointer } kind;
+  union {
+    long long i;
+    unsigned long long u;
+    const char* s;
+    const void* p;
+  };
+
+  BreadcrumbArg(int v) noexcept : kind{kSigned}, i{v} {}
+  BreadcrumbArg(long v) noexcept : kind{kSigned}, i{v} {}
+  BreadcrumbArg(long long v) noexcept : kind{kSigned}, i{v} {}
+  BreadcrumbArg(unsigned v) noexcept : kind{kUnsigned}, u{v} {}
+  BreadcrumbArg(unsigned long v) noexcept : kind{kUnsigned}, u{v} {}
+  BreadcrumbArg(unsigned long long v) noexcept : kind{kUnsigned}, u{v} {}
+  BreadcrumbArg(bool v) noexcept : kind{kBool}, u{v} {}
+  BreadcrumbArg(char v) noexcept : kind{kChar}, u{static_cast<unsigned char>(v)} {}
+  BreadcrumbArg(const char* v) noexcept : kind{kString}, s{v} {}
+  BreadcrumbArg(const void* v) noexcept : kind{kPointer}, p{v} {}
+};
+
+// Appends characters to the trail, truncating at its end.
+class BreadcrumbWriter {
+  BreadcrumbTrail& trail;
+  unsigned pos;
+
+public:
+  explicit BreadcrumbWriter(BreadcrumbTrail& t) noexcept : trail(t), pos{t.size} {}
+
+  void put(char c) noexcept {
+    if(pos + 1 < sizeof(trail.text)) { trail.text[pos++] = c; }
+  }
+  void put(const char* s) noexcept {
+    while(*s != '\0') { put(*s++); }
+  }
+  void put(unsigned long long v, unsigned base) noexcept {
+    char digits[24];
+    int n = 0;
+    do {
+      digits[n++] = "0123456789abcdef"[v % base];
+      v /= base;
+    } while(v != 0);
+    while(n > 0) { put(digits[--n]); }
+  }
+  void put(const BreadcrumbArg& a) noexcept {
+    switch(a.kind) {
+    case BreadcrumbArg::kSigned: {
+      const unsigned long long magnitude = static_cast<unsigned long long>(a.i);
+      if(a.i < 0) { put('-'); }
+      put(a.i < 0 ? 0ull - magnitude : magnitude, 10);
+      break;
+    }
+    case BreadcrumbArg::kUnsigned: put(a.u, 10); break;
+    case BreadcrumbArg::kBool: put(a.u != 0 ? "true" : "false"); break;
+    case BreadcrumbArg::kChar: put(static_cast<char>(a.u)); break;
+    case BreadcrumbArg::kString: put(a.s != nullptr ? a.s : "(null)"); break;
+    case BreadcrumbArg::kPointer:
+      put("0x");
+      put(reinterpret_cast<unsigned long long>(a.p), 16);
+      break;
+    }
+  }
+
+  // Terminates the message and adds it to the trail.
+  void finish() noexcept {
+    trail.text[pos] = '\0';
+    trail.size      = pos + 1;
+    ++trail.count;
+  }
+};
+
+// Formats a message into the trail, replacing each "{}" in `format` with the next argument.
+DEFERRAL_COLD inline void append_breadcrumb(
+    const char* format, const BreadcrumbArg* args, unsigned n) noexcept {
+  BreadcrumbTrail& trail = breadcrumb_trail();
+  if(trail.size + 1 >= sizeof(trail.text)) {
+    ++trail.dropped;
+    return;
+  }
+  BreadcrumbWriter w{trail};
+  unsigned next = 0;
+  for(const char* f = format; *f != '\0'; ++f) {
+    if(f[0] == '{' && f[1] == '}' && next < n) {
+      w.put(args[next++]);
+      ++f;
+    } else {
+      w.put(*f);
+    }
+  }
+  w.finish();
+}
+
+// The function of `DeferBreadcrumb`, called with the stored format and arguments.
+struct DEFERRAL_VISIBILITY_HIDDEN AppendBreadcrumb {
+  template <typename... argTs>
+  void operator()(const char* format, const argTs&... args) const noexcept {
+    // One extra element, so that the array is not empty.
+    const BreadcrumbArg list[] = {BreadcrumbArg{args}..., BreadcrumbArg{0}};
+    append_breadcrumb(format, list, sizeof...(argTs));
+  }
+};
+
+template <typename T>
+struct is_breadcrumb_arg
+    : std::integral_constant<bool,
+          std::is_integral<T>::value ||
+              (std::is_enum<T>::value && std::is_convertible<T, int>::value) ||
+              (std::is_pointer<T>::value && std::is_convertible<T, const void*>::value)> {};
+
+} // namespace internal
+
+/**
+ * @brief The guard created by `DEFER_BREADCRUMB`: a `DeferFail` that appends a formatted message
+ * to the breadcrumb trail of the thread.
+ *
+ * @tparam argTs The types of the stored arguments.
+ */
+template <typename... argTs>
+using DeferBreadcrumb =
+    DeferFail<internal::bound_call_t<internal::AppendBreadcrumb, const char*, argTs...>>;
+
+/**
+ * @brief Creates a `DeferBreadcrumb` object.
+ *
+ * @param format The message. Each "{}" is replaced by the next argument.
+ * @param args Integers, unscoped enums, `bool`, `char`, strings and other object pointers, stored
+ * by value. Strings must outlive the guard.
+ * @return A `DeferBreadcrumb` object.
+ */
+template <typename... argTs>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE
+    DeferBreadcrumb<typename std::decay<argTs>::type...>
+    make_breadcrumb(const char* format, argTs&&... args) noexcept {
+  static_assert(internal::all_of(true,
+                    internal::is_breadcrumb_arg<typename std::decay<argTs>::type>::value...),
+      "breadcrumb arguments must be integers, unscoped enums, bool, char, strings or object "
+      "pointers");
+  return DeferBreadcrumb<typename std::decay<argTs>::type...>{
+      internal::bound_call_t<internal::AppendBreadcrumb, const char*,
+          typename std::decay<argTs>::type...>{
+          internal::AppendBreadcrumb{}, format, static_cast<argTs&&>(args)...}};
+}
+
+/**
+ * @brief The breadcrumb trail of a thread, innermost scope first.
+ */
+class BreadcrumbView {
+  const char* text;
+  unsigned bytes;
+  unsigned messages;
+  unsigned dropped_messages;
+
+public:
+  class iterator {
+    const char* p;
+
+  public:
+    explicit iterator(const char* q) noexcept : p{q} {}
+    const char* operator*() const noexcept { return p; }
+    iterator& operator++() noexcept {
+      p += std::strlen(p) + 1;
+      return *this;
+    }
+    bool operator==(const iterator& other) const noexcept { return p == other.p; }
+    bool operator!=(const iterator& other) const noexcept { return p != other.p; }
+  };
+
+  BreadcrumbView(const char* t, unsigned b, unsigned m, unsigned d) noexcept :
+      text{t}, bytes{b}, messages{m}, dropped_messages{d} {}
+
+  iterator begin() const noexcept { return iterator{text}; }
+  iterator end() const noexcept { return iterator{text + bytes}; }
+  // The number of messages in the trail.
+  unsigned size() const noexcept { return messages; }
+  bool empty() const noexcept { return messages == 0; }
+  // The number of messages that did not fit.
+  unsigned dropped() const noexcept { return dropped_messages; }
+};
+
+/**
+ * @brief Returns the breadcrumb trail of the calling thread. The view is valid until the next
+ * breadcrumb is recorded or the trail is cleared.
+ */
+inline BreadcrumbView breadcrumbs() noexcept {
+  const internal::BreadcrumbTrail& trail = internal::breadcrumb_trail();
+  return BreadcrumbView{trail.text, trail.size, trail.count, trail.dropped};
+}
+
+/**
+ * @brief Clears the breadcrumb trail of the calling thread, e.g. once a catch site has handled
+ * the exception.
+ */
+inline void clear_breadcrumbs() noexcept {
+  internal::BreadcrumbTrail& trail = internal::breadcrumb_trail();
+  trail.size                       = 0;
+  trail.count                      = 0;
+  trail.dropped                    = 0;
+}
+
+} // namespace deferral
+
+#if !defined(DEFERRAL_NO_MACROS)
+
+/**
+ * @brief A `DEFER_FAIL` guard that adds a message to the breadcrumb trail if the scope exits by
+ * an exception. Each "{}" in the format is replaced by the next argument.
+ * @def DEFER_BREADCRUMB(...)
+ *
+ * @code
+ * for(unsigned i = 0; i < records.size(); ++i) {
+ *   DEFER_BREADCRUMB("while parsing record {} of {}", i, path.c_str());
+ *   parse(records[i]);
+ * }
+ * @endcode
+ */
+#define DEFER_BREADCRUMB(...)                                                                      \
+  DEFERRAL_MAYBE_UNUSED auto DEFERRAL_ANONYMOUS_VARIABLE(DEFERRAL_BREADCRUMB) =                    \
+      ::deferral::make_breadcrumb(__VA_ARGS__)
+
+#if !defined(DEFERRAL_NO_KEYWORDS)
+#define defer_breadcrumb(...) DEFER_BREADCRUMB(__VA_ARGS__)
+#endif // !defined(DEFERRAL_NO_KEYWORDS)
+
+#endif // !defined(DEFERRAL_NO_MACROS)
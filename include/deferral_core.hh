@@ -0,0 +1,1152 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Core of deferral: the guard classes, policies and factory functions, implemented without any
+// standard library include. deferral.hh adds the standard headers and the `DEFER`/`defer` macros
+// (deferral_macros.hh) on top of this file.
+
+#pragma once
+
+#if defined(__has_attribute)
+#define DEFERRAL_HAS_ATTRIBUTE(x) __has_attribute(x)
+#else
+#define DEFERRAL_HAS_ATTRIBUTE(x) 0
+#endif // defined(__has_attribute)
+
+// attribute hidden
+#if defined(_MSC_VER)
+#define DEFERRAL_VISIBILITY_HIDDEN
+#elif defined(__GNUC__)
+#define DEFERRAL_VISIBILITY_HIDDEN [[gnu::visibility("hidden")]]
+#else
+#define DEFERRAL_VISIBILITY_HIDDEN
+#endif // defined(_MSC_VER)
+
+// DEFERRAL_COLD marks a function that runs rarely (sampling, registration, unwinding), so that the
+// compiler optimizes it for size and moves it away from the hot path.
+#if !defined(DEFERRAL_COLD)
+#if DEFERRAL_HAS_ATTRIBUTE(__cold__)
+#define DEFERRAL_COLD __attribute__((__cold__))
+#else
+#define DEFERRAL_COLD
+#endif
+#endif // !defined(DEFERRAL_COLD)
+
+// DEFERRAL_ALWAYS_INLINE forces the internal call chain (tag operator, factory function,
+// constructor, policy) to be inlined, even at -O0/-Og, and hides it from the debugger.
+#if !defined(DEFERRAL_ALWAYS_INLINE)
+#if defined(_MSC_VER)
+#define DEFERRAL_ALWAYS_INLINE __forceinline
+#elif DEFERRAL_HAS_ATTRIBUTE(__artificial__)
+#define DEFERRAL_ALWAYS_INLINE __attribute__((__always_inline__, __artificial__)) inline
+#elif DEFERRAL_HAS_ATTRIBUTE(__always_inline__)
+#define DEFERRAL_ALWAYS_INLINE __attribute__((__always_inline__)) inline
+#else
+#define DEFERRAL_ALWAYS_INLINE inline
+#endif
+#endif // !defined(DEFERRAL_ALWAYS_INLINE)
+
+// DEFERRAL_NO_UNIQUE_ADDRESS lets an empty stored function (a captureless lambda) share its
+// address with the policy, so that it takes no storage in the guard.
+#if !defined(DEFERRAL_NO_UNIQUE_ADDRESS)
+#if defined(_MSC_VER) && _MSC_VER >= 1929
+#define DEFERRAL_NO_UNIQUE_ADDRESS [[msvc::no_unique_address]]
+#elif defined(__has_cpp_attribute)
+#if __has_cpp_attribute(no_unique_address)
+#define DEFERRAL_NO_UNIQUE_ADDRESS [[no_unique_address]]
+#else
+#define DEFERRAL_NO_UNIQUE_ADDRESS
+#endif
+#else
+#define DEFERRAL_NO_UNIQUE_ADDRESS
+#endif
+#endif // !defined(DEFERRAL_NO_UNIQUE_ADDRESS)
+
+// DEFERRAL_CONSTEXPR20 is `constexpr` when destructors can be constexpr (C++20), so that guards
+// can be used in constant-evaluated functions.
+#if !defined(DEFERRAL_CONSTEXPR20)
+#if defined(__cpp_constexpr) && __cpp_constexpr >= 201907L
+#define DEFERRAL_CONSTEXPR20 constexpr
+#define DEFERRAL_HAS_CONSTEXPR_GUARDS 1
+#else
+#define DEFERRAL_CONSTEXPR20
+#endif
+#endif // !defined(DEFERRAL_CONSTEXPR20)
+
+// DEFERRAL_BEGIN_EXPORT and DEFERRAL_END_EXPORT enclose the declarations exported by the `deferral`
+// C++20 module (see modules/deferral.cppm). They are empty when deferral.hh is used as a header.
+#if !defined(DEFERRAL_BEGIN_EXPORT)
+#define DEFERRAL_BEGIN_EXPORT
+#define DEFERRAL_END_EXPORT
+#endif // !defined(DEFERRAL_BEGIN_EXPORT)
+
+// DEFERRAL_NODISCARD encourages the compiler to issue a warning if the return value is discarded.
+#if !defined(DEFERRAL_NODISCARD)
+#if defined(__clang__)
+#if(__clang_major__ * 10 + __clang_minor__) >= 39 && __cplusplus >= 201703L
+#define DEFERRAL_NODISCARD [[nodiscard]]
+#else
+#define DEFERRAL_NODISCARD __attribute__((__warn_unused_result__))
+#endif
+#elif defined(__GNUC__)
+// GCC accepts `[[nodiscard]]` on classes before C++17, but ignores `__warn_unused_result__`.
+#if __GNUC__ >= 7
+#define DEFERRAL_NODISCARD [[nodiscard]]
+#else
+#define DEFERRAL_NODISCARD
+#endif
+#elif defined(_MSC_VER)
+#if _MSC_VER >= 1911 && defined(_MSVC_LANG) && _MSVC_LANG >= 201703L
+#define DEFERRAL_NODISCARD [[nodiscard]]
+#elif defined(_Check_return_)
+#define DEFERRAL_NODISCARD _Check_return_
+#else
+#define DEFERRAL_NODISCARD
+#endif
+#else
+#define DEFERRAL_NODISCARD
+#endif
+#endif
+
+// The uncaught exception count is read straight from the C++ runtime, so that this header needs no
+// standard library include: the Itanium C++ ABI exception globals (GCC, Clang) or the MSVC runtime
+// function behind `std::uncaught_exceptions()`.
+#if defined(_MSC_VER)
+#define DEFERRAL_USE_MSVC_UNCAUGHT_EXCEPTIONS 1
+extern "C" int __cdecl __uncaught_exceptions();
+#elif defined(__GNUC__)
+#define DEFERRAL_USE_CXA_GET_GLOBALS 1
+namespace __cxxabiv1 {
+struct __cxa_eh_globals;
+extern "C" __cxa_eh_globals* __cxa_get_globals() noexcept __attribute__((__const__));
+} // namespace __cxxabiv1
+#else
+#include <exception>
+#endif
+
+DEFERRAL_BEGIN_EXPORT
+namespace deferral {
+namespace internal {
+
+/**
+ * @brief Returns the number of exceptions currently being thrown or rethrown in this thread.
+ *
+ * No exception can be in flight during constant evaluation, so it returns 0 there: fail guards
+ * never execute and success guards always do.
+ */
+DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 int uncaught_exceptions() noexcept {
+#if defined(DEFERRAL_HAS_CONSTEXPR_GUARDS)
+  if(__builtin_is_constant_evaluated()) { return 0; }
+#endif // defined(DEFERRAL_HAS_CONSTEXPR_GUARDS)
+#if defined(DEFERRAL_USE_CXA_GET_GLOBALS)
+  // `__cxa_eh_globals` is `{ __cxa_exception* caughtExceptions; unsigned int uncaughtExceptions; }`
+  return static_cast<int>(*reinterpret_cast<unsigned int*>(
+      reinterpret_cast<char*>(__cxxabiv1::__cxa_get_globals()) + sizeof(void*)));
+#elif defined(DEFERRAL_USE_MSVC_UNCAUGHT_EXCEPTIONS)
+  return __uncaught_exceptions();
+#elif defined(__cpp_lib_uncaught_exceptions) && (__cpp_lib_uncaught_exceptions >= 201411L)
+  return std::uncaught_exceptions();
+#else
+  return std::uncaught_exception() ? 1 : 0;
+#endif // defined(DEFERRAL_USE_CXA_GET_GLOBALS)
+}
+
+// Minimal replacements for the <type_traits> and <utility> facilities used below.
+// `std::is_nothrow_constructible` is replaced by the `__is_nothrow_constructible` builtin, which
+// also avoids a class template instantiation per guard.
+
+template <typename T>
+struct remove_reference {
+  using type = T;
+};
+template <typename T>
+struct remove_reference<T&> {
+  using type = T;
+};
+template <typename T>
+struct remove_reference<T&&> {
+  using type = T;
+};
+
+template <typename T>
+struct remove_cv {
+  using type = T;
+};
+template <typename T>
+struct remove_cv<const T> {
+  using type = T;
+};
+template <typename T>
+struct remove_cv<volatile T> {
+  using type = T;
+};
+template <typename T>
+struct remove_cv<const volatile T> {
+  using type = T;
+};
+
+// `std::decay` without the class and enum special cases: function-to-pointer and, for the
+// arguments stored by `defer_call`, array-to-pointer conversion.
+template <typename T>
+struct decay_function {
+  using type = T;
+};
+template <typename T>
+struct decay_function<T[]> {
+  using type = T*;
+};
+template <typename T, decltype(sizeof(0)) N>
+struct decay_function<T[N]> {
+  using type = T*;
+};
+template <typename R, typename... Args>
+struct decay_function<R(Args...)> {
+  using type = R (*)(Args...);
+};
+#if defined(__cpp_noexcept_function_type)
+template <typename R, typename... Args>
+struct decay_function<R(Args...) noexcept> {
+  using type = R (*)(Args...) noexcept;
+};
+#endif // defined(__cpp_noexcept_function_type)
+
+template <typename T>
+struct decay {
+  using type =
+      typename decay_function<typename remove_cv<typename remove_reference<T>::type>::type>::type;
+};
+
+template <bool B, typename T, typename F>
+struct conditional {
+  using type = T;
+};
+template <typename T, typename F>
+struct conditional<false, T, F> {
+  using type = F;
+};
+
+template <typename T, typename U>
+struct is_same {
+  static constexpr bool value{false};
+};
+template <typename T>
+struct is_same<T, T> {
+  static constexpr bool value{true};
+};
+
+template <bool B, typename T = void>
+struct enable_if {};
+template <typename T>
+struct enable_if<true, T> {
+  using type = T;
+};
+
+template <typename T>
+T&& declval() noexcept;
+
+// `is_invocable<T>(nullptr)` is a function rather than a trait class, so that checking it does not
+// emit a static data member per guard in unoptimized builds.
+template <typename T>
+constexpr bool is_invocable(decltype(static_cast<void>(declval<T&>()()))*) {
+  return true;
+}
+template <typename T>
+constexpr bool is_invocable(...) {
+  return false;
+}
+
+DEFERRAL_ALWAYS_INLINE constexpr bool all_of() noexcept {
+  return true;
+}
+template <typename... Bs>
+DEFERRAL_ALWAYS_INLINE constexpr bool all_of(bool b, Bs... bs) noexcept {
+  return b && all_of(bs...);
+}
+
+template <unsigned... Is>
+struct index_list {};
+template <unsigned N, unsigned... Is>
+struct make_index_list : make_index_list<N - 1, N - 1, Is...> {};
+template <unsigned... Is>
+struct make_index_list<0, Is...> {
+  using type = index_list<Is...>;
+};
+
+// One argument stored by `BoundCall`. The index keeps arguments of the same type distinct.
+template <unsigned I, typename T>
+struct DEFERRAL_VISIBILITY_HIDDEN BoundArg {
+  T value;
+};
+
+/**
+ * @brief A function and its arguments, stored by value, called as `func(args...)`.
+ *
+ * The arguments are base class subobjects, so the layout is that of a plain struct with the same
+ * members and empty arguments take no storage. Used by `defer_call` in place of a `[&]` lambda, so
+ * that the arguments are copied into the guard rather than referenced.
+ */
+template <typename indicesT, typename funcT, typename... argTs>
+class BoundCall;
+
+template <unsigned... Is, typename funcT, typename... argTs>
+class DEFERRAL_VISIBILITY_HIDDEN BoundCall<index_list<Is...>, funcT, argTs...>
+    : BoundArg<Is, argTs>... {
+  DEFERRAL_NO_UNIQUE_ADDRESS funcT func;
+
+public:
+  template <typename F, typename... As>
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 explicit BoundCall(F&& f, As&&... as) noexcept(
+      __is_nothrow_constructible(funcT, F&&) &&
+      all_of(__is_nothrow_constructible(argTs, As&&)...)) :
+      BoundArg<Is, argTs>{static_cast<As&&>(as)}..., func{static_cast<F&&>(f)} {}
+
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 void operator()() noexcept(
+      noexcept(internal::declval<funcT&>()(internal::declval<argTs&>()...))) {
+    static_cast<void>(func(static_cast<BoundArg<Is, argTs>&>(*this).value...));
+  }
+}; // class BoundCall
+
+template <typename funcT, typename... argTs>
+using bound_call_t = BoundCall<typename make_index_list<sizeof...(argTs)>::type,
+    typename decay<funcT>::type, typename decay<argTs>::type...>;
+
+class OnExitNoCheckPolicy {
+public:
+  static constexpr bool expect_execute{true};
+  static constexpr bool require_noexcept{false};
+
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 static void release() noexcept {}
+  DEFERRAL_ALWAYS_INLINE static constexpr bool should_execute() noexcept { return true; }
+}; // class OnExitNoCheckPolicy
+
+class OnExitPolicy {
+  bool active;
+
+public:
+  static constexpr bool expect_execute{true};
+  static constexpr bool require_noexcept{false};
+
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 OnExitPolicy() noexcept : active{true} {}
+
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 void arm() noexcept { active = true; }
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 void release() noexcept { active = false; }
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 bool should_execute() const noexcept {
+    return active;
+  }
+}; // class OnExitPolicy
+
+/**
+ * @brief The default exception-state source of the fail and success policies: the uncaught
+ * exception count of the current thread, read from the C++ runtime.
+ *
+ * An exception-state source is a type with `static int uncaught_exceptions() noexcept`. A fiber
+ * library whose fibers switch stacks in the middle of a scope can provide a source that returns a
+ * per-fiber count, or keep this one and swap the runtime's exception globals on every switch (see
+ * deferral_fiber.hh).
+ */
+struct ThreadExceptionSource {
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 static int uncaught_exceptions() noexcept {
+    return internal::uncaught_exceptions();
+  }
+}; // struct ThreadExceptionSource
+
+// The fail and success policies keep the exception count snapshot taken at construction while
+// released, and mark the released state with a bit that the comparison in `should_execute()` can
+// never pass. `arm()` clears the bit again, so re-arming does not need a new snapshot.
+
+template <typename sourceT>
+class BasicOnFailPolicy {
+  int exception_count;
+
+  static constexpr int released_bit = 1 << 30;
+
+public:
+  static constexpr bool expect_execute{false};
+  static constexpr bool require_noexcept{true};
+
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 BasicOnFailPolicy() noexcept :
+      exception_count{sourceT::uncaught_exceptions()} {}
+
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 void arm() noexcept {
+    exception_count &= ~released_bit;
+  }
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 void release() noexcept {
+    exception_count |= released_bit;
+  }
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 bool should_execute() const noexcept {
+    return exception_count < sourceT::uncaught_exceptions();
+  }
+}; // class BasicOnFailPolicy
+
+template <typename sourceT>
+class BasicOnSuccessPolicy {
+  int exception_count;
+
+public:
+  static constexpr bool expect_execute{true};
+  static constexpr bool require_noexcept{true};
+
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 BasicOnSuccessPolicy() noexcept :
+      exception_count{sourceT::uncaught_exceptions()} {}
+
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 void arm() noexcept {
+    exception_count &= static_cast<int>(~0u >> 1);
+  }
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 void release() noexcept {
+    exception_count |= static_cast<int>(~(~0u >> 1));
+  }
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 bool should_execute() const noexcept {
+    return exception_count >= sourceT::uncaught_exceptions();
+  }
+}; // class BasicOnSuccessPolicy
+
+// DEFERRAL_EXCEPTION_SOURCE is the exception-state source of `DeferFail`, `DeferSuccess` and the
+// `DEFER_FAIL`/`DEFER_SUCCESS` macros. It may be defined, before deferral is included, to a type
+// that is declared by then.
+#if !defined(DEFERRAL_EXCEPTION_SOURCE)
+#define DEFERRAL_EXCEPTION_SOURCE ::deferral::internal::ThreadExceptionSource
+#endif // !defined(DEFERRAL_EXCEPTION_SOURCE)
+
+using OnFailPolicy    = BasicOnFailPolicy<DEFERRAL_EXCEPTION_SOURCE>;
+using OnSuccessPolicy = BasicOnSuccessPolicy<DEFERRAL_EXCEPTION_SOURCE>;
+
+template <bool>
+struct bool_constant_tag {};
+
+// `is_policy<P>(nullptr)` checks the requirements documented at `deferral::Policy`, for standards
+// without concepts.
+template <typename policyT>
+constexpr bool is_policy(decltype(bool_constant_tag<policyT::expect_execute>{},
+    bool_constant_tag<policyT::require_noexcept>{}, declval<policyT&>().release(),
+    static_cast<bool>(declval<const policyT&>().should_execute()), nullptr)) {
+  return noexcept(declval<policyT&>().release()) &&
+         noexcept(declval<const policyT&>().should_execute()) &&
+         __is_nothrow_constructible(policyT, policyT&&);
+}
+template <typename policyT>
+constexpr bool is_policy(...) {
+  return false;
+}
+
+} // namespace internal
+
+/**
+ * @brief Requirements on the policy of a guard, which decides whether the function is executed.
+ *
+ * A policy type `P` must provide:
+ *  - `static constexpr bool expect_execute`: whether the function is usually executed. It is used
+ *    as a branch prediction hint.
+ *  - `static constexpr bool require_noexcept`: whether the function must be `noexcept`. The
+ *    `DEFER_WITH` macros declare the deferred code `noexcept` accordingly.
+ *  - `void release() noexcept`: stops the function from being executed.
+ *  - `bool should_execute() const noexcept`: called by the guard's destructor.
+ *  - A `noexcept` move constructor. The guard is the policy's derived class, so a stateless policy
+ *    takes no storage.
+ *
+ * Built-in guards use the exception runtime to decide; user policies can test a cancel flag, a
+ * status word, and so on, for guards created with `make_defer_with` or `DEFER_WITH`. With C++20
+ * concepts this is the concept `deferral::Policy`; otherwise the guard checks it with a
+ * `static_assert`.
+ */
+#if defined(__cpp_concepts) && __cpp_concepts >= 201907L
+template <typename policyT>
+concept Policy = __is_nothrow_constructible(policyT, policyT&&) &&
+                 requires(policyT& p, const policyT& cp) {
+                   typename internal::bool_constant_tag<policyT::expect_execute>;
+                   typename internal::bool_constant_tag<policyT::require_noexcept>;
+                   { p.release() } noexcept;
+                   { cp.should_execute() } noexcept;
+                   static_cast<bool>(cp.should_execute());
+                 };
+#define DEFERRAL_POLICY ::deferral::Policy
+#else
+#define DEFERRAL_POLICY typename
+#endif // defined(__cpp_concepts) && __cpp_concepts >= 201907L
+
+namespace internal {
+
+// Not hidden: the `deferral_scope.hh` guards derive from it with default visibility, so that they
+// can be members of exported classes.
+template <typename funcT, DEFERRAL_POLICY policyT>
+class DeferBase : policyT {
+private:
+  using policy_t = policyT;
+  using func_t   = typename decay<funcT>::type;
+
+  static_assert(is_invocable<func_t>(nullptr), "deferral function must be callable");
+#if !defined(__cpp_concepts) || __cpp_concepts < 201907L
+  static_assert(is_policy<policy_t>(nullptr), "deferral policy does not meet the requirements");
+#endif
+
+  DEFERRAL_NO_UNIQUE_ADDRESS func_t func;
+
+  void* operator new(decltype(sizeof(0))) = delete;
+  void operator delete(void*)                     = delete;
+
+  // The stored function is initialized from `F&&` if that cannot throw, otherwise it is copied
+  // from `F&` so the source is left intact. This is a plain cast rather than
+  // `std::move_if_noexcept` so that debug builds do not pay for an extra call.
+  template <typename F>
+  using init_t = typename conditional<__is_nothrow_constructible(func_t, F), F&&,
+      typename remove_reference<F>::type&>::type;
+
+public:
+  /**
+   * @brief Constructs a DeferExit object with the specified function.
+   *
+   * @param f The function to be executed.
+   * @tparam F The type of the function.
+   * @exception noexcept If the construction of the function object is noexcept.
+   */
+  template <typename F>
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 explicit DeferBase(F&& f) noexcept(
+      __is_nothrow_constructible(func_t, init_t<F>)) :
+      policyT{}, func{static_cast<init_t<F>>(f)} {}
+
+  /**
+   * @brief Constructs a DeferBase object with the specified policy and function.
+   *
+   * @param policy The policy that decides whether the function is executed.
+   * @param f The function to be executed.
+   * @tparam F The type of the function.
+   */
+  template <typename F>
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 DeferBase(policy_t policy, F&& f) noexcept(
+      __is_nothrow_constructible(func_t, init_t<F>)) :
+      policy_t{static_cast<policy_t&&>(policy)}, func{static_cast<init_t<F>>(f)} {}
+
+  /**
+   * @brief Move constructs a DeferBase object from another DeferExit object.
+   *
+   * @param other The other DeferExit object to be moved from.
+   * @exception noexcept If the move construction of the function object is noexcept.
+   */
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 DeferBase(DeferBase&& other) noexcept(
+      __is_nothrow_constructible(func_t, init_t<func_t>)) :
+      policy_t{static_cast<policy_t&&>(other)}, func{static_cast<init_t<func_t>>(other.func)} {
+    other.release();
+  }
+
+  /**
+   * @brief `DeferBase` object is not copy constructible.
+   */
+  DeferBase(const DeferBase&) = delete;
+
+  /**
+   * @brief Destructor.
+   *
+   * If the `DeferBase` object is active, it calls the stored function.
+   */
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 ~DeferBase() noexcept(noexcept(func())) {
+    if(__builtin_expect(policy_t::should_execute(), policy_t::expect_execute)) { func(); }
+  }
+
+  /**
+   * @brief `DeferBase` object is not copy assignable.
+   */
+  DeferBase& operator=(const DeferBase&) = delete;
+
+  /**
+   * @brief `DeferBase` object is move assignable.
+   */
+  DeferBase& operator=(DeferBase&&) = delete;
+
+  /**
+   * @brief Releases the scope_exit object.
+   *
+   * Sets the active state of the scope_exit object to false.
+   */
+  using policy_t::release;
+}; // class DeferExit
+
+// Storage for the function of a `Rearmable` guard. The class-scope placement `operator new` lets
+// `reset()` construct a new function in place without including <new>.
+template <typename T>
+struct DEFERRAL_VISIBILITY_HIDDEN Slot {
+  T value;
+
+  DEFERRAL_ALWAYS_INLINE static void* operator new(decltype(sizeof(0)), void* p) noexcept {
+    return p;
+  }
+  DEFERRAL_ALWAYS_INLINE static void operator delete(void*, void*) noexcept {}
+};
+
+/**
+ * @brief A guard that can be disarmed, re-armed and given a new function while it is alive.
+ *
+ * Intended to be constructed once outside of a loop, instead of constructing a guard per
+ * iteration. `arm()` and `disarm()` are a single store (exit policy) or a single bit operation on
+ * the exception count taken at construction (fail and success policies), and `reset(f)` replaces
+ * the function in place.
+ *
+ * @tparam funcT The type of the function to be executed.
+ * @tparam policyT The policy that decides whether the function is executed.
+ */
+template <typename funcT, typename policyT>
+class DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN Rearmable : policyT {
+private:
+  using policy_t = policyT;
+  using func_t   = typename decay<funcT>::type;
+  using slot_t   = Slot<func_t>;
+
+  static_assert(is_invocable<func_t>(nullptr), "deferral function must be callable");
+
+  // Not `DEFERRAL_NO_UNIQUE_ADDRESS`: `reset()` ends the lifetime of the slot and constructs a new
+  // one in its place, and only a complete, non-overlapping member is transparently replaced, so
+  // that `slot` names the new object without `std::launder`.
+  slot_t slot;
+
+  void* operator new(decltype(sizeof(0))) = delete;
+  void operator delete(void*)             = delete;
+
+public:
+  /**
+   * @brief Constructs an armed `Rearmable` object with the specified function.
+   *
+   * @param f The function to be executed.
+   * @tparam F The type of the function.
+   */
+  template <typename F>
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 explicit Rearmable(F&& f) noexcept(
+      __is_nothrow_constructible(func_t, F&&)) :
+      policy_t{}, slot{static_cast<F&&>(f)} {}
+
+  /**
+   * @brief Move constructs a `Rearmable` object, releasing `other`.
+   *
+   * @param other The other `Rearmable` object to be moved from.
+   */
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 Rearmable(Rearmable&& other) noexcept(
+      __is_nothrow_constructible(func_t, func_t&&)) :
+      policy_t{static_cast<policy_t&&>(other)}, slot{static_cast<func_t&&>(other.slot.value)} {
+    other.release();
+  }
+
+  Rearmable(const Rearmable&)            = delete;
+  Rearmable& operator=(const Rearmable&) = delete;
+  Rearmable& operator=(Rearmable&&)      = delete;
+
+  /**
+   * @brief Destructor.
+   *
+   * If the `Rearmable` object is armed, it calls the stored function.
+   */
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 ~Rearmable() noexcept(noexcept(slot.value())) {
+    if(__builtin_expect(policy_t::should_execute(), policy_t::expect_execute)) { slot.value(); }
+  }
+
+  /**
+   * @brief Arms the guard, so that the function is executed when the scope exits.
+   */
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 void arm() noexcept { policy_t::arm(); }
+
+  /**
+   * @brief Disarms the guard. Equivalent to `release()`, but the guard can be armed again.
+   */
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 void disarm() noexcept { policy_t::release(); }
+
+  /**
+   * @brief Replaces the stored function with `f` and arms the guard.
+   *
+   * The old function is destroyed and the new one constructed in place, so the function type need
+   * not be assignable (lambdas are not). Constructing the new function must not throw.
+   *
+   * @param f The new function, converted to the stored function type.
+   * @tparam F The type of the new function.
+   */
+  template <typename F>
+  DEFERRAL_ALWAYS_INLINE void reset(F&& f) noexcept {
+    static_assert(__is_nothrow_constructible(func_t, F&&),
+        "reset() requires a function that can be constructed without throwing");
+    slot.~slot_t();
+    new(static_cast<void*>(&slot)) slot_t{static_cast<F&&>(f)};
+    policy_t::arm();
+  }
+
+  using policy_t::release;
+}; // class Rearmable
+
+} // namespace internal
+
+// Add explicit classes for deduction guides (if C++17 is available).
+
+/**
+ * @class DeferExit
+ * @brief A class that executes a function when it goes out of scope.
+ *
+ * The DeferExit class provides a way to execute a function when the scope in which it is defined
+ * ends. This can be useful for performing cleanup or releasing resources when an object goes out of
+ * scope.
+ *
+ * @tparam funcT The type of the function to be executed.
+ */
+template <typename funcT>
+struct DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN DeferExit
+    : internal::DeferBase<funcT, internal::OnExitPolicy> {
+  using base_t = internal::DeferBase<funcT, internal::OnExitPolicy>;
+
+  template <typename F>
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 explicit DeferExit(F&& f) noexcept(
+      __is_nothrow_constructible(base_t, F)) :
+      base_t{static_cast<F&&>(f)} {}
+  DEFERRAL_ALWAYS_INLINE DeferExit(DeferExit&&) = default;
+  DEFERRAL_ALWAYS_INLINE ~DeferExit()           = default;
+}; // class DeferExit
+
+/**
+ * @brief A class that provides scope-based failure behavior.
+ *
+ * The `DeferFail` class is a derived class of `DeferExit` and provides a way to execute a function
+ * or lambda when the scope is exited due to an exception. It is designed to be used in situations
+ * where you want to ensure that a certain action is performed when the scope is exited due to an
+ * exception, regardless of how the scope is exited (e.g., through normal execution or another
+ * exception).
+ *
+ * @tparam funcT The type of the function or lambda to be executed.
+ */
+template <typename funcT>
+struct DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN DeferFail
+    : internal::DeferBase<funcT, internal::OnFailPolicy> {
+  using base_t = internal::DeferBase<funcT, internal::OnFailPolicy>;
+
+  template <typename F>
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 explicit DeferFail(F&& f) noexcept(
+      __is_nothrow_constructible(base_t, F)) :
+      base_t{static_cast<F&&>(f)} {}
+  DEFERRAL_ALWAYS_INLINE DeferFail(DeferFail&&) = default;
+  DEFERRAL_ALWAYS_INLINE ~DeferFail()           = default;
+}; // class DeferFail
+
+/**
+ * @brief A class that provides scope-based success behavior.
+ *
+ * The `DeferSuccess` class is a derived class of DeferExit and provides a way to execute a
+ * function or lambda when the scope is successfully exited. It is designed to be used in situations
+ * where you want to ensure that a certain action is performed when the scope is successfully
+ * completed, regardless of how the scope is exited (e.g., through normal execution or an
+ * exception).
+ *
+ * @tparam funcT The type of the function or lambda to be executed.
+ */
+template <typename funcT>
+struct DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN DeferSuccess
+    : internal::DeferBase<funcT, internal::OnSuccessPolicy> {
+  using base_t = internal::DeferBase<funcT, internal::OnSuccessPolicy>;
+
+  template <typename F>
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 explicit DeferSuccess(F&& f) noexcept(
+      __is_nothrow_constructible(base_t, F)) :
+      base_t{static_cast<F&&>(f)} {}
+  DEFERRAL_ALWAYS_INLINE DeferSuccess(DeferSuccess&&) = default;
+  DEFERRAL_ALWAYS_INLINE ~DeferSuccess()              = default;
+}; // class DeferSuccess
+
+// Add deduction guide if C++17 is available.
+#if __cplusplus >= 201703L
+
+template <typename funcT>
+DeferExit(funcT) -> DeferExit<funcT>;
+
+template <typename funcT>
+DeferFail(funcT) -> DeferFail<funcT>;
+
+template <typename funcT>
+DeferSuccess(funcT) -> DeferSuccess<funcT>;
+
+#endif // __cplusplus >= 201703L
+
+/**
+ * @brief Creates a `DeferExit` object.
+ *
+ * @param f The function to be executed.
+ * @return A `DeferExit` object with the specified function.
+ * @tparam funcT The type of the function.
+ */
+template <typename funcT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 DeferExit<funcT>
+make_defer_exit(funcT&& f) noexcept(noexcept(DeferExit<funcT>{static_cast<funcT&&>(f)})) {
+  return DeferExit<funcT>{static_cast<funcT&&>(f)};
+}
+
+/**
+ * @brief Factory function to create a DeferFail object.
+ *
+ * @tparam funcT The type of the function or lambda to be executed.
+ * @param f The function or lambda to be executed.
+ * @param a A boolean value indicating whether the DeferFail object is active. Default is true.
+ * @return A DeferFail object.
+ */
+template <typename funcT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 DeferFail<funcT>
+make_defer_fail(funcT&& f) noexcept(noexcept(DeferFail<funcT>{static_cast<funcT&&>(f)})) {
+  return DeferFail<funcT>{static_cast<funcT&&>(f)};
+}
+
+/**
+ * @brief Factory function to create a `DeferSuccess` object.
+ *
+ * @tparam funcT The type of the function or lambda to be executed.
+ * @param f The function or lambda to be executed.
+ * @param a A boolean value indicating whether the DeferSuccess object is active. Default is true.
+ * @return A DeferSuccess object.
+ */
+template <typename funcT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 DeferSuccess<funcT>
+make_defer_success(funcT&& f) noexcept(noexcept(DeferSuccess<funcT>{static_cast<funcT&&>(f)})) {
+  return DeferSuccess<funcT>{static_cast<funcT&&>(f)};
+}
+
+using internal::ThreadExceptionSource;
+
+/**
+ * @brief Policies that execute the function if the scope exits by an exception (`FailPolicy`) or
+ * without one (`SuccessPolicy`), as counted by `sourceT`. For use with `make_defer_with` and
+ * `DEFER_WITH`, e.g. `DEFER_WITH(deferral::FailPolicy<FiberExceptionSource>{}) { ... };`.
+ *
+ * @tparam sourceT The exception-state source, a type with `static int uncaught_exceptions()`.
+ */
+template <typename sourceT = ThreadExceptionSource>
+using FailPolicy = internal::BasicOnFailPolicy<sourceT>;
+template <typename sourceT = ThreadExceptionSource>
+using SuccessPolicy = internal::BasicOnSuccessPolicy<sourceT>;
+
+/**
+ * @brief A guard that executes a function when it goes out of scope, if `policyT` says so.
+ *
+ * @tparam policyT The policy, see `Policy`.
+ * @tparam funcT The type of the function to be executed.
+ */
+template <typename policyT, typename funcT>
+using DeferWith = internal::DeferBase<funcT, policyT>;
+
+/**
+ * @brief Creates a `DeferWith` object with a user policy.
+ *
+ * @code
+ * struct OnStatusPolicy {
+ *   static constexpr bool expect_execute{false};
+ *   static constexpr bool require_noexcept{false};
+ *   const int* status;
+ *   void release() noexcept { status = nullptr; }
+ *   bool should_execute() const noexcept { return status && *status != 0; }
+ * };
+ *
+ * auto d = deferral::make_defer_with(OnStatusPolicy{&status}, [&]() { rollback(); });
+ * @endcode
+ *
+ * @param policy The policy that decides whether the function is executed.
+ * @param f The function to be executed.
+ * @return A `DeferWith` object.
+ * @tparam policyT The type of the policy.
+ * @tparam funcT The type of the function.
+ */
+template <typename policyT, typename funcT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 DeferWith<policyT, funcT>
+make_defer_with(policyT policy, funcT&& f) noexcept(noexcept(
+    DeferWith<policyT, funcT>{static_cast<policyT&&>(policy), static_cast<funcT&&>(f)})) {
+  return DeferWith<policyT, funcT>{static_cast<policyT&&>(policy), static_cast<funcT&&>(f)};
+}
+
+/**
+ * @brief Re-armable guards, executed on any scope exit, on exit by exception, or on exit without
+ * an exception. See `make_rearmable_exit`.
+ */
+template <typename funcT>
+using RearmableExit = internal::Rearmable<funcT, internal::OnExitPolicy>;
+template <typename funcT>
+using RearmableFail = internal::Rearmable<funcT, internal::OnFailPolicy>;
+template <typename funcT>
+using RearmableSuccess = internal::Rearmable<funcT, internal::OnSuccessPolicy>;
+
+/**
+ * @brief Creates a `RearmableExit` object, for use across the iterations of a loop.
+ *
+ * @code
+ * auto g = deferral::make_rearmable_exit([&]() { undo(item); });
+ * for(auto& x : items) {
+ *   item = &x;
+ *   g.arm();
+ *   update(x);  // may throw; undo(item) runs on the way out
+ *   g.disarm();
+ * }
+ * @endcode
+ *
+ * @param f The function to be executed.
+ * @return An armed `RearmableExit` object.
+ * @tparam funcT The type of the function.
+ */
+template <typename funcT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 RearmableExit<funcT>
+make_rearmable_exit(funcT&& f) noexcept(noexcept(RearmableExit<funcT>{static_cast<funcT&&>(f)})) {
+  return RearmableExit<funcT>{static_cast<funcT&&>(f)};
+}
+
+/**
+ * @brief Creates a `RearmableFail` object, for use across the iterations of a loop.
+ *
+ * @param f The function to be executed if the scope exits by an exception.
+ * @return An armed `RearmableFail` object.
+ * @tparam funcT The type of the function.
+ */
+template <typename funcT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 RearmableFail<funcT>
+make_rearmable_fail(funcT&& f) noexcept(noexcept(RearmableFail<funcT>{static_cast<funcT&&>(f)})) {
+  return RearmableFail<funcT>{static_cast<funcT&&>(f)};
+}
+
+/**
+ * @brief Creates a `RearmableSuccess` object, for use across the iterations of a loop.
+ *
+ * @param f The function to be executed if the scope exits without an exception.
+ * @return An armed `RearmableSuccess` object.
+ * @tparam funcT The type of the function.
+ */
+template <typename funcT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 RearmableSuccess<funcT>
+make_rearmable_success(funcT&& f) noexcept(
+    noexcept(RearmableSuccess<funcT>{static_cast<funcT&&>(f)})) {
+  return RearmableSuccess<funcT>{static_cast<funcT&&>(f)};
+}
+
+/**
+ * @brief The type returned by `defer_call(f, args...)`: a `DeferExit` whose function is `f` bound
+ * to copies of `args...`.
+ */
+template <typename funcT, typename... argTs>
+using DeferCall = DeferExit<internal::bound_call_t<funcT, argTs...>>;
+
+/**
+ * @brief Creates a `DeferExit` object that calls `f(args...)` with copies of the arguments.
+ *
+ * Unlike the `[&]` lambda of `DEFER`, the function and arguments are stored by value in the guard,
+ * so the caller's locals are not address-taken and can stay in registers.
+ *
+ * @code
+ * auto d = deferral::defer_call(&close, fd);
+ * @endcode
+ *
+ * @param f The function to be executed.
+ * @param args The arguments passed to `f`. They are copied (or moved) into the guard.
+ * @return A `DeferExit` object.
+ * @tparam funcT The type of the function.
+ * @tparam argTs The types of the arguments.
+ */
+template <typename funcT, typename... argTs>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 DeferCall<funcT, argTs...>
+defer_call(funcT&& f, argTs&&... args) noexcept(noexcept(DeferCall<funcT, argTs...>{
+    internal::bound_call_t<funcT, argTs...>{
+        static_cast<funcT&&>(f), static_cast<argTs&&>(args)...}})) {
+  return DeferCall<funcT, argTs...>{internal::bound_call_t<funcT, argTs...>{
+      static_cast<funcT&&>(f), static_cast<argTs&&>(args)...}};
+}
+
+#if defined(__cpp_nontype_template_parameter_auto)
+
+/**
+ * @brief A guard that calls a function, given as a template argument, on a stored argument.
+ *
+ * `DeferFn<&fclose, FILE*>` calls `fclose(fp)` when it goes out of scope. The function takes no
+ * storage and the argument is held by value, so the guard is only as large as the argument plus
+ * the active flag, and the handle is not forced into memory the way a `[&]` lambda capture is.
+ *
+ * @tparam fn The function to be called, e.g. `&fclose`.
+ * @tparam argT The type of the stored argument.
+ */
+template <auto fn, typename argT>
+class DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN DeferFn : internal::OnExitPolicy {
+  using policy_t = internal::OnExitPolicy;
+
+  argT arg;
+
+  void* operator new(decltype(sizeof(0))) = delete;
+  void operator delete(void*)             = delete;
+
+public:
+  /**
+   * @brief Constructs a `DeferFn` object that will call `fn(a)`.
+   *
+   * @param a The argument passed to `fn`.
+   * @tparam A The type of the argument.
+   */
+  template <typename A>
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 explicit DeferFn(A&& a) noexcept(
+      __is_nothrow_constructible(argT, A&&)) :
+      policy_t{}, arg{static_cast<A&&>(a)} {}
+
+  /**
+   * @brief Move constructs a `DeferFn` object, releasing `other`.
+   *
+   * @param other The other `DeferFn` object to be moved from.
+   */
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 DeferFn(DeferFn&& other) noexcept(
+      __is_nothrow_constructible(argT, argT&&)) :
+      policy_t{static_cast<policy_t&&>(other)}, arg{static_cast<argT&&>(other.arg)} {
+    other.release();
+  }
+
+  DeferFn(const DeferFn&)            = delete;
+  DeferFn& operator=(const DeferFn&) = delete;
+  DeferFn& operator=(DeferFn&&)      = delete;
+
+  /**
+   * @brief Destructor.
+   *
+   * If the `DeferFn` object is active, it calls `fn` with the stored argument.
+   */
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 ~DeferFn() noexcept(
+      noexcept(fn(internal::declval<argT&>()))) {
+    if(__builtin_expect(policy_t::should_execute(), policy_t::expect_execute)) {
+      static_cast<void>(fn(arg));
+    }
+  }
+
+  using policy_t::release;
+}; // class DeferFn
+
+/**
+ * @brief Creates a `DeferFn` object that calls `fn(arg)` when it goes out of scope.
+ *
+ * @code
+ * FILE* fp = fopen("data.txt", "r");
+ * auto d = deferral::defer_fn<&fclose>(fp);
+ * @endcode
+ *
+ * @param arg The argument passed to `fn`. It is stored by value.
+ * @return A `DeferFn` object.
+ * @tparam fn The function to be called.
+ * @tparam argT The type of the argument.
+ */
+template <auto fn, typename argT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20
+    DeferFn<fn, typename internal::decay<argT>::type>
+    defer_fn(argT&& arg) noexcept(
+        __is_nothrow_constructible(typename internal::decay<argT>::type, argT&&)) {
+  return DeferFn<fn, typename internal::decay<argT>::type>{static_cast<argT&&>(arg)};
+}
+
+#endif // defined(__cpp_nontype_template_parameter_auto)
+
+namespace internal {
+// The following enums and `+` opererator are used for the macro `defer`, `defer_success`,
+// `defer_fail` below. They construct the guard directly, rather than through the factory functions,
+// so that a debug build does not pay for a chain of calls per guard.
+
+enum class DeferOnExitNoCheck {};
+template <typename funcT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20
+    DeferBase<funcT, OnExitNoCheckPolicy>
+    operator+(DeferOnExitNoCheck, funcT&& f) noexcept(
+        noexcept(DeferBase<funcT, OnExitNoCheckPolicy>{static_cast<funcT&&>(f)})) {
+  return DeferBase<funcT, OnExitNoCheckPolicy>{static_cast<funcT&&>(f)};
+}
+
+enum class DeferOnExit {};
+template <typename funcT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 DeferExit<funcT> operator+(
+    DeferOnExit, funcT&& f) noexcept(noexcept(DeferExit<funcT>{static_cast<funcT&&>(f)})) {
+  return DeferExit<funcT>{static_cast<funcT&&>(f)};
+}
+
+enum class DeferOnFail {};
+template <typename funcT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 DeferFail<funcT> operator+(
+    DeferOnFail, funcT&& f) noexcept(noexcept(DeferFail<funcT>{static_cast<funcT&&>(f)})) {
+  return DeferFail<funcT>{static_cast<funcT&&>(f)};
+}
+
+enum class DeferOnSuccess {};
+template <typename funcT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 DeferSuccess<funcT>
+operator+(DeferOnSuccess, funcT&& f) noexcept(
+    noexcept(DeferSuccess<funcT>{static_cast<funcT&&>(f)})) {
+  return DeferSuccess<funcT>{static_cast<funcT&&>(f)};
+}
+
+// `with_policy(p) + f` is used by the `DEFER_WITH` macros.
+template <typename policyT>
+struct DEFERRAL_VISIBILITY_HIDDEN PolicyHolder {
+  policyT policy;
+};
+
+template <typename policyT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20
+    PolicyHolder<typename decay<policyT>::type>
+    with_policy(policyT&& p) noexcept(
+        __is_nothrow_constructible(typename decay<policyT>::type, policyT&&)) {
+  return PolicyHolder<typename decay<policyT>::type>{static_cast<policyT&&>(p)};
+}
+
+template <typename policyT, typename funcT>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 DeferBase<funcT, policyT>
+operator+(PolicyHolder<policyT>&& h, funcT&& f) noexcept(noexcept(
+    DeferBase<funcT, policyT>{static_cast<policyT&&>(h.policy), static_cast<funcT&&>(f)})) {
+  return DeferBase<funcT, policyT>{static_cast<policyT&&>(h.policy), static_cast<funcT&&>(f)};
+}
+
+#if defined(DEFERRAL_MINIMAL_INSTANTIATION)
+#if __cplusplus < 201703L && !(defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#error "DEFERRAL_MINIMAL_INSTANTIATION requires C++17 or later"
+#endif
+
+/**
+ * @brief Guards used by the macros when `DEFERRAL_MINIMAL_INSTANTIATION` is defined.
+ *
+ * `MinimalGuard<policyT>::Guard` is deduced from the lambda by class template argument deduction,
+ * so a guard instantiates exactly one class, `Guard<lambda>`, with a non-template constructor, and
+ * no tag operator, factory function or derived class. `MinimalGuard<policyT>` itself is
+ * instantiated once per policy. All members are hidden and force-inlined, so no out-of-line body
+ * is emitted.
+ *
+ * @tparam policyT The policy that decides whether the function is executed.
+ */
+template <typename policyT>
+struct DEFERRAL_VISIBILITY_HIDDEN MinimalGuard {
+  template <typename funcT>
+  class DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN Guard : policyT {
+    DEFERRAL_NO_UNIQUE_ADDRESS funcT func;
+
+    void* operator new(decltype(sizeof(0))) = delete;
+    void operator delete(void*)             = delete;
+
+  public:
+    DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 Guard(funcT f) noexcept(
+        __is_nothrow_constructible(funcT, funcT&&)) :
+        policyT{}, func{static_cast<funcT&&>(f)} {}
+
+    Guard(const Guard&)            = delete;
+    Guard& operator=(const Guard&) = delete;
+
+    DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 ~Guard() noexcept(noexcept(func())) {
+      if(__builtin_expect(policyT::should_execute(), policyT::expect_execute)) { func(); }
+    }
+
+    using policyT::release;
+  }; // class Guard
+}; // struct MinimalGuard
+
+#endif // defined(DEFERRAL_MINIMAL_INSTANTIATION)
+
+} // namespace internal
+} // namespace deferral
+DEFERRAL_END_EXPORT
@@ -0,0 +1,452 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Deferred cleanup for sender/receiver (P2300, `std::execution`) pipelines.
+//
+// A guard cannot span an asynchronous operation: the scope that holds it ends when the operation
+// is started, not when it completes, and the cleanup may itself be asynchronous. The adapters
+// below run a cleanup sender after a sender completes, then forward the original completion:
+//  - `let_defer(sndr, cleanup)`: on every completion (value, error and stopped), like `defer`,
+//  - `let_defer_fail(sndr, cleanup)`: on the error completion only, like `defer_fail`,
+//  - `let_defer_success(sndr, cleanup)`: on the value completion only, like `defer_success`.
+// The cleanup sender, its operation state and the stored completion are all held in the
+// operation state of the adapter: nothing is allocated.
+//
+// Senders, receivers and operation states follow the member-function protocol of P2300R10
+// (`connect`, `start`, `set_value`/`set_error`/`set_stopped`, and a `completion_signatures` type).
+// The vocabulary (`set_value_t`, `connect`, `completion_signatures`, ...) is taken from
+// `DEFERRAL_EXECUTION_NAMESPACE`, which defaults to `std::execution` when the standard library
+// provides it (`__cpp_lib_senders`) and can be defined to a sender library's namespace, e.g.
+// `stdexec`. Otherwise this header defines a minimal vocabulary in `deferral::execution`.
+//
+// Requires C++17.
+
+#pragma once
+
+#include "deferral_core.hh"
+
+#if __cplusplus < 201703L && !(defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#error "deferral_execution.hh requires C++17 or later"
+#endif
+
+#include <exception>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#if defined(__has_include)
+#if __has_include(<version>)
+#include <version>
+#endif // __has_include(<version>)
+#endif // defined(__has_include)
+
+#if !defined(DEFERRAL_EXECUTION_NAMESPACE) && defined(__cpp_lib_senders)
+#include <execution>
+#define DEFERRAL_EXECUTION_NAMESPACE ::std::execution
+#endif // !defined(DEFERRAL_EXECUTION_NAMESPACE) && defined(__cpp_lib_senders)
+
+namespace deferral {
+namespace execution {
+
+#if defined(DEFERRAL_EXECUTION_NAMESPACE)
+
+using DEFERRAL_EXECUTION_NAMESPACE::completion_signatures;
+using DEFERRAL_EXECUTION_NAMESPACE::completion_signatures_of_t;
+using DEFERRAL_EXECUTION_NAMESPACE::connect;
+using DEFERRAL_EXECUTION_NAMESPACE::connect_result_t;
+using DEFERRAL_EXECUTION_NAMESPACE::get_env;
+using DEFERRAL_EXECUTION_NAMESPACE::operation_state_t;
+using DEFERRAL_EXECUTION_NAMESPACE::receiver_t;
+using DEFERRAL_EXECUTION_NAMESPACE::sender_t;
+using DEFERRAL_EXECUTION_NAMESPACE::set_error;
+using DEFERRAL_EXECUTION_NAMESPACE::set_error_t;
+using DEFERRAL_EXECUTION_NAMESPACE::set_stopped;
+using DEFERRAL_EXECUTION_NAMESPACE::set_stopped_t;
+using DEFERRAL_EXECUTION_NAMESPACE::set_value;
+using DEFERRAL_EXECUTION_NAMESPACE::set_value_t;
+using DEFERRAL_EXECUTION_NAMESPACE::start;
+
+#else
+
+struct sender_t {};
+struct receiver_t {};
+struct operation_state_t {};
+
+/**
+ * @brief The completion signatures of a sender, e.g.
+ * `completion_signatures<set_value_t(int), set_error_t(std::exception_ptr), set_stopped_t()>`.
+ */
+template <typename... sigTs>
+struct completion_signatures {};
+
+template <typename senderT>
+using completion_signatures_of_t =
+    typename std::remove_cv_t<std::remove_reference_t<senderT>>::completion_signatures;
+
+struct set_value_t {
+  template <typename R, typename... Vs>
+  void operator()(R&& r, Vs&&... vs) const noexcept {
+    static_cast<R&&>(r).set_value(static_cast<Vs&&>(vs)...);
+  }
+};
+struct set_error_t {
+  template <typename R, typename E>
+  void operator()(R&& r, E&& e) const noexcept {
+    static_cast<R&&>(r).set_error(static_cast<E&&>(e));
+  }
+};
+struct set_stopped_t {
+  template <typename R>
+  void operator()(R&& r) const noexcept {
+    static_cast<R&&>(r).set_stopped();
+  }
+};
+
+struct connect_t {
+  template <typename S, typename R>
+  auto operator()(S&& s, R&& r) const
+      -> decltype(static_cast<S&&>(s).connect(static_cast<R&&>(r))) {
+    return static_cast<S&&>(s).connect(static_cast<R&&>(r));
+  }
+};
+struct start_t {
+  template <typename O>
+  void operator()(O& op) const noexcept {
+    op.start();
+  }
+};
+
+// The environment of a receiver without `get_env()`.
+struct empty_env {};
+
+struct get_env_t {
+  template <typename T>
+  decltype(auto) operator()(const T& t) const noexcept {
+    return get(t, 0);
+  }
+
+private:
+  template <typename T>
+  static auto get(const T& t, int) noexcept -> decltype(t.get_env()) {
+    return t.get_env();
+  }
+  template <typename T>
+  static empty_env get(const T&, long) noexcept {
+    return {};
+  }
+};
+
+inline constexpr set_value_t set_value{};
+inline constexpr set_error_t set_error{};
+inline constexpr set_stopped_t set_stopped{};
+inline constexpr connect_t connect{};
+inline constexpr start_t start{};
+inline constexpr get_env_t get_env{};
+
+template <typename senderT, typename receiverT>
+using connect_result_t =
+    decltype(connect(std::declval<senderT>(), std::declval<receiverT>()));
+
+#endif // defined(DEFERRAL_EXECUTION_NAMESPACE)
+
+} // namespace execution
+
+namespace internal {
+
+// The completion channels after which a `let_defer` adapter runs its cleanup.
+enum : unsigned { defer_on_value = 1u, defer_on_error = 2u, defer_on_stopped = 4u };
+
+template <typename tagT>
+constexpr unsigned defer_channel() noexcept {
+  if constexpr(std::is_same_v<tagT, execution::set_value_t>) {
+    return defer_on_value;
+  } else if constexpr(std::is_same_v<tagT, execution::set_error_t>) {
+    return defer_on_error;
+  } else {
+    return defer_on_stopped;
+  }
+}
+
+// A completion, stored as its tag followed by the decayed arguments.
+template <typename sigT>
+struct stored_completion;
+template <typename tagT, typename... argTs>
+struct stored_completion<tagT(argTs...)> {
+  using type = std::tuple<tagT, std::decay_t<argTs>...>;
+};
+
+// A variant of `Ts...` without duplicates, which `std::variant::emplace<T>` needs. Signatures that
+// differ only in references or cv-qualifiers store the same tuple.
+template <typename variantT, typename... Ts>
+struct unique_variant {
+  using type = variantT;
+};
+template <typename... Vs, typename T, typename... Ts>
+struct unique_variant<std::variant<Vs...>, T, Ts...>
+    : unique_variant<std::conditional_t<(std::is_same_v<T, Vs> || ...), std::variant<Vs...>,
+                         std::variant<Vs..., T>>,
+          Ts...> {};
+
+template <typename sigsT>
+struct completion_storage;
+template <typename... sigTs>
+struct completion_storage<execution::completion_signatures<sigTs...>> {
+  using type = typename unique_variant<std::variant<std::monostate>,
+      typename stored_completion<sigTs>::type...>::type;
+};
+
+// The error and stopped signatures of the cleanup sender, which replace the stored completion.
+template <typename sigT>
+struct cleanup_signature {
+  using type = execution::completion_signatures<sigT>;
+};
+template <typename... argTs>
+struct cleanup_signature<execution::set_value_t(argTs...)> {
+  using type = execution::completion_signatures<>;
+};
+
+template <typename... sigsTs>
+struct concat_signatures {
+  using type = execution::completion_signatures<>;
+};
+template <typename sigsT>
+struct concat_signatures<sigsT> {
+  using type = sigsT;
+};
+template <typename... aTs, typename... bTs, typename... restTs>
+struct concat_signatures<execution::completion_signatures<aTs...>,
+    execution::completion_signatures<bTs...>, restTs...>
+    : concat_signatures<execution::completion_signatures<aTs..., bTs...>, restTs...> {};
+
+template <typename sigsT, typename cleanupSigsT>
+struct let_defer_signatures;
+template <typename sigsT, typename... cleanupSigTs>
+struct let_defer_signatures<sigsT, execution::completion_signatures<cleanupSigTs...>> {
+  using type = typename concat_signatures<sigsT,
+      execution::completion_signatures<execution::set_error_t(std::exception_ptr)>,
+      typename cleanup_signature<cleanupSigTs>::type...>::type;
+};
+
+/**
+ * @brief The operation state of a `let_defer` adapter.
+ *
+ * Holds the downstream receiver, the cleanup sender, the stored completion of the main sender and,
+ * once the main sender completes, the operation state of the cleanup sender, constructed in place.
+ */
+template <unsigned channels, typename senderT, typename cleanupT, typename receiverT>
+class DEFERRAL_VISIBILITY_HIDDEN LetDeferOperation {
+  struct MainReceiver {
+    using receiver_concept = execution::receiver_t;
+    LetDeferOperation* op;
+
+    template <typename... Vs>
+    void set_value(Vs&&... vs) && noexcept {
+      op->template complete<execution::set_value_t>(static_cast<Vs&&>(vs)...);
+    }
+    template <typename E>
+    void set_error(E&& e) && noexcept {
+      op->template complete<execution::set_error_t>(static_cast<E&&>(e));
+    }
+    void set_stopped() && noexcept { op->template complete<execution::set_stopped_t>(); }
+    decltype(auto) get_env() const noexcept { return execution::get_env(op->receiver); }
+  };
+
+  struct CleanupReceiver {
+    using receiver_concept = execution::receiver_t;
+    LetDeferOperation* op;
+
+    template <typename... Vs>
+    void set_value(Vs&&...) && noexcept {
+      op->finish();
+    }
+    template <typename E>
+    void set_error(E&& e) && noexcept {
+      execution::set_error(static_cast<receiverT&&>(op->receiver), static_cast<E&&>(e));
+    }
+    void set_stopped() && noexcept {
+      execution::set_stopped(static_cast<receiverT&&>(op->receiver));
+    }
+    decltype(auto) get_env() const noexcept { return execution::get_env(op->receiver); }
+  };
+
+  using main_op_t    = execution::connect_result_t<senderT, MainReceiver>;
+  using cleanup_op_t = execution::connect_result_t<cleanupT, CleanupReceiver>;
+  using storage_t =
+      typename completion_storage<execution::completion_signatures_of_t<senderT>>::type;
+
+  // Connects the cleanup sender in place: `std::optional::emplace` constructs the operation state
+  // from the prvalue returned by the conversion, so it need not be movable.
+  struct ConnectCleanup {
+    LetDeferOperation* op;
+    operator cleanup_op_t() && {
+      return execution::connect(static_cast<cleanupT&&>(op->cleanup), CleanupReceiver{op});
+    }
+  };
+
+  receiverT receiver;
+  cleanupT cleanup;
+  storage_t completion;
+  std::optional<cleanup_op_t> cleanup_op;
+  main_op_t main_op;
+
+  template <typename tagT, typename... argTs>
+  void complete(argTs&&... args) noexcept {
+    if constexpr((channels & defer_channel<tagT>()) == 0) {
+      tagT{}(static_cast<receiverT&&>(receiver), static_cast<argTs&&>(args)...);
+    } else {
+#if defined(__cpp_exceptions) || defined(_CPPUNWIND)
+      try {
+#endif // defined(__cpp_exceptions) || defined(_CPPUNWIND)
+        completion.template emplace<std::tuple<tagT, std::decay_t<argTs>...>>(
+            tagT{}, static_cast<argTs&&>(args)...);
+        cleanup_op.emplace(ConnectCleanup{this});
+#if defined(__cpp_exceptions) || defined(_CPPUNWIND)
+      } catch(...) {
+        execution::set_error(static_cast<receiverT&&>(receiver), std::current_exception());
+        return;
+      }
+#endif // defined(__cpp_exceptions) || defined(_CPPUNWIND)
+      execution::start(*cleanup_op);
+    }
+  }
+
+  // Forwards the stored completion once the cleanup sender has completed with a value.
+  void finish() noexcept {
+    std::visit(
+        [this](auto& stored) {
+          if constexpr(!std::is_same_v<std::decay_t<decltype(stored)>, std::monostate>) {
+            std::apply(
+                [this](auto tag, auto&... args) {
+                  tag(static_cast<receiverT&&>(receiver), std::move(args)...);
+                },
+                stored);
+          }
+        },
+        completion);
+  }
+
+public:
+  using operation_state_concept = execution::operation_state_t;
+
+  template <typename S, typename C, typename R>
+  LetDeferOperation(S&& s, C&& c, R&& r) :
+      receiver{static_cast<R&&>(r)}, cleanup{static_cast<C&&>(c)},
+      main_op{execution::connect(static_cast<S&&>(s), MainReceiver{this})} {}
+
+  LetDeferOperation(LetDeferOperation&&)            = delete;
+  LetDeferOperation& operator=(LetDeferOperation&&) = delete;
+
+  void start() & noexcept { execution::start(main_op); }
+}; // class LetDeferOperation
+
+/**
+ * @brief The sender returned by `let_defer`, `let_defer_fail` and `let_defer_success`.
+ *
+ * Completes like `senderT`, after running `cleanupT` on the completion channels in `channels`. An
+ * error or stopped completion of the cleanup replaces the completion of `senderT`.
+ */
+template <unsigned channels, typename senderT, typename cleanupT>
+class DEFERRAL_VISIBILITY_HIDDEN LetDeferSender {
+  senderT sender;
+  cleanupT cleanup;
+
+public:
+  using sender_concept        = execution::sender_t;
+  using completion_signatures = typename let_defer_signatures<
+      execution::completion_signatures_of_t<senderT>,
+      execution::completion_signatures_of_t<cleanupT>>::type;
+
+  template <typename S, typename C>
+  LetDeferSender(S&& s, C&& c) : sender{static_cast<S&&>(s)}, cleanup{static_cast<C&&>(c)} {}
+
+  template <typename R>
+  LetDeferOperation<channels, senderT, cleanupT, std::decay_t<R>> connect(R&& r) && {
+    return {static_cast<senderT&&>(sender), static_cast<cleanupT&&>(cleanup),
+        static_cast<R&&>(r)};
+  }
+
+  template <typename R>
+  LetDeferOperation<channels, senderT, cleanupT, std::decay_t<R>> connect(R&& r) const& {
+    return {sender, cleanup, static_cast<R&&>(r)};
+  }
+}; // class LetDeferSender
+
+template <unsigned channels, typename S, typename C>
+using let_defer_sender_t = LetDeferSender<channels, std::decay_t<S>, std::decay_t<C>>;
+
+} // namespace internal
+
+/**
+ * @brief Runs `cleanup` after `sndr` completes on any channel, then completes like `sndr`.
+ *
+ * @code
+ * auto work = deferral::let_defer(
+ *     read_block(file, offset),
+ *     close_file(file));  // an async sender, run on value, error and stopped
+ * @endcode
+ *
+ * @param sndr The sender.
+ * @param cleanup The cleanup sender. A value completion of `cleanup` forwards the completion of
+ * `sndr`; an error or stopped completion replaces it.
+ * @return A sender.
+ */
+template <typename senderT, typename cleanupT>
+internal::let_defer_sender_t<internal::defer_on_value | internal::defer_on_error |
+                                 internal::defer_on_stopped,
+    senderT, cleanupT>
+let_defer(senderT&& sndr, cleanupT&& cleanup) {
+  return {static_cast<senderT&&>(sndr), static_cast<cleanupT&&>(cleanup)};
+}
+
+/**
+ * @brief Runs `cleanup` only if `sndr` completes with an error, like `defer_fail`; value and
+ * stopped completions are forwarded directly.
+ *
+ * @param sndr The sender.
+ * @param cleanup The cleanup sender.
+ * @return A sender.
+ */
+template <typename senderT, typename cleanupT>
+internal::let_defer_sender_t<internal::defer_on_error, senderT, cleanupT> let_defer_fail(
+    senderT&& sndr, cleanupT&& cleanup) {
+  return {static_cast<senderT&&>(sndr), static_cast<cleanupT&&>(cleanup)};
+}
+
+/**
+ * @brief Runs `cleanup` only if `sndr` completes with a value, like `defer_success`; error and
+ * stopped completions are forwarded directly.
+ *
+ * @param sndr The sender.
+ * @param cleanup The cleanup sender.
+ * @return A sender.
+ */
+template <typename senderT, typename cleanupT>
+internal::let_defer_sender_t<internal::defer_on_value, senderT, cleanupT> let_defer_success(
+    senderT&& sndr, cleanupT&& cleanup) {
+  return {static_cast<senderT&&>(sndr), static_cast<cleanupT&&>(cleanup)};
+}
+
+} // namespace deferral
@@ -0,0 +1,110 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Fiber support for deferral's fail and success guards.
+//
+// `DeferFail`, `DeferSuccess` and the `DEFER_FAIL`/`DEFER_SUCCESS` macros compare the uncaught
+// exception count at construction with the count at destruction. The C++ runtime keeps that count
+// per thread, so when a fiber scheduler switches stacks in the middle of a scope, a guard may
+// compare counts that belong to different fibers. The functions below give each fiber its own copy
+// of the runtime's exception globals and swap them on every context switch. The guards themselves
+// are unchanged and still read the thread's count directly.
+//
+// Only available with the Itanium C++ ABI runtime (GCC, Clang), on platforms with <ucontext.h>.
+
+#pragma once
+
+#include "deferral_core.hh"
+
+#include <ucontext.h>
+
+#if !defined(DEFERRAL_USE_CXA_GET_GLOBALS)
+#error "deferral_fiber.hh requires the Itanium C++ ABI exception globals"
+#endif // !defined(DEFERRAL_USE_CXA_GET_GLOBALS)
+
+namespace deferral {
+namespace fiber {
+
+/**
+ * @brief The C++ exception state of one fiber.
+ *
+ * A copy of the runtime's per-thread `__cxa_eh_globals`: the stack of caught exceptions and the
+ * uncaught exception count. A new fiber starts with no exceptions.
+ */
+struct ExceptionState {
+  void* caught_exceptions{nullptr};
+  unsigned int uncaught_exceptions{0};
+}; // struct ExceptionState
+
+/**
+ * @brief Saves the current thread's exception state in `from` and installs `to`.
+ *
+ * Call this right before switching from the fiber that owns `from` to the fiber that owns `to`,
+ * for schedulers that do not switch with `swapcontext`.
+ *
+ * @param from The exception state of the fiber being switched out.
+ * @param to The exception state of the fiber being switched in.
+ */
+inline void switch_exception_state(ExceptionState& from, const ExceptionState& to) noexcept {
+  char* globals = reinterpret_cast<char*>(__cxxabiv1::__cxa_get_globals());
+  void** caught = reinterpret_cast<void**>(globals);
+  unsigned int* uncaught = reinterpret_cast<unsigned int*>(globals + sizeof(void*));
+
+  from.caught_exceptions   = *caught;
+  from.uncaught_exceptions = *uncaught;
+  *caught                  = to.caught_exceptions;
+  *uncaught                = to.uncaught_exceptions;
+}
+
+/**
+ * @brief `swapcontext` that also switches the C++ exception state.
+ *
+ * A reference context switch hook: use it in place of `swapcontext(from, to)`, with one
+ * `ExceptionState` kept next to each fiber's `ucontext_t`.
+ *
+ * @code
+ * struct Fiber {
+ *   ucontext_t context;
+ *   deferral::fiber::ExceptionState exceptions;
+ * };
+ *
+ * void switch_to(Fiber& from, Fiber& to) {
+ *   deferral::fiber::swap_context(&from.context, from.exceptions, &to.context, to.exceptions);
+ * }
+ * @endcode
+ *
+ * @param from The context to save the current fiber in.
+ * @param from_state The exception state of the current fiber.
+ * @param to The context to switch to.
+ * @param to_state The exception state of the fiber being switched in.
+ * @return The result of `swapcontext`.
+ */
+inline int swap_context(ucontext_t* from, ExceptionState& from_state, const ucontext_t* to,
+    const ExceptionState& to_state) noexcept {
+  switch_exception_state(from_state, to_state);
+  return swapcontext(from, to);
+}
+
+} // namespace fiber
+} // namespace deferral
@@ -0,0 +1,236 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Floating-point mode guards.
+//
+// `DeferFloatMode` sets the denormal handling and rounding mode of the calling thread for a scope
+// and restores the bits it changed on every exit, leaving the exception flags raised inside the
+// scope set. It reads and writes the control register directly, MXCSR on x86 and FPCR on AArch64,
+// which is a single instruction each way rather than the full environment copy of
+// `fegetenv`/`fesetenv`, and skips the writes when the requested mode is already in effect.
+// Elsewhere only the rounding mode is supported, through <cfenv>.
+//
+// On x86 only SSE/AVX arithmetic is affected; x87 `long double` arithmetic is not. The compiler
+// does not order floating-point operations against the mode change unless the code is built with
+// `-frounding-math`; keep the kernel in a separate, non-inlined function otherwise.
+
+#pragma once
+
+#include "deferral_core.hh"
+
+#include <cstdint>
+
+#if(defined(__x86_64__) || (defined(__i386__) && defined(__SSE__))) && defined(__GNUC__)
+#define DEFERRAL_FP_X86 1
+#include <xmmintrin.h>
+#elif defined(__aarch64__) && defined(__GNUC__)
+#define DEFERRAL_FP_AARCH64 1
+#else
+#include <cfenv>
+#endif
+
+namespace deferral {
+namespace internal {
+
+#if defined(DEFERRAL_FP_X86)
+using fp_control_t = unsigned int;
+
+// MXCSR: FTZ flushes denormal results to zero, DAZ treats denormal inputs as zero.
+constexpr fp_control_t fp_flush_bits     = 0x8040u;
+constexpr fp_control_t fp_rounding_mask  = 0x6000u;
+constexpr fp_control_t fp_round_nearest  = 0x0000u;
+constexpr fp_control_t fp_round_down     = 0x2000u;
+constexpr fp_control_t fp_round_up       = 0x4000u;
+constexpr fp_control_t fp_round_toward_0 = 0x6000u;
+
+DEFERRAL_ALWAYS_INLINE fp_control_t get_fp_control() noexcept {
+  return _mm_getcsr();
+}
+DEFERRAL_ALWAYS_INLINE void set_fp_control(fp_control_t c) noexcept {
+  _mm_setcsr(c);
+}
+#elif defined(DEFERRAL_FP_AARCH64)
+using fp_control_t = std::uint64_t;
+
+// FPCR: FZ flushes denormal inputs and results to zero.
+constexpr fp_control_t fp_flush_bits     = fp_control_t{1} << 24;
+constexpr fp_control_t fp_rounding_mask  = fp_control_t{3} << 22;
+constexpr fp_control_t fp_round_nearest  = fp_control_t{0} << 22;
+constexpr fp_control_t fp_round_up       = fp_control_t{1} << 22;
+constexpr fp_control_t fp_round_down     = fp_control_t{2} << 22;
+constexpr fp_control_t fp_round_toward_0 = fp_control_t{3} << 22;
+
+DEFERRAL_ALWAYS_INLINE fp_control_t get_fp_control() noexcept {
+  fp_control_t c;
+  __asm__ __volatile__("mrs %0, fpcr" : "=r"(c));
+  return c;
+}
+DEFERRAL_ALWAYS_INLINE void set_fp_control(fp_control_t c) noexcept {
+  __asm__ __volatile__("msr fpcr, %0" : : "r"(c));
+}
+#else
+// The <cfenv> rounding mode. Denormal handling is not available.
+using fp_control_t = unsigned int;
+
+constexpr fp_control_t fp_flush_bits     = 0;
+constexpr fp_control_t fp_rounding_mask  = ~0u;
+constexpr fp_control_t fp_round_nearest  = FE_TONEAREST;
+constexpr fp_control_t fp_round_down     = FE_DOWNWARD;
+constexpr fp_control_t fp_round_up       = FE_UPWARD;
+constexpr fp_control_t fp_round_toward_0 = FE_TOWARDZERO;
+
+DEFERRAL_ALWAYS_INLINE fp_control_t get_fp_control() noexcept {
+  return static_cast<fp_control_t>(std::fegetround());
+}
+DEFERRAL_ALWAYS_INLINE void set_fp_control(fp_control_t c) noexcept {
+  std::fesetround(static_cast<int>(c));
+}
+#endif
+
+} // namespace internal
+
+/**
+ * @brief A floating-point mode: the control register bits to change and their new values.
+ * Combine modes with `|`.
+ *
+ * @code
+ * constexpr auto mode = deferral::FloatMode::flush_denormals() | deferral::FloatMode::round_down();
+ * @endcode
+ */
+struct FloatMode {
+  internal::fp_control_t mask;
+  internal::fp_control_t bits;
+
+  /**
+   * @brief Flush denormal results and inputs to zero (FTZ and DAZ on x86, FZ on AArch64).
+   * Changes nothing where not available; see `flush_denormals_supported()`.
+   */
+  static constexpr FloatMode flush_denormals() noexcept {
+    return FloatMode{internal::fp_flush_bits, internal::fp_flush_bits};
+  }
+
+  /**
+   * @brief Keep denormals (IEEE 754 gradual underflow).
+   */
+  static constexpr FloatMode keep_denormals() noexcept {
+    return FloatMode{internal::fp_flush_bits, 0};
+  }
+
+  static constexpr FloatMode round_nearest() noexcept {
+    return FloatMode{internal::fp_rounding_mask, internal::fp_round_nearest};
+  }
+  static constexpr FloatMode round_down() noexcept {
+    return FloatMode{internal::fp_rounding_mask, internal::fp_round_down};
+  }
+  static constexpr FloatMode round_up() noexcept {
+    return FloatMode{internal::fp_rounding_mask, internal::fp_round_up};
+  }
+  static constexpr FloatMode round_toward_zero() noexcept {
+    return FloatMode{internal::fp_rounding_mask, internal::fp_round_toward_0};
+  }
+
+  /**
+   * @brief Returns whether `flush_denormals()` has an effect on this target.
+   */
+  static constexpr bool flush_denormals_supported() noexcept {
+    return internal::fp_flush_bits != 0;
+  }
+
+  /**
+   * @brief Combines two modes. Where both change the same bits, `other` wins.
+   */
+  constexpr FloatMode operator|(FloatMode other) const noexcept {
+    return FloatMode{mask | other.mask, (bits & ~other.mask) | other.bits};
+  }
+
+  /**
+   * @brief Returns `c` with this mode applied.
+   */
+  constexpr internal::fp_control_t apply(internal::fp_control_t c) const noexcept {
+    return (c & ~mask) | bits;
+  }
+}; // struct FloatMode
+
+namespace internal {
+
+// The function of `DeferFloatMode`. Only the bits in `mask` are restored from `saved`, so that the
+// sticky exception flags raised inside the scope survive; `changed` is false when the mode was
+// already in effect and nothing was written.
+struct DEFERRAL_VISIBILITY_HIDDEN RestoreFloatMode {
+  fp_control_t saved;
+  fp_control_t mask;
+  bool changed;
+
+  DEFERRAL_ALWAYS_INLINE void operator()() const noexcept {
+    if(changed) { set_fp_control((get_fp_control() & ~mask) | (saved & mask)); }
+  }
+}; // struct RestoreFloatMode
+
+DEFERRAL_ALWAYS_INLINE RestoreFloatMode enter_float_mode(FloatMode mode) noexcept {
+  const fp_control_t saved = get_fp_control();
+  const bool changed       = (saved & mode.mask) != mode.bits;
+  if(changed) { set_fp_control(mode.apply(saved)); }
+  return RestoreFloatMode{saved, mode.mask, changed};
+}
+
+} // namespace internal
+
+/**
+ * @brief A guard that sets a floating-point mode for the calling thread and restores the previous
+ * mode on every scope exit, unless released. Exception flags raised in the scope are kept.
+ *
+ * @code
+ * void filter(float* x, std::size_t n) {
+ *   deferral::DeferFloatMode ftz{deferral::FloatMode::flush_denormals()};
+ *   run_kernel(x, n);
+ * }
+ * @endcode
+ */
+struct DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN DeferFloatMode
+    : internal::DeferBase<internal::RestoreFloatMode, internal::OnExitPolicy> {
+  using base_t = internal::DeferBase<internal::RestoreFloatMode, internal::OnExitPolicy>;
+
+  /**
+   * @brief Sets `mode`, unless it is already in effect.
+   *
+   * @param mode The mode to set.
+   */
+  DEFERRAL_ALWAYS_INLINE explicit DeferFloatMode(FloatMode mode) noexcept :
+      base_t{internal::enter_float_mode(mode)} {}
+  DEFERRAL_ALWAYS_INLINE DeferFloatMode(DeferFloatMode&&) = default;
+  DEFERRAL_ALWAYS_INLINE ~DeferFloatMode()                = default;
+}; // struct DeferFloatMode
+
+/**
+ * @brief Creates a `DeferFloatMode` object.
+ *
+ * @param mode The mode to set.
+ * @return A `DeferFloatMode` object.
+ */
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DeferFloatMode make_defer_float_mode(
+    FloatMode mode) noexcept {
+  return DeferFloatMode{mode};
+}
+
+} // namespace deferral
@@ -0,0 +1,532 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Lock wait and hold time profiler.
+//
+// `DEFER_PROFILE_LOCK("name", m);` locks `m` and unlocks it when the scope exits, like
+// `std::lock_guard`, and records for the lock site "name" how long the lock took to acquire (the
+// wait time, zero when `try_lock()` succeeds at once) and how long it was held. Each thread
+// records into its own log2 histograms, indexed by a site id assigned when the site is first
+// used; the histograms of a thread are merged into a shared table when it exits. `lock_report()`
+// sums them, most contended site first. With `DEFERRAL_NO_LOCK_PROFILE` defined the macro creates
+// a guard that only locks and unlocks.
+
+#pragma once
+
+#include "deferral_core.hh"
+#include "deferral_macros.hh"
+#include "deferral_profile.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// The number of lock sites that are recorded. Sites beyond it lock and unlock without recording.
+#if !defined(DEFERRAL_LOCK_PROFILE_MAX_SITES)
+#define DEFERRAL_LOCK_PROFILE_MAX_SITES 4096
+#endif // !defined(DEFERRAL_LOCK_PROFILE_MAX_SITES)
+
+namespace deferral {
+namespace profile {
+
+class LockSite;
+struct LockSiteReport;
+
+inline std::vector<LockSiteReport> lock_report();
+
+namespace internal {
+
+// Histogram bucket 0 counts zero durations, bucket i > 0 durations in [2^(i-1), 2^i) ns. The last
+// bucket also counts everything longer (2^46 ns is about 20 hours).
+constexpr unsigned lock_buckets    = 48;
+constexpr unsigned lock_chunk_size = 8;
+constexpr unsigned lock_max_sites  = DEFERRAL_LOCK_PROFILE_MAX_SITES;
+constexpr unsigned lock_chunks     = (lock_max_sites + lock_chunk_size - 1) / lock_chunk_size;
+
+// The number of bits needed to represent `v`: 0 for 0, else one more than the index of the highest
+// set bit.
+DEFERRAL_ALWAYS_INLINE unsigned bit_width(std::uint64_t v) noexcept {
+#if defined(__GNUC__)
+  return v == 0 ? 0 : 64u - static_cast<unsigned>(__builtin_clzll(v));
+#else
+  unsigned n = 0;
+  for(; v != 0; v >>= 1) { ++n; }
+  return n;
+#endif // defined(__GNUC__)
+}
+
+DEFERRAL_ALWAYS_INLINE unsigned lock_bucket(std::uint64_t ns) noexcept {
+  return std::min(lock_buckets - 1, bit_width(ns));
+}
+
+// A counter written by one thread and read by `lock_report()` on another. A load and a store
+// rather than a `fetch_add`, so that recording does not need a locked instruction.
+struct LockCounter {
+  std::atomic<std::uint64_t> value;
+
+  DEFERRAL_ALWAYS_INLINE void add(std::uint64_t v) noexcept {
+    value.store(value.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+  }
+  DEFERRAL_ALWAYS_INLINE void max(std::uint64_t v) noexcept {
+    if(v > value.load(std::memory_order_relaxed)) { value.store(v, std::memory_order_relaxed); }
+  }
+  DEFERRAL_ALWAYS_INLINE std::uint64_t get() const noexcept {
+    return value.load(std::memory_order_relaxed);
+  }
+};
+
+// The counters of one site in one thread.
+struct LockStats {
+  LockCounter acquisitions;
+  LockCounter contended;
+  LockCounter wait_ns;
+  LockCounter max_wait_ns;
+  LockCounter hold_ns;
+  LockCounter wait_histogram[lock_buckets];
+  LockCounter hold_histogram[lock_buckets];
+
+  void merge_into(LockStats& to) const noexcept {
+    to.acquisitions.add(acquisitions.get());
+    to.contended.add(contended.get());
+    to.wait_ns.add(wait_ns.get());
+    to.max_wait_ns.max(max_wait_ns.get());
+    to.hold_ns.add(hold_ns.get());
+    for(unsigned i = 0; i < lock_buckets; ++i) {
+      to.wait_histogram[i].add(wait_histogram[i].get());
+      to.hold_histogram[i].add(hold_histogram[i].get());
+    }
+  }
+};
+
+// The counters of every site in one thread, allocated `lock_chunk_size` sites at a time as the
+// thread uses them. Only the owning thread allocates; readers load the chunk pointers.
+struct LockTable {
+  std::atomic<LockStats*> chunks[lock_chunks];
+  LockTable* prev;
+  LockTable* next;
+
+  LockTable() noexcept : chunks{}, prev{nullptr}, next{nullptr} {}
+  LockTable(const LockTable&)            = delete;
+  LockTable& operator=(const LockTable&) = delete;
+  ~LockTable() {
+    for(auto& c : chunks) { delete[] c.load(std::memory_order_relaxed); }
+  }
+
+  LockStats& at(std::uint32_t id) {
+    std::atomic<LockStats*>& chunk = chunks[id / lock_chunk_size];
+    LockStats* stats               = chunk.load(std::memory_order_relaxed);
+    if(stats == nullptr) {
+      stats = new LockStats[lock_chunk_size]();
+      chunk.store(stats, std::memory_order_release);
+    }
+    return stats[id % lock_chunk_size];
+  }
+
+  const LockStats* find(std::uint32_t id) const noexcept {
+    const LockStats* stats = chunks[id / lock_chunk_size].load(std::memory_order_acquire);
+    return stats == nullptr ? nullptr : stats + id % lock_chunk_size;
+  }
+};
+
+// The process-wide state. Never destroyed, so that threads exiting after `main` can still merge
+// their tables.
+struct LockRegistry {
+  std::mutex mutex;
+  LockTable* threads = nullptr;
+  LockTable retired;
+  std::uint32_t site_count = 0;
+  const LockSite* sites[lock_max_sites] = {};
+};
+
+inline LockRegistry& lock_registry() {
+  static LockRegistry* registry = new LockRegistry;
+  return *registry;
+}
+
+DEFERRAL_ALWAYS_INLINE LockTable*& lock_table_slot() noexcept {
+  static thread_local LockTable* table = nullptr;
+  return table;
+}
+
+// Set when the table of the thread has been merged, at thread exit.
+inline bool& lock_table_exited() noexcept {
+  static thread_local bool exited = false;
+  return exited;
+}
+
+// Merges the table of the thread into `LockRegistry::retired` when the thread exits. Locks taken
+// later, by the destructors of other thread-locals, are not recorded.
+struct LockTableOwner {
+  LockTable* table = nullptr;
+
+  ~LockTableOwner() {
+    if(table == nullptr) { return; }
+    LockRegistry& registry = lock_registry();
+    {
+      std::lock_guard<std::mutex> lock{registry.mutex};
+      for(std::uint32_t id = 0; id < registry.site_count; ++id) {
+        if(const LockStats* stats = table->find(id)) {
+          stats->merge_into(registry.retired.at(id));
+        }
+      }
+      (table->prev != nullptr ? table->prev->next : registry.threads) = table->next;
+      if(table->next != nullptr) { table->next->prev = table->prev; }
+    }
+    lock_table_exited() = true;
+    lock_table_slot()   = nullptr;
+    delete table;
+  }
+};
+
+// Creates the table of the calling thread, on the first profiled lock of the thread. Returns
+// `nullptr` once the thread has exited.
+DEFERRAL_COLD inline LockTable* new_lock_table() {
+  if(lock_table_exited()) { return nullptr; }
+  static thread_local LockTableOwner owner;
+  LockRegistry& registry = lock_registry();
+  LockTable* table       = new LockTable;
+  {
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    table->next = registry.threads;
+    if(registry.threads != nullptr) { registry.threads->prev = table; }
+    registry.threads = table;
+  }
+  owner.table = table;
+  return table;
+}
+
+DEFERRAL_ALWAYS_INLINE LockTable* lock_table() {
+  LockTable*& table = lock_table_slot();
+  if(__builtin_expect(table == nullptr, false)) { table = new_lock_table(); }
+  return table;
+}
+
+DEFERRAL_COLD inline std::uint32_t register_lock_site(LockSite& site);
+
+} // namespace internal
+
+/**
+ * @brief A lock site: the static data of one `DEFER_PROFILE_LOCK` in the source.
+ *
+ * Constant-initialized, so that a function-local `static LockSite` has no initialization guard.
+ * Its id is assigned when it is first used.
+ */
+class LockSite {
+  const char* name;
+  const char* file;
+  unsigned line;
+  // 0 until assigned, then the index of the site plus one; `lock_max_sites + 1` if there was no
+  // room left.
+  std::atomic<std::uint32_t> id;
+
+  friend std::uint32_t internal::register_lock_site(LockSite&);
+  friend std::vector<LockSiteReport> lock_report();
+
+public:
+  /**
+   * @brief Constructs a lock site.
+   *
+   * @param n The name of the site, a string literal.
+   * @param f The source file, usually `__FILE__`.
+   * @param l The source line, usually `__LINE__`.
+   */
+  constexpr LockSite(const char* n, const char* f, unsigned l) noexcept :
+      name{n}, file{f}, line{l}, id{0} {}
+
+  LockSite(const LockSite&)            = delete;
+  LockSite& operator=(const LockSite&) = delete;
+
+  /**
+   * @brief Returns the counters of the site in the calling thread, or `nullptr` if the site is
+   * not recorded: there was no room for it, or the thread is exiting.
+   */
+  DEFERRAL_ALWAYS_INLINE internal::LockStats* stats() {
+    std::uint32_t i = id.load(std::memory_order_acquire);
+    if(__builtin_expect(i == 0, false)) { i = internal::register_lock_site(*this); }
+    if(i > internal::lock_max_sites) { return nullptr; }
+    internal::LockTable* const table = internal::lock_table();
+    return table != nullptr ? &table->at(i - 1) : nullptr;
+  }
+}; // class LockSite
+
+namespace internal {
+
+inline std::uint32_t register_lock_site(LockSite& site) {
+  LockRegistry& registry = lock_registry();
+  std::lock_guard<std::mutex> lock{registry.mutex};
+  std::uint32_t i = site.id.load(std::memory_order_relaxed);
+  if(i == 0) {
+    if(registry.site_count < lock_max_sites) {
+      registry.sites[registry.site_count] = &site;
+      i                                   = ++registry.site_count;
+    } else {
+      i = lock_max_sites + 1;
+    }
+    site.id.store(i, std::memory_order_release);
+  }
+  return i;
+}
+
+// The function of `PlainLock`.
+template <typename mutexT>
+struct DEFERRAL_VISIBILITY_HIDDEN Unlock {
+  mutexT* mutex;
+
+  DEFERRAL_ALWAYS_INLINE void operator()() const { mutex->unlock(); }
+}; // struct Unlock
+
+// The function of `ProfiledLock`: records the hold time, then unlocks.
+template <typename mutexT>
+struct DEFERRAL_VISIBILITY_HIDDEN TimedUnlock {
+  mutexT* mutex;
+  LockStats* stats;
+  std::uint64_t acquired;
+
+  DEFERRAL_ALWAYS_INLINE void operator()() const {
+    if(stats != nullptr) {
+      const std::uint64_t held = now_ns() - acquired;
+      stats->hold_ns.add(held);
+      stats->hold_histogram[lock_bucket(held)].add(1);
+    }
+    mutex->unlock();
+  }
+}; // struct TimedUnlock
+
+// Locks `m`, timing the wait if `try_lock()` fails, and records the acquisition.
+template <typename mutexT>
+DEFERRAL_ALWAYS_INLINE TimedUnlock<mutexT> timed_lock(LockSite& site, mutexT& m) {
+  LockStats* stats = site.stats();
+  if(stats == nullptr) {
+    m.lock();
+    return TimedUnlock<mutexT>{&m, nullptr, 0};
+  }
+  std::uint64_t wait = 0;
+  std::uint64_t acquired;
+  if(__builtin_expect(m.try_lock(), true)) {
+    acquired = now_ns();
+  } else {
+    const std::uint64_t start = now_ns();
+    m.lock();
+    acquired = now_ns();
+    wait     = acquired - start;
+    stats->contended.add(1);
+    stats->wait_ns.add(wait);
+    stats->max_wait_ns.max(wait);
+  }
+  stats->acquisitions.add(1);
+  stats->wait_histogram[lock_bucket(wait)].add(1);
+  return TimedUnlock<mutexT>{&m, stats, acquired};
+}
+
+} // namespace internal
+
+/**
+ * @brief A guard that locks a mutex and unlocks it when it goes out of scope, unless released.
+ * The guard `DEFER_PROFILE_LOCK` creates when `DEFERRAL_NO_LOCK_PROFILE` is defined.
+ *
+ * @tparam mutexT A type with `lock()` and `unlock()`.
+ */
+template <typename mutexT>
+struct DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN PlainLock
+    : deferral::internal::DeferBase<internal::Unlock<mutexT>, deferral::internal::OnExitPolicy> {
+  using base_t =
+      deferral::internal::DeferBase<internal::Unlock<mutexT>, deferral::internal::OnExitPolicy>;
+
+  /**
+   * @brief Locks `m`.
+   *
+   * @param m The mutex.
+   */
+  DEFERRAL_ALWAYS_INLINE explicit PlainLock(mutexT& m) :
+      base_t{(m.lock(), internal::Unlock<mutexT>{&m})} {}
+  DEFERRAL_ALWAYS_INLINE PlainLock(PlainLock&&) = default;
+  DEFERRAL_ALWAYS_INLINE ~PlainLock()           = default;
+}; // struct PlainLock
+
+/**
+ * @brief A guard that locks a mutex and unlocks it when it goes out of scope, unless released,
+ * and records the wait and hold times for a lock site.
+ *
+ * @tparam mutexT A type with `lock()`, `try_lock()` and `unlock()`.
+ */
+template <typename mutexT>
+struct DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN ProfiledLock
+    : deferral::internal::DeferBase<internal::TimedUnlock<mutexT>,
+          deferral::internal::OnExitPolicy> {
+  using base_t = deferral::internal::DeferBase<internal::TimedUnlock<mutexT>,
+      deferral::internal::OnExitPolicy>;
+
+  /**
+   * @brief Locks `m` and records the acquisition for `site`.
+   *
+   * @param site The lock site.
+   * @param m The mutex.
+   */
+  DEFERRAL_ALWAYS_INLINE ProfiledLock(LockSite& site, mutexT& m) :
+      base_t{internal::timed_lock(site, m)} {}
+  DEFERRAL_ALWAYS_INLINE ProfiledLock(ProfiledLock&&) = default;
+  DEFERRAL_ALWAYS_INLINE ~ProfiledLock()              = default;
+}; // struct ProfiledLock
+
+/**
+ * @brief The wait and hold times of one lock site, summed over all threads.
+ */
+struct LockSiteReport {
+  const char* name;
+  const char* file;
+  unsigned line;
+  // The number of times the lock was acquired.
+  std::uint64_t acquisitions;
+  // The number of acquisitions that had to wait because `try_lock()` failed.
+  std::uint64_t contended;
+  std::uint64_t wait_total_ns;
+  std::uint64_t wait_max_ns;
+  std::uint64_t hold_total_ns;
+  // Percentiles of all acquisitions, including those that did not wait, rounded up to the upper
+  // bound of their histogram bucket, a power of two.
+  std::uint64_t wait_p50_ns;
+  std::uint64_t wait_p99_ns;
+  std::uint64_t hold_p50_ns;
+  std::uint64_t hold_p99_ns;
+  // Bucket 0 counts zero durations, bucket i > 0 durations in [2^(i-1), 2^i) ns.
+  std::uint64_t wait_histogram[internal::lock_buckets];
+  std::uint64_t hold_histogram[internal::lock_buckets];
+};
+
+namespace internal {
+
+inline std::uint64_t histogram_percentile(
+    const std::uint64_t (&histogram)[lock_buckets], std::uint64_t count, unsigned percent) {
+  const std::uint64_t rank = (count * percent + 99) / 100;
+  std::uint64_t seen       = 0;
+  for(unsigned i = 0; i < lock_buckets; ++i) {
+    seen += histogram[i];
+    if(seen >= rank && seen > 0) { return i == 0 ? 0 : std::uint64_t{1} << i; }
+  }
+  return 0;
+}
+
+} // namespace internal
+
+/**
+ * @brief Returns the lock sites that have been acquired, most contended (`wait_total_ns`) first.
+ *
+ * The counts are cumulative since the start of the process. May be called while other threads
+ * hold profiled locks; their counters are read one at a time.
+ */
+inline std::vector<LockSiteReport> lock_report() {
+  std::vector<LockSiteReport> result;
+  internal::LockRegistry& registry = internal::lock_registry();
+  std::lock_guard<std::mutex> lock{registry.mutex};
+  for(std::uint32_t id = 0; id < registry.site_count; ++id) {
+    internal::LockStats sum{};
+    if(const internal::LockStats* stats = registry.retired.find(id)) { stats->merge_into(sum); }
+    for(const internal::LockTable* t = registry.threads; t != nullptr; t = t->next) {
+      if(const internal::LockStats* stats = t->find(id)) { stats->merge_into(sum); }
+    }
+    if(sum.acquisitions.get() == 0) { continue; }
+
+    const LockSite& site = *registry.sites[id];
+    LockSiteReport r{};
+    r.name          = site.name;
+    r.file          = site.file;
+    r.line          = site.line;
+    r.acquisitions  = sum.acquisitions.get();
+    r.contended     = sum.contended.get();
+    r.wait_total_ns = sum.wait_ns.get();
+    r.wait_max_ns   = sum.max_wait_ns.get();
+    r.hold_total_ns = sum.hold_ns.get();
+    std::uint64_t holds = 0;
+    for(unsigned i = 0; i < internal::lock_buckets; ++i) {
+      r.wait_histogram[i] = sum.wait_histogram[i].get();
+      r.hold_histogram[i] = sum.hold_histogram[i].get();
+      holds += r.hold_histogram[i];
+    }
+    r.wait_p50_ns = internal::histogram_percentile(r.wait_histogram, r.acquisitions, 50);
+    r.wait_p99_ns = internal::histogram_percentile(r.wait_histogram, r.acquisitions, 99);
+    r.hold_p50_ns = internal::histogram_percentile(r.hold_histogram, holds, 50);
+    r.hold_p99_ns = internal::histogram_percentile(r.hold_histogram, holds, 99);
+    result.push_back(r);
+  }
+  std::sort(result.begin(), result.end(), [](const LockSiteReport& a, const LockSiteReport& b) {
+    return a.wait_total_ns != b.wait_total_ns ? a.wait_total_ns > b.wait_total_ns
+                                              : a.contended > b.contended;
+  });
+  return result;
+}
+
+namespace internal {
+
+template <typename mutexT>
+DEFERRAL_ALWAYS_INLINE PlainLock<mutexT> plain_lock(mutexT& m) {
+  return PlainLock<mutexT>{m};
+}
+
+template <typename mutexT>
+DEFERRAL_ALWAYS_INLINE ProfiledLock<mutexT> profiled_lock(LockSite& site, mutexT& m) {
+  return ProfiledLock<mutexT>{site, m};
+}
+
+} // namespace internal
+
+} // namespace profile
+} // namespace deferral
+
+#if !defined(DEFERRAL_NO_MACROS)
+
+/**
+ * @brief Locks `mutex` until the end of the scope and records the wait and hold times for the
+ * lock site `name`. With `DEFERRAL_NO_LOCK_PROFILE` defined, only locks and unlocks.
+ * @def DEFER_PROFILE_LOCK(name, mutex)
+ *
+ * @code
+ * void Queue::push(Item item) {
+ *   DEFER_PROFILE_LOCK("queue.push", mutex);
+ *   items.push_back(std::move(item));
+ * }
+ * @endcode
+ *
+ * @param name The name of the site, a string literal.
+ * @param mutex The mutex to lock.
+ */
+#if defined(DEFERRAL_NO_LOCK_PROFILE)
+#define DEFER_PROFILE_LOCK(name, mutex)                                                            \
+  DEFERRAL_MAYBE_UNUSED auto DEFERRAL_ANONYMOUS_VARIABLE(DEFERRAL_LOCK_GUARD) =                    \
+      ::deferral::profile::internal::plain_lock(mutex)
+#else
+#define DEFER_PROFILE_LOCK(name, mutex)                                                            \
+  DEFERRAL_PROFILE_LOCK_(DEFERRAL_ANONYMOUS_VARIABLE(DEFERRAL_LOCK_SITE), name, mutex)
+#endif // defined(DEFERRAL_NO_LOCK_PROFILE)
+#define DEFERRAL_PROFILE_LOCK_(site, name, mutex)                                                  \
+  static ::deferral::profile::LockSite site{name, __FILE__, __LINE__};                             \
+  DEFERRAL_MAYBE_UNUSED auto DEFERRAL_CONCATENATE(site, _GUARD) =                                  \
+      ::deferral::profile::internal::profiled_lock(site, mutex)
+
+#if !defined(DEFERRAL_NO_KEYWORDS)
+#define defer_profile_lock(name, mutex) DEFER_PROFILE_LOCK(name, mutex)
+#endif // !defined(DEFERRAL_NO_KEYWORDS)
+
+#endif // !defined(DEFERRAL_NO_MACROS)
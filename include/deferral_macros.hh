@@ -0,0 +1,400 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Macro-only part of deferral: the `DEFER`/`defer` family and the helpers they expand to. It has no
+// includes and no declarations, so it can be imported as a header unit alongside the `deferral`
+// module:
+//
+//   import deferral;
+//   #include <deferral_macros.hh> // or: import <deferral_macros.hh>;
+//
+// deferral.hh includes this file, so header users do not need to include it directly.
+
+#pragma once
+
+#if defined(__has_feature)
+#define DEFERRAL_HAS_FEATURE(x) __has_feature(x)
+#else
+#define DEFERRAL_HAS_FEATURE(x) 0
+#endif // defined(__has_feature)
+
+/**
+ * DEFERRAL_ANONYMOUS_VARIABLE(str) introduces an identifier starting with
+ * str and ending with a number that varies with the line.
+ */
+#ifndef DEFERRAL_ANONYMOUS_VARIABLE
+#define DEFERRAL_CONCATENATE_IMPL(s1, s2) s1##s2
+#define DEFERRAL_CONCATENATE(s1, s2)      DEFERRAL_CONCATENATE_IMPL(s1, s2)
+#ifdef __COUNTER__
+// Modular builds build each module with its own preprocessor state, meaning
+// `__COUNTER__` no longer provides a unique number across a TU.  Instead of
+// calling back to just `__LINE__`, use a mix of `__COUNTER__` and `__LINE__`
+// to try provide as much uniqueness as possible.
+#if DEFERRAL_HAS_FEATURE(modules)
+#define DEFERRAL_ANONYMOUS_VARIABLE(str)                                                           \
+  DEFERRAL_CONCATENATE(DEFERRAL_CONCATENATE(DEFERRAL_CONCATENATE(str, __COUNTER__), _), __LINE__)
+#else
+#define DEFERRAL_ANONYMOUS_VARIABLE(str) DEFERRAL_CONCATENATE(str, __COUNTER__)
+#endif
+#else
+#define DEFERRAL_ANONYMOUS_VARIABLE(str) DEFERRAL_CONCATENATE(str, __LINE__)
+#endif
+#endif
+
+// DEFERRAL_MAYBE_UNUSED suppresses compiler warnings on unused entities, if any.
+#if !defined(DEFERRAL_MAYBE_UNUSED)
+#if defined(__clang__)
+#if(__clang_major__ * 10 + __clang_minor__) >= 39 && __cplusplus >= 201703L
+#define DEFERRAL_MAYBE_UNUSED [[maybe_unused]]
+#else
+#define DEFERRAL_MAYBE_UNUSED __attribute__((__unused__))
+#endif
+#elif defined(__GNUC__)
+#if __GNUC__ >= 7 && __cplusplus >= 201703L
+#define DEFERRAL_MAYBE_UNUSED [[maybe_unused]]
+#else
+#define DEFERRAL_MAYBE_UNUSED __attribute__((__unused__))
+#endif
+#elif defined(_MSC_VER)
+#if _MSC_VER >= 1911 && defined(_MSVC_LANG) && _MSVC_LANG >= 201703L
+#define DEFERRAL_MAYBE_UNUSED [[maybe_unused]]
+#else
+#define DEFERRAL_MAYBE_UNUSED __pragma(warning(suppress : 4100 4101 4189))
+#endif
+#else
+#define DEFERRAL_MAYBE_UNUSED
+#endif
+#endif
+
+#if !defined(DEFERRAL_NO_MACROS)
+
+/**
+ * DEFERRAL_GUARD(policy, tag, x) declares the guard variable `x`, initialized from the lambda that
+ * follows the macro. By default the lambda is passed to the tag `operator+`. With
+ * `DEFERRAL_MINIMAL_INSTANTIATION` (C++17 or later) the guard class is deduced directly from the
+ * lambda, so that each guard instantiates a single class template and no function template.
+ */
+#if defined(DEFERRAL_MINIMAL_INSTANTIATION)
+#define DEFERRAL_GUARD(policy, tag, x)                                                             \
+  ::deferral::internal::MinimalGuard<::deferral::internal::policy>::Guard x =
+#else
+#define DEFERRAL_GUARD(policy, tag, x) auto x = ::deferral::internal::tag() +
+#endif // defined(DEFERRAL_MINIMAL_INSTANTIATION)
+
+/**
+ * @brief Capture code that shall be run when the current scope exits.
+ * @def DEFER_(name)
+ *
+ * The code within `DEFER_`'s braces shall execute as if the code was in the
+ * destructor of an object instantiated at the point of `DEFER_`. A variable
+ * name is required to be passed to `DEFER_`, and creates a DeferExit object
+ * with the specified name.
+ *
+ * If you need to skip the cleanup code, you can call `release()` on the
+ * DeferExit object.
+ *
+ * Variables used within `DEFER_` are captured by reference.
+ *
+ * Example usage:
+ * @code
+ * { // open scope
+ *   some_resource_t resource;
+ *   some_resource_init(resource);
+ *
+ *   // create a DeferExit object with variable name d
+ *   DEFER_(d) { some_resource_fini(resource); };
+ *
+ *   if (fini_not_needed)
+ *    d.release(); // the cleanup does not happen
+ *
+ *   if (!cond)
+ *     throw 0; // the cleanup happens at end of the scope
+ *   else
+ *     return; // the cleanup happens at end of the scope
+ *
+ *   use_some_resource(resource); // may throw; cleanup will happen
+ *  } // close scope
+ * @endcode
+ *
+ * The code in the braces passed to `DEFER_` executes at the end of the
+ * containing scope as if the code is the content of the destructor of an
+ * object instantiated at the point of the `defer`, where the destructor
+ * reference-captures all local variables it uses.
+ *
+ * The cleanup code - the code in the braces passed to `DEFER_` - always
+ * executes at the end of the scope, regardless of whether the scope exits
+ * normally or erroneously as if via the throw statement.
+ *
+ * @note If you do not need to release the DeferExit object, you can use `DEFER`
+ * instead.
+ *
+ * @warning Suitable for coroutine functions only when the cleanup code does
+ * not use captured references to thread-local objects. Recall that there is
+ * no assumption that coroutines resume from co-await, co-yield, or co-return
+ * in the same thread as the one in which they suspend. If you need to capture
+ * thread-local objects, consider using
+ *
+ * @warning May not execute if the scope exits erroneously but stack unwinding
+ * is skipped, or if the scope does not exit at all such as with std::abort or
+ * setcontext, which fibers use.
+ */
+#define DEFER_(x) DEFERRAL_GUARD(OnExitPolicy, DeferOnExit, x)[&]()
+
+/**
+ * @brief Capture code that shall be run when the current scope exits.
+ * @def DEFER
+ *
+ * Like `DEFER_`, but a variable name is implicitily created.
+ *
+ * Example usage:
+ * @code
+ * { // open scope
+ *   some_resource_t resource;
+ *   some_resource_init(resource);
+ *   DEFER { some_resource_fini(resource); };
+ *
+ *   if (!cond)
+ *     throw 0; // the cleanup happens at end of the scope
+ *   else
+ *     return; // the cleanup happens at end of the scope
+ *
+ *   use_some_resource(resource); // may throw; cleanup will happen
+ *  } // close scope
+ * @endcode
+ *
+ * The code in the braces passed to `DEFER` executes at the end of the
+ * containing scope as if the code is the content of the destructor of an
+ * object instantiated at the point of the `defer`, where the destructor
+ * reference-captures all local variables it uses.
+ *
+ * The cleanup code - the code in the braces passed to `DEFER` - always
+ * executes at the end of the scope, regardless of whether the scope exits
+ * normally or erroneously as if via the throw statement.
+ *
+ * @warning Suitable for coroutine functions only when the cleanup code does
+ * not use captured references to thread-local objects. Recall that there is
+ * no assumption that coroutines resume from co-await, co-yield, or co-return
+ * in the same thread as the one in which they suspend. If you need to capture
+ * thread-local objects, consider using
+ *
+ * @warning May not execute if the scope exits erroneously but stack unwinding
+ * is skipped, or if the scope does not exit at all such as with std::abort or
+ * setcontext, which fibers use.
+ */
+#define DEFER                                                                                      \
+  DEFERRAL_GUARD(OnExitNoCheckPolicy, DeferOnExitNoCheck,                                          \
+      DEFERRAL_ANONYMOUS_VARIABLE(DEFERRAL_STATE))[&]()
+
+/**
+ * @brief Capture code that shall be run when the current scope exits, with the
+ * listed variables captured by value.
+ * @def DEFER_CAPTURE(...)
+ *
+ * Like `DEFER`, but the lambda capture list is given explicitly, e.g.
+ * `DEFER_CAPTURE(fd)` or `DEFER_CAPTURE(p = ptr.get())`. Variables captured by
+ * value are copied into the guard, so unlike the `[&]` capture of `DEFER` they
+ * are not address-taken, and the compiler can keep them in registers even
+ * when the cleanup is not inlined (for example on exception paths).
+ *
+ * Example usage:
+ * @code
+ * int fd = open(path, O_RDONLY);
+ * DEFER_CAPTURE(fd) { close(fd); };
+ * @endcode
+ *
+ * @note The captured copies are taken at the point of `DEFER_CAPTURE`; later
+ * changes to the variables are not seen by the cleanup code.
+ */
+#define DEFER_CAPTURE(...)                                                                         \
+  DEFERRAL_GUARD(OnExitNoCheckPolicy, DeferOnExitNoCheck,                                          \
+      DEFERRAL_ANONYMOUS_VARIABLE(DEFERRAL_CAPTURE_STATE))[__VA_ARGS__]()
+
+/**
+ * Capture code to run if the scope exits with an exception.
+ * @def DEFER_FAIL_
+ *
+ * Like `DEFER_`, but only executes the code if the scope exited due to an
+ * exception.
+ *
+ * May be useful in situations where the caller requests a resource where
+ * initializations of the resource is multi-step and may fail.
+ *
+ * Example:
+ * @code
+ *   some_resource_t resource;
+ *   some_resource_init(resource);
+ *
+ *   // create a DeferFail object with varible name d
+ *   DEFER_FAIL_(d) { some_resource_fini(resource); };
+ *
+ *   if (fini_not_needed)
+ *     d.release(); // the cleanup does not happen
+ *
+ *   if (do_throw)
+ *     throw 0; // the cleanup happens at the end of the scope
+ *   else
+ *     return resource; // the cleanup does not happen
+ * @endcode
+ *
+ * @warning Not suitable for coroutine functions.
+ *
+ * @warning With fibers that switch stacks in the middle of a scope, switch
+ * with `deferral::fiber::swap_context` (deferral_fiber.hh) or give the guard a
+ * per-fiber exception source (`DEFERRAL_EXCEPTION_SOURCE`).
+ */
+#define DEFER_FAIL_(x) DEFERRAL_GUARD(OnFailPolicy, DeferOnFail, x)[&]() noexcept
+
+/**
+ * @brief Capture code to run if the scope exits with an exception.
+ * @def DEFER_FAIL
+ *
+ * Like `DEFER_FAIL_`, but a variable name is implicitily created.
+ *
+ * Example:
+ * @code
+ *   some_resource_t resource;
+ *   some_resource_init(resource);
+ *   DEFER_FAIL { some_resource_fini(resource); };
+ *   if (do_throw)
+ *     throw 0; // the cleanup happens at the end of the scope
+ *   else
+ *     return resource; // the cleanup does not happen
+ * @endcode
+ *
+ * @warning Not suitable for coroutine functions.
+ */
+#define DEFER_FAIL                                                                                 \
+  DEFERRAL_MAYBE_UNUSED DEFER_FAIL_(DEFERRAL_ANONYMOUS_VARIABLE(DEFERRAL_FAIL_STATE))
+
+/**
+ * @brief Capture code to run on scope exits without an exception.
+ * @def DEFER_SUCCESS_
+ *
+ * Like `DEFER_`, but does not execute the code if the scope exited due to an
+ * exception. In a sense, the opposite of `DEFER_SUCCESS_`.
+ *
+ * Example:
+ * @code
+ * some_resource_t resource;
+ * some_resource_init(resource);
+ * DEFER_SUCCESS_(d) {
+ *   log_success();
+ *   some_resource_fini(resource);
+ * };
+ *
+ * if (fini_not_needed)
+ *  d.release(); // the cleanup does not happen
+ *
+ * if (do_throw)
+ *   throw 0; // the cleanup does not happen; log failure
+ * else
+ *   return; // the cleanup happens at the end of the scope; log success
+ * @endcode
+ *
+ * @warning Not suitable for coroutine functions.
+ *
+ * @warning With fibers that switch stacks in the middle of a scope, see
+ * `DEFER_FAIL_`.
+ */
+#define DEFER_SUCCESS_(x) DEFERRAL_GUARD(OnSuccessPolicy, DeferOnSuccess, x)[&]() noexcept
+
+/**
+ * @brief Capture code to run on scope exits without an exception.
+ * @def DEFER_SUCCESS
+ *
+ * Like `DEFER_SUCCESS_`, but a varibule name is implicitily created.
+ *
+ * Example:
+ * @code
+ * some_resource_t resource;
+ * some_resource_init(resource);
+ * DEFER_SUCCESS {
+ *   log_success();
+ *   some_resource_fini(resource);
+ * };
+ *
+ * if (do_throw)
+ *   throw 0; // the cleanup does not happen
+ * else
+ *   return; // the cleanup happens at the end of the scope; log success
+ * @endcode
+ *
+ * @warning Not suitable for coroutine functions.
+ */
+#define DEFER_SUCCESS                                                                              \
+  DEFERRAL_MAYBE_UNUSED DEFER_SUCCESS_(DEFERRAL_ANONYMOUS_VARIABLE(DEFERRAL_SUCCESS_STATE))
+
+/**
+ * @brief Capture code that shall be run when the current scope exits, if the
+ * given policy says so.
+ * @def DEFER_WITH_(name, policy)
+ *
+ * Like `DEFER_`, but whether the code runs is decided by `policy`, an object
+ * that meets the `deferral::Policy` requirements, rather than by the exception
+ * runtime. The code is declared `noexcept` if the policy's `require_noexcept`
+ * is true. `policy` is evaluated once, and may contain commas.
+ *
+ * Example usage:
+ * @code
+ * struct OnStatusPolicy {
+ *   static constexpr bool expect_execute{false};
+ *   static constexpr bool require_noexcept{false};
+ *   const int* status;
+ *   void release() noexcept { status = nullptr; }
+ *   bool should_execute() const noexcept { return status && *status != 0; }
+ * };
+ *
+ * int status = 0;
+ * DEFER_WITH_(d, OnStatusPolicy{&status}) { rollback(); };
+ * status = do_work(); // rollback() runs at the end of the scope if non-zero
+ * @endcode
+ */
+#define DEFER_WITH_(x, ...)                                                                        \
+  auto x = ::deferral::internal::with_policy(__VA_ARGS__) + [&]() noexcept(                        \
+      ::deferral::internal::remove_reference<decltype(__VA_ARGS__)>::type::require_noexcept)
+
+/**
+ * @brief Capture code that shall be run when the current scope exits, if the
+ * given policy says so.
+ * @def DEFER_WITH(policy)
+ *
+ * Like `DEFER_WITH_`, but a variable name is implicitily created.
+ */
+#define DEFER_WITH(...)                                                                            \
+  DEFERRAL_MAYBE_UNUSED DEFER_WITH_(DEFERRAL_ANONYMOUS_VARIABLE(DEFERRAL_WITH_STATE), __VA_ARGS__)
+
+#if !defined(DEFERRAL_NO_KEYWORDS)
+
+#define defer_(x)              DEFER_(x)
+#define defer                  DEFER
+#define defer_capture(...)     DEFER_CAPTURE(__VA_ARGS__)
+#define defer_fail_(x)         DEFER_FAIL_(x)
+#define defer_fail             DEFER_FAIL
+#define defer_success_(x)      DEFER_SUCCESS_(x)
+#define defer_success          DEFER_SUCCESS
+#define defer_with_(x, ...)    DEFER_WITH_(x, __VA_ARGS__)
+#define defer_with(...)        DEFER_WITH(__VA_ARGS__)
+
+#endif // !defined(DEFERRAL_NO_KEYWORDS)
+#endif // !defined(DEFERRAL_NO_MACROS)
@@ -0,0 +1,196 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Prefault guards.
+//
+// `DeferPrefault` faults in the pages of a writable memory range when it is constructed, so that
+// the first touches inside a latency-critical scope do not take page faults, and optionally locks
+// them in memory. When it goes out of scope it unlocks the range and applies a release policy:
+// keep the pages, or give them back to the kernel with `MADV_FREE` or `MADV_DONTNEED`.
+//
+// Pages are populated with `madvise(MADV_POPULATE_WRITE)` (Linux 5.14) in a single call. Where
+// that is not available, each page is touched with an atomic add of zero, which faults the page
+// in for writing without changing its contents, even if other threads write to it.
+//
+// Only available on Linux.
+
+#pragma once
+
+#if !defined(__linux__)
+#error "deferral_prefault.hh requires Linux"
+#endif // !defined(__linux__)
+
+#include "deferral_core.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace deferral {
+
+/**
+ * @brief How `DeferPrefault` faults in its range.
+ */
+enum class Prefault : unsigned {
+  // Fault in the pages for writing.
+  populate,
+  // Lock the pages in memory with `mlock`, which also faults them in. Falls back to `populate` if
+  // `mlock` fails, e.g. because `RLIMIT_MEMLOCK` is too low.
+  lock,
+};
+
+/**
+ * @brief What `DeferPrefault` does with its pages on scope exit.
+ */
+enum class PageRelease : unsigned {
+  // Keep the pages and their contents.
+  keep,
+  // `MADV_FREE`: the kernel may reclaim the pages lazily, under memory pressure; until then a
+  // touch reuses them without a fault. The contents become undefined. Falls back to
+  // `dont_need` where `MADV_FREE` is not supported.
+  free,
+  // `MADV_DONTNEED`: the pages are unmapped at once; private anonymous pages read as zero after.
+  dont_need,
+};
+
+namespace internal {
+
+// `MADV_POPULATE_WRITE` from Linux 5.14, for older headers. Older kernels reject it with `EINVAL`.
+#if defined(MADV_POPULATE_WRITE)
+constexpr int madv_populate_write = MADV_POPULATE_WRITE;
+#else
+constexpr int madv_populate_write = 23;
+#endif // defined(MADV_POPULATE_WRITE)
+
+inline std::uintptr_t page_size() noexcept {
+  static const std::uintptr_t size = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+  return size;
+}
+
+// Faults in every page of [begin, end), both page aligned, for writing.
+inline void populate_pages(std::uintptr_t begin, std::uintptr_t end) noexcept {
+  if(madvise(reinterpret_cast<void*>(begin), end - begin, madv_populate_write) == 0) { return; }
+  for(std::uintptr_t p = begin; p < end; p += page_size()) {
+    __atomic_fetch_add(reinterpret_cast<unsigned char*>(p), 0, __ATOMIC_RELAXED);
+  }
+}
+
+} // namespace internal
+
+/**
+ * @brief A guard that faults in a memory range on construction and releases it on scope exit,
+ * unless released.
+ *
+ * The range is extended to whole pages to fault it in and to lock it, and shrunk to whole pages
+ * to give pages back, so that `PageRelease::free` and `dont_need` never discard bytes outside of
+ * it. The range must be writable and must stay mapped for the lifetime of the guard.
+ *
+ * @code
+ * deferral::DeferPrefault scratch{buf, size, deferral::Prefault::populate,
+ *     deferral::PageRelease::free};
+ * run_latency_critical_loop(buf, size);
+ * @endcode
+ */
+class DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN DeferPrefault : internal::OnExitPolicy {
+  using policy_t = internal::OnExitPolicy;
+
+  void* data;
+  std::size_t size;
+  PageRelease release_policy;
+  bool is_locked;
+
+  void* operator new(decltype(sizeof(0))) = delete;
+  void operator delete(void*)             = delete;
+
+public:
+  /**
+   * @brief Faults in `n` bytes at `p`.
+   *
+   * @param p The start of the range.
+   * @param n The size of the range in bytes.
+   * @param mode Whether to lock the pages or only fault them in.
+   * @param release What to do with the pages on scope exit.
+   */
+  DeferPrefault(void* p, std::size_t n, Prefault mode = Prefault::populate,
+      PageRelease release = PageRelease::keep) noexcept :
+      policy_t{}, data{p}, size{n}, release_policy{release}, is_locked{false} {
+    if(n == 0) { return; }
+    const std::uintptr_t mask  = internal::page_size() - 1;
+    const std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(p) & ~mask;
+    const std::uintptr_t end   = (reinterpret_cast<std::uintptr_t>(p) + n + mask) & ~mask;
+    if(mode == Prefault::lock) {
+      is_locked = mlock(reinterpret_cast<void*>(begin), end - begin) == 0;
+    }
+    if(!is_locked) { internal::populate_pages(begin, end); }
+  }
+
+  /**
+   * @brief Move constructs a guard. `other` no longer releases anything.
+   */
+  DeferPrefault(DeferPrefault&& other) noexcept :
+      policy_t{static_cast<policy_t&&>(other)}, data{other.data}, size{other.size},
+      release_policy{other.release_policy}, is_locked{other.is_locked} {
+    other.release();
+  }
+
+  DeferPrefault(const DeferPrefault&)            = delete;
+  DeferPrefault& operator=(const DeferPrefault&) = delete;
+
+  /**
+   * @brief Unlocks the range if it was locked, then applies the release policy.
+   */
+  ~DeferPrefault() {
+    if(!policy_t::should_execute() || size == 0) { return; }
+    const std::uintptr_t mask = internal::page_size() - 1;
+    if(is_locked) {
+      const std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(data) & ~mask;
+      const std::uintptr_t end   = (reinterpret_cast<std::uintptr_t>(data) + size + mask) & ~mask;
+      munlock(reinterpret_cast<void*>(begin), end - begin);
+    }
+    if(release_policy == PageRelease::keep) { return; }
+    const std::uintptr_t begin = (reinterpret_cast<std::uintptr_t>(data) + mask) & ~mask;
+    const std::uintptr_t end   = (reinterpret_cast<std::uintptr_t>(data) + size) & ~mask;
+    if(begin >= end) { return; }
+    void* const pages = reinterpret_cast<void*>(begin);
+#if defined(MADV_FREE)
+    if(release_policy == PageRelease::free && madvise(pages, end - begin, MADV_FREE) == 0) {
+      return;
+    }
+#endif // defined(MADV_FREE)
+    madvise(pages, end - begin, MADV_DONTNEED);
+  }
+
+  /**
+   * @brief Returns whether the range is locked in memory.
+   */
+  bool locked() const noexcept { return is_locked; }
+
+  /**
+   * @brief Keeps the pages, and their lock, when the guard goes out of scope.
+   */
+  using policy_t::release;
+}; // class DeferPrefault
+
+} // namespace deferral
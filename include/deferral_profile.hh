@@ -0,0 +1,380 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Sampling profiler for guarded scopes.
+//
+// `DEFER_PROFILE("name") { cleanup(); };` is a `defer` guard that also marks the rest of the
+// scope as a span of the profiling site "name". Only one span in `sample_period()` (1,000 by
+// default) is timed, picked by a per-thread countdown with a randomized interval, so that periodic
+// code does not alias with the sampler. An unsampled span costs a thread-local decrement and a
+// branch when it starts, and a branch on a register when it ends. Each site keeps the weighted sum
+// of its sampled durations and a reservoir of sample durations for percentiles; `report()`
+// returns the estimated call count and total time of every site that has been sampled.
+
+#pragma once
+
+#include "deferral_core.hh"
+#include "deferral_macros.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// The number of sample durations kept per site for `SiteReport::p50_ns` and `p99_ns`.
+#if !defined(DEFERRAL_PROFILE_RESERVOIR_SIZE)
+#define DEFERRAL_PROFILE_RESERVOIR_SIZE 128
+#endif // !defined(DEFERRAL_PROFILE_RESERVOIR_SIZE)
+
+namespace deferral {
+namespace profile {
+
+class Site;
+struct SiteReport;
+
+inline std::vector<SiteReport> report();
+inline void reset() noexcept;
+
+namespace internal {
+
+// The sampler of a thread. All members are zero-initialized, so the thread-local needs no
+// initialization guard; `rng == 0` marks a thread that has not drawn an interval yet.
+struct ThreadSampler {
+  std::int64_t countdown;
+  std::uint32_t period;
+  std::uint64_t rng;
+};
+
+DEFERRAL_ALWAYS_INLINE ThreadSampler& thread_sampler() noexcept {
+  static thread_local ThreadSampler sampler;
+  return sampler;
+}
+
+inline std::atomic<std::uint32_t>& sample_period_storage() noexcept {
+  static std::atomic<std::uint32_t> period{1000};
+  return period;
+}
+
+inline std::atomic<Site*>& site_list() noexcept {
+  static std::atomic<Site*> head{nullptr};
+  return head;
+}
+
+DEFERRAL_ALWAYS_INLINE std::uint64_t now_ns() noexcept {
+  return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch())
+                                        .count());
+}
+
+DEFERRAL_ALWAYS_INLINE std::uint64_t next_random(ThreadSampler& t) noexcept {
+  // xorshift64
+  t.rng ^= t.rng << 13;
+  t.rng ^= t.rng >> 7;
+  t.rng ^= t.rng << 17;
+  return t.rng;
+}
+
+// The slow paths of `Span`, taken once per sample.
+DEFERRAL_COLD inline std::uint64_t start_sample(ThreadSampler& t) noexcept;
+DEFERRAL_COLD inline void end_sample(Site& site, std::uint64_t start) noexcept;
+
+} // namespace internal
+
+/**
+ * @brief A profiling site: the static data of one `DEFER_PROFILE` in the source.
+ *
+ * Constant-initialized, so that a function-local `static Site` has no initialization guard. The
+ * site is added to the list returned by `report()` when it is first sampled.
+ */
+class Site {
+  static constexpr unsigned reservoir_size = DEFERRAL_PROFILE_RESERVOIR_SIZE;
+
+  const char* name;
+  const char* file;
+  unsigned line;
+  std::atomic<bool> registered;
+  Site* next;
+  std::atomic<std::uint64_t> samples;
+  std::atomic<std::uint64_t> weighted_calls;
+  std::atomic<std::uint64_t> weighted_ns;
+  std::atomic<std::uint64_t> reservoir[reservoir_size];
+
+  friend void internal::end_sample(Site&, std::uint64_t) noexcept;
+  friend std::vector<SiteReport> report();
+  friend void reset() noexcept;
+
+public:
+  /**
+   * @brief Constructs a site.
+   *
+   * @param n The name of the site, a string literal.
+   * @param f The source file, usually `__FILE__`.
+   * @param l The source line, usually `__LINE__`.
+   */
+  constexpr Site(const char* n, const char* f, unsigned l) noexcept :
+      name{n}, file{f}, line{l}, registered{false}, next{nullptr}, samples{0}, weighted_calls{0},
+      weighted_ns{0}, reservoir{} {}
+
+  Site(const Site&)            = delete;
+  Site& operator=(const Site&) = delete;
+}; // class Site
+
+/**
+ * @brief Marks a span of a site: from construction to destruction, if the sampler picks it.
+ */
+class DEFERRAL_NODISCARD Span {
+  Site* site;
+  std::uint64_t start;
+
+public:
+  /**
+   * @brief Starts a span of `s`. Unless the thread's countdown runs out, this is a decrement and a
+   * branch.
+   *
+   * @param s The site.
+   */
+  DEFERRAL_ALWAYS_INLINE explicit Span(Site& s) noexcept : site{&s}, start{0} {
+    internal::ThreadSampler& t = internal::thread_sampler();
+    if(__builtin_expect(--t.countdown <= 0, false)) { start = internal::start_sample(t); }
+  }
+
+  /**
+   * @brief Move constructs a span. `other` no longer records a sample.
+   */
+  DEFERRAL_ALWAYS_INLINE Span(Span&& other) noexcept : site{other.site}, start{other.start} {
+    other.start = 0;
+  }
+
+  Span(const Span&)            = delete;
+  Span& operator=(const Span&) = delete;
+
+  /**
+   * @brief Ends the span, and records its duration if it was sampled.
+   */
+  DEFERRAL_ALWAYS_INLINE ~Span() {
+    if(__builtin_expect(start != 0, false)) { internal::end_sample(*site, start); }
+  }
+}; // class Span
+
+/**
+ * @brief A `defer` guard that is also a span of a profiling site. The span ends after the
+ * deferred function has run.
+ *
+ * @tparam funcT The type of the function to be executed.
+ */
+template <typename funcT>
+class DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN ProfiledDefer
+    : deferral::internal::OnExitPolicy {
+  using policy_t = deferral::internal::OnExitPolicy;
+
+  Span span;
+  funcT func;
+
+  void* operator new(decltype(sizeof(0))) = delete;
+  void operator delete(void*)             = delete;
+
+public:
+  template <typename F>
+  DEFERRAL_ALWAYS_INLINE ProfiledDefer(Site& s, F&& f) noexcept(
+      __is_nothrow_constructible(funcT, F&&)) :
+      policy_t{}, span{s}, func{static_cast<F&&>(f)} {}
+
+  DEFERRAL_ALWAYS_INLINE ProfiledDefer(ProfiledDefer&& other) noexcept(
+      __is_nothrow_constructible(funcT, funcT&&)) :
+      policy_t{static_cast<policy_t&&>(other)}, span{static_cast<Span&&>(other.span)},
+      func{static_cast<funcT&&>(other.func)} {
+    other.release();
+  }
+
+  ProfiledDefer(const ProfiledDefer&)            = delete;
+  ProfiledDefer& operator=(const ProfiledDefer&) = delete;
+
+  DEFERRAL_ALWAYS_INLINE ~ProfiledDefer() noexcept(noexcept(func())) {
+    if(__builtin_expect(policy_t::should_execute(), policy_t::expect_execute)) { func(); }
+  }
+
+  using policy_t::release;
+}; // class ProfiledDefer
+
+namespace internal {
+
+// `SiteTag{site} + f` is used by the `DEFER_PROFILE` macro.
+struct SiteTag {
+  Site& site;
+};
+
+template <typename funcT>
+DEFERRAL_ALWAYS_INLINE ProfiledDefer<typename deferral::internal::decay<funcT>::type> operator+(
+    SiteTag tag, funcT&& f) noexcept(__is_nothrow_constructible(
+    typename deferral::internal::decay<funcT>::type, funcT&&)) {
+  return ProfiledDefer<typename deferral::internal::decay<funcT>::type>{
+      tag.site, static_cast<funcT&&>(f)};
+}
+
+// Called when the thread's countdown runs out: draws the next interval, uniform in
+// [1, 2 * period - 1] so that its mean is the period, and returns the start time of the sampled
+// span. The first call on a thread only seeds the generator and samples nothing.
+inline std::uint64_t start_sample(ThreadSampler& t) noexcept {
+  const bool first = t.rng == 0;
+  if(first) {
+    t.rng = reinterpret_cast<std::uintptr_t>(&t) ^ now_ns() ^ 0x9e3779b97f4a7c15ull;
+    if(t.rng == 0) { t.rng = 1; }
+  }
+  t.period    = std::max<std::uint32_t>(1, sample_period_storage().load(std::memory_order_relaxed));
+  t.countdown = static_cast<std::int64_t>(1 + next_random(t) % (2ull * t.period - 1));
+  return first ? 0 : now_ns();
+}
+
+// Records a sampled span, weighted by the period it was sampled at. The reservoir keeps a uniform
+// sample of the durations (Algorithm R).
+inline void end_sample(Site& site, std::uint64_t start) noexcept {
+  const std::uint64_t duration = now_ns() - start;
+  ThreadSampler& t             = thread_sampler();
+  const std::uint64_t weight   = t.period;
+
+  if(!site.registered.load(std::memory_order_acquire) &&
+      !site.registered.exchange(true, std::memory_order_acq_rel)) {
+    Site* head = site_list().load(std::memory_order_relaxed);
+    do { site.next = head; } while(!site_list().compare_exchange_weak(
+        head, &site, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  const std::uint64_t i = site.samples.fetch_add(1, std::memory_order_relaxed);
+  site.weighted_calls.fetch_add(weight, std::memory_order_relaxed);
+  site.weighted_ns.fetch_add(duration * weight, std::memory_order_relaxed);
+  const std::uint64_t slot = i < Site::reservoir_size ? i : next_random(t) % (i + 1);
+  if(slot < Site::reservoir_size) {
+    site.reservoir[slot].store(duration, std::memory_order_relaxed);
+  }
+}
+
+} // namespace internal
+
+/**
+ * @brief The estimated cost of one profiling site.
+ */
+struct SiteReport {
+  const char* name;
+  const char* file;
+  unsigned line;
+  // The number of sampled spans.
+  std::uint64_t samples;
+  // The estimated number of spans: the sum of the sampling periods of the samples.
+  std::uint64_t estimated_calls;
+  // The estimated total time of all spans: the sum of sampled durations times their periods.
+  std::uint64_t estimated_total_ns;
+  // The median and 99th percentile of the sampled durations in the reservoir.
+  std::uint64_t p50_ns;
+  std::uint64_t p99_ns;
+};
+
+/**
+ * @brief Returns a report of every sampled site, most expensive (`estimated_total_ns`) first.
+ *
+ * May be called while spans are recorded on other threads; the counters of a site are read one
+ * at a time, so a report may be off by the samples recorded while it is taken.
+ */
+inline std::vector<SiteReport> report() {
+  std::vector<SiteReport> result;
+  for(Site* s = internal::site_list().load(std::memory_order_acquire); s != nullptr; s = s->next) {
+    const std::uint64_t samples = s->samples.load(std::memory_order_relaxed);
+    if(samples == 0) { continue; }
+    std::vector<std::uint64_t> durations;
+    const std::uint64_t reservoir_size = Site::reservoir_size;
+    const std::uint64_t kept           = std::min(samples, reservoir_size);
+    for(std::uint64_t i = 0; i < kept; ++i) {
+      durations.push_back(s->reservoir[i].load(std::memory_order_relaxed));
+    }
+    std::sort(durations.begin(), durations.end());
+    result.push_back(SiteReport{s->name, s->file, s->line, samples,
+        s->weighted_calls.load(std::memory_order_relaxed),
+        s->weighted_ns.load(std::memory_order_relaxed), durations[(kept - 1) / 2],
+        durations[(kept - 1) * 99 / 100]});
+  }
+  std::sort(result.begin(), result.end(), [](const SiteReport& a, const SiteReport& b) {
+    return a.estimated_total_ns > b.estimated_total_ns;
+  });
+  return result;
+}
+
+/**
+ * @brief Clears the samples of every site. Sites stay registered.
+ */
+inline void reset() noexcept {
+  for(Site* s = internal::site_list().load(std::memory_order_acquire); s != nullptr; s = s->next) {
+    s->samples.store(0, std::memory_order_relaxed);
+    s->weighted_calls.store(0, std::memory_order_relaxed);
+    s->weighted_ns.store(0, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief Sets the mean number of spans per sample, for all threads. The calling thread picks it
+ * up at its next span, other threads when their current interval runs out. 1 samples every span.
+ *
+ * @param period The sampling period.
+ */
+inline void set_sample_period(std::uint32_t period) noexcept {
+  internal::sample_period_storage().store(period, std::memory_order_relaxed);
+  internal::thread_sampler().countdown = 0;
+}
+
+/**
+ * @brief Returns the sampling period set by `set_sample_period`.
+ */
+inline std::uint32_t sample_period() noexcept {
+  return internal::sample_period_storage().load(std::memory_order_relaxed);
+}
+
+} // namespace profile
+} // namespace deferral
+
+#if !defined(DEFERRAL_NO_MACROS)
+
+/**
+ * @brief A `DEFER` guard that is also a span of the profiling site `name`.
+ * @def DEFER_PROFILE(name)
+ *
+ * @code
+ * void commit(Transaction& tx) {
+ *   DEFER_PROFILE("tx.commit") { tx.unlock(); };
+ *   tx.write();
+ * }
+ * @endcode
+ *
+ * @param name The name of the site, a string literal.
+ */
+#define DEFER_PROFILE(name)                                                                        \
+  DEFERRAL_PROFILE_(DEFERRAL_ANONYMOUS_VARIABLE(DEFERRAL_PROFILE_SITE), name)
+#define DEFERRAL_PROFILE_(site, name)                                                              \
+  static ::deferral::profile::Site site{name, __FILE__, __LINE__};                                 \
+  DEFERRAL_MAYBE_UNUSED auto DEFERRAL_CONCATENATE(site, _GUARD) =                                  \
+      ::deferral::profile::internal::SiteTag{site} + [&]()
+
+#if !defined(DEFERRAL_NO_KEYWORDS)
+#define defer_profile(name) DEFER_PROFILE(name)
+#endif // !defined(DEFERRAL_NO_KEYWORDS)
+
+#endif // !defined(DEFERRAL_NO_MACROS)
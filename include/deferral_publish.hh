@@ -0,0 +1,157 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Copy-on-write publish guards.
+//
+// Read-mostly data is often shared through a `std::atomic<T*>`: readers load the pointer with
+// acquire ordering and never lock, and a writer copies the current version, modifies the copy and
+// swaps the pointer. `DeferPublish` owns the private copy for the scope of the update. If the scope
+// exits normally, the copy is published with a single pointer exchange and the previous version is
+// handed to a reclamation callback, which must defer the delete until no reader can still hold it
+// (RCU, hazard pointers, an epoch scheme, or a grace period). If the scope exits by an exception,
+// or the guard is released, the copy is deleted and the shared pointer is never touched, so a
+// failed update can neither leak nor publish a half-modified version.
+//
+// Writers of the same pointer must be serialized, e.g. by a mutex; the guard does not detect a
+// concurrent publish.
+
+#pragma once
+
+#include "deferral_core.hh"
+
+#include <atomic>
+
+namespace deferral {
+
+/**
+ * @brief A guard that owns a private copy of the version behind `target` and publishes it when
+ * the scope exits normally, unless released.
+ *
+ * The copy is made with `T`'s copy constructor when the guard is constructed; an exception thrown
+ * there propagates and nothing is allocated. On publish, `reclaim(old)` is called with the
+ * previous version, after the new one is visible to readers; it must not throw.
+ *
+ * @code
+ * std::atomic<RouteTable*> routes;
+ *
+ * void add_route(const Route& r) {
+ *   std::lock_guard<std::mutex> lock{writer_mutex};
+ *   auto next = deferral::make_defer_publish(routes, [](RouteTable* old) noexcept {
+ *     rcu_retire(old);
+ *   });
+ *   next->insert(r);  // may throw: routes is left unchanged and the copy is deleted
+ * }
+ * @endcode
+ *
+ * @tparam T The type of the shared version.
+ * @tparam reclaimT The type of the reclamation callback, called as `reclaim(T*)`.
+ */
+template <typename T, typename reclaimT>
+class DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN DeferPublish : internal::OnSuccessPolicy {
+  using policy_t = internal::OnSuccessPolicy;
+
+  std::atomic<T*>* target;
+  // Before `next`, so that a throwing move of the callback leaves nothing to delete.
+  DEFERRAL_NO_UNIQUE_ADDRESS reclaimT reclaim;
+  T* next;
+
+  void* operator new(decltype(sizeof(0))) = delete;
+  void operator delete(void*)             = delete;
+
+public:
+  /**
+   * @brief Copies the current version of `target`, which must not be null.
+   *
+   * @param t The shared pointer to update.
+   * @param r The callback that receives the previous version after a publish.
+   */
+  DeferPublish(std::atomic<T*>& t, reclaimT r) :
+      policy_t{}, target{&t}, reclaim(static_cast<reclaimT&&>(r)),
+      next{new T(*t.load(std::memory_order_acquire))} {}
+
+  /**
+   * @brief Takes ownership of a version built by the caller, e.g. for the first publish.
+   *
+   * @param t The shared pointer to update.
+   * @param n The new version, allocated with `new`.
+   * @param r The callback that receives the previous version after a publish, if not null.
+   */
+  DeferPublish(std::atomic<T*>& t, T* n, reclaimT r) noexcept :
+      policy_t{}, target{&t}, reclaim(static_cast<reclaimT&&>(r)), next{n} {}
+
+  /**
+   * @brief Move constructs a guard. `other` no longer owns a copy, unless moving the callback
+   * throws.
+   */
+  DeferPublish(DeferPublish&& other) noexcept(__is_nothrow_constructible(reclaimT, reclaimT&&)) :
+      policy_t{static_cast<policy_t&&>(other)}, target{other.target},
+      reclaim(static_cast<reclaimT&&>(other.reclaim)), next{other.next} {
+    other.next = nullptr;
+  }
+
+  DeferPublish(const DeferPublish&)            = delete;
+  DeferPublish& operator=(const DeferPublish&) = delete;
+
+  /**
+   * @brief Publishes the copy and reclaims the previous version, or, after an exception or
+   * `release()`, deletes the copy.
+   */
+  ~DeferPublish() {
+    if(next == nullptr) { return; }
+    if(policy_t::should_execute()) {
+      T* const old = target->exchange(next, std::memory_order_acq_rel);
+      if(old != nullptr) { reclaim(old); }
+    } else {
+      delete next;
+    }
+  }
+
+  /**
+   * @brief Returns the private copy.
+   */
+  T* get() const noexcept { return next; }
+  T& operator*() const noexcept { return *next; }
+  T* operator->() const noexcept { return next; }
+
+  /**
+   * @brief Discards the copy when the guard goes out of scope, leaving `target` unchanged.
+   */
+  using policy_t::release;
+}; // class DeferPublish
+
+/**
+ * @brief Creates a `DeferPublish` object holding a copy of the current version of `target`.
+ *
+ * @param target The shared pointer to update; must not be null.
+ * @param reclaim The callback that receives the previous version after a publish.
+ * @return A `DeferPublish` object.
+ */
+template <typename T, typename reclaimT>
+DEFERRAL_VISIBILITY_HIDDEN DeferPublish<T, typename internal::decay<reclaimT>::type>
+make_defer_publish(std::atomic<T*>& target, reclaimT&& reclaim) {
+  return DeferPublish<T, typename internal::decay<reclaimT>::type>{
+      target, static_cast<reclaimT&&>(reclaim)};
+}
+
+} // namespace deferral
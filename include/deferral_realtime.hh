@@ -0,0 +1,239 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Realtime sections.
+//
+// `RealtimeSection` pins the calling thread to a set of CPUs, switches it to a scheduling policy
+// and priority, and locks a memory range, for the lifetime of the guard. It reads the previous
+// state first and skips every change that would not change anything; the destructor restores only
+// what was changed. A change that fails, typically with `EPERM` without `CAP_SYS_NICE` or with
+// `ENOMEM` when `RLIMIT_MEMLOCK` is too low, is skipped and reported by `applied()` and `error()`
+// rather than thrown, so that the section still runs, without the guarantee.
+//
+// Only available on Linux.
+
+#pragma once
+
+#if !defined(__linux__)
+#error "deferral_realtime.hh requires Linux"
+#endif // !defined(__linux__)
+
+#include "deferral_core.hh"
+
+#include <cerrno>
+#include <cstddef>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+namespace deferral {
+
+/**
+ * @brief What a `RealtimeSection` changes. Each setter adds a change; the default changes nothing.
+ *
+ * @code
+ * auto config = deferral::RealtimeConfig{}.cpu(3).scheduling(SCHED_FIFO, 80).lock_memory(buf, n);
+ * @endcode
+ */
+class RealtimeConfig {
+  cpu_set_t cpu_set;
+  bool has_cpu_set{false};
+  int policy{-1};
+  int priority{0};
+  const void* lock_addr{nullptr};
+  std::size_t lock_size{0};
+
+  friend class RealtimeSection;
+
+public:
+  RealtimeConfig() noexcept { CPU_ZERO(&cpu_set); }
+
+  /**
+   * @brief Adds `c` to the CPUs the thread is pinned to.
+   */
+  RealtimeConfig& cpu(int c) noexcept {
+    CPU_SET(c, &cpu_set);
+    has_cpu_set = true;
+    return *this;
+  }
+
+  /**
+   * @brief Pins the thread to the CPUs in `set`.
+   */
+  RealtimeConfig& cpus(const cpu_set_t& set) noexcept {
+    cpu_set     = set;
+    has_cpu_set = true;
+    return *this;
+  }
+
+  /**
+   * @brief Sets the scheduling policy and priority of the thread, e.g. `SCHED_FIFO` and 80.
+   */
+  RealtimeConfig& scheduling(int p, int prio) noexcept {
+    policy   = p;
+    priority = prio;
+    return *this;
+  }
+
+  /**
+   * @brief Locks `n` bytes at `p` in memory with `mlock`, which also faults them in.
+   */
+  RealtimeConfig& lock_memory(const void* p, std::size_t n) noexcept {
+    lock_addr = p;
+    lock_size = n;
+    return *this;
+  }
+}; // class RealtimeConfig
+
+/**
+ * @brief A guard that applies a `RealtimeConfig` to the calling thread and restores the previous
+ * state when it goes out of scope, unless released.
+ *
+ * The changes are applied in the order affinity, memory, scheduling: pages are faulted in on the
+ * target CPU, and not at realtime priority. They are undone in reverse order. Each change costs
+ * one call to read the current state and, if it differs, one call to set it; the destructor makes
+ * one call per change that was applied.
+ *
+ * The memory range is unlocked by `munlock` on exit. Locks do not nest, so the range should not
+ * be locked elsewhere.
+ *
+ * The guard must be destroyed on the thread that created it.
+ */
+class DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN RealtimeSection : internal::OnExitPolicy {
+  using policy_t = internal::OnExitPolicy;
+
+public:
+  enum : unsigned {
+    // The thread was pinned to other CPUs.
+    affinity = 1u << 0,
+    // The memory range was locked.
+    memory = 1u << 1,
+    // The scheduling policy or priority was changed.
+    scheduling = 1u << 2,
+  };
+
+private:
+  cpu_set_t saved_cpu_set;
+  int saved_policy;
+  sched_param saved_param;
+  const void* locked_addr;
+  std::size_t locked_size;
+  unsigned applied_changes;
+  int first_error;
+
+  void* operator new(decltype(sizeof(0))) = delete;
+  void operator delete(void*)             = delete;
+
+  void fail(int e) noexcept {
+    if(first_error == 0) { first_error = e; }
+  }
+
+public:
+  /**
+   * @brief Applies `config` to the calling thread.
+   *
+   * @param config The changes to apply.
+   */
+  explicit RealtimeSection(const RealtimeConfig& config) noexcept :
+      policy_t{}, saved_cpu_set(), saved_policy{0}, saved_param(), locked_addr{config.lock_addr},
+      locked_size{config.lock_size}, applied_changes{0}, first_error{0} {
+    const pthread_t self = pthread_self();
+    if(config.has_cpu_set) {
+      if(int e = pthread_getaffinity_np(self, sizeof(saved_cpu_set), &saved_cpu_set)) {
+        fail(e);
+      } else if(!CPU_EQUAL(&saved_cpu_set, &config.cpu_set)) {
+        if(int e2 = pthread_setaffinity_np(self, sizeof(config.cpu_set), &config.cpu_set)) {
+          fail(e2);
+        } else {
+          applied_changes |= affinity;
+        }
+      }
+    }
+    if(config.lock_size != 0) {
+      if(mlock(config.lock_addr, config.lock_size) != 0) {
+        fail(errno);
+      } else {
+        applied_changes |= memory;
+      }
+    }
+    if(config.policy >= 0) {
+      if(int e = pthread_getschedparam(self, &saved_policy, &saved_param)) {
+        fail(e);
+      } else if(saved_policy != config.policy || saved_param.sched_priority != config.priority) {
+        sched_param param{};
+        param.sched_priority = config.priority;
+        if(int e2 = pthread_setschedparam(self, config.policy, &param)) {
+          fail(e2);
+        } else {
+          applied_changes |= scheduling;
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Move constructs a guard. `other` no longer restores anything.
+   */
+  RealtimeSection(RealtimeSection&& other) noexcept :
+      policy_t{static_cast<policy_t&&>(other)}, saved_cpu_set(other.saved_cpu_set),
+      saved_policy{other.saved_policy}, saved_param(other.saved_param),
+      locked_addr{other.locked_addr}, locked_size{other.locked_size},
+      applied_changes{other.applied_changes}, first_error{other.first_error} {
+    other.release();
+  }
+
+  RealtimeSection(const RealtimeSection&)            = delete;
+  RealtimeSection& operator=(const RealtimeSection&) = delete;
+
+  /**
+   * @brief Restores what was changed, in reverse order.
+   */
+  ~RealtimeSection() {
+    if(!policy_t::should_execute()) { return; }
+    const pthread_t self = pthread_self();
+    if(applied_changes & scheduling) { pthread_setschedparam(self, saved_policy, &saved_param); }
+    if(applied_changes & memory) { munlock(locked_addr, locked_size); }
+    if(applied_changes & affinity) {
+      pthread_setaffinity_np(self, sizeof(saved_cpu_set), &saved_cpu_set);
+    }
+  }
+
+  /**
+   * @brief Returns the changes that were applied, a combination of `affinity`, `memory` and
+   * `scheduling`. A requested change that is missing either failed or was already in effect.
+   */
+  unsigned applied() const noexcept { return applied_changes; }
+
+  /**
+   * @brief Returns the error number of the first change that failed, or 0.
+   */
+  int error() const noexcept { return first_error; }
+
+  /**
+   * @brief Keeps the changes when the guard goes out of scope.
+   */
+  using policy_t::release;
+}; // class RealtimeSection
+
+} // namespace deferral
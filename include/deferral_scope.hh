@@ -0,0 +1,480 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// `scope_exit`, `scope_fail`, `scope_success` and `unique_resource` with the interface and
+// semantics of the C++ Extensions for Library Fundamentals, Version 3 (<experimental/scope>),
+// implemented on deferral's guards and policies. Code written against the TS switches over by
+// including this header in place of <experimental/scope> and naming `deferral::` in place of
+// `std::experimental::`.
+//
+// Requires C++17, like the TS deduction guides.
+
+#pragma once
+
+#include "deferral_core.hh"
+
+#if __cplusplus < 201703L && !(defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#error "deferral_scope.hh requires C++17 or later"
+#endif
+
+// The TS calls the exit function or deleter when storing it throws. Without exceptions nothing can
+// throw, so the handlers are left out.
+#if defined(__cpp_exceptions) || defined(_CPPUNWIND)
+#define DEFERRAL_SCOPE_TRY             try
+#define DEFERRAL_SCOPE_CATCH_ALL(...) catch(...) { __VA_ARGS__; }
+#else
+#define DEFERRAL_SCOPE_TRY
+#define DEFERRAL_SCOPE_CATCH_ALL(...)
+#endif // defined(__cpp_exceptions) || defined(_CPPUNWIND)
+
+namespace deferral {
+namespace internal {
+
+template <typename T>
+struct is_pointer {
+  static constexpr bool value{false};
+};
+template <typename T>
+struct is_pointer<T*> {
+  static constexpr bool value{true};
+};
+
+template <typename T>
+struct is_lvalue_reference {
+  static constexpr bool value{false};
+};
+template <typename T>
+struct is_lvalue_reference<T&> {
+  static constexpr bool value{true};
+};
+
+/**
+ * @brief A rebindable reference, the `std::reference_wrapper` of the TS: stored in place of a
+ * reference exit function or resource, and called through for exit functions.
+ */
+template <typename T>
+class DEFERRAL_VISIBILITY_HIDDEN Ref {
+  T* ptr;
+
+public:
+  DEFERRAL_ALWAYS_INLINE constexpr Ref(T& r) noexcept : ptr{__builtin_addressof(r)} {}
+
+  DEFERRAL_ALWAYS_INLINE constexpr T& get() const noexcept { return *ptr; }
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 void operator()() const noexcept(
+      noexcept(declval<T&>()())) {
+    (*ptr)();
+  }
+}; // class Ref
+
+// The stored type for a TS `EF` or `R` template argument: the type itself, or `Ref` for an lvalue
+// reference.
+template <typename T>
+struct scope_storage {
+  using type = T;
+};
+template <typename T>
+struct scope_storage<T&> {
+  using type = Ref<T>;
+};
+
+// Selects the `unique_resource` constructor of `make_unique_resource_checked`.
+struct CheckedResourceTag {};
+
+// The TS constraints of the `scope_exit`, `scope_fail` and `scope_success` constructor.
+template <typename guardT, typename EF, typename EFP>
+using enable_scope_guard_t = typename enable_if<
+    !is_same<typename remove_cv<typename remove_reference<EFP>::type>::type, guardT>::value &&
+    __is_constructible(EF, EFP) &&
+    (__is_nothrow_constructible(EF, EFP) || __is_constructible(EF, EFP&))>::type;
+
+} // namespace internal
+
+/**
+ * @brief `std::experimental::scope_exit`: calls the exit function when the scope exits, unless
+ * released.
+ *
+ * A `DeferExit` with the TS constructor: if storing the exit function throws, the function is
+ * called before the exception propagates. The destructor is `noexcept`, so an exit function that
+ * throws terminates the program.
+ *
+ * @tparam EF The type of the exit function, or an lvalue reference to a function object.
+ */
+template <typename EF>
+struct DEFERRAL_NODISCARD scope_exit
+    : internal::DeferBase<typename internal::scope_storage<EF>::type, internal::OnExitPolicy> {
+  using base_t =
+      internal::DeferBase<typename internal::scope_storage<EF>::type, internal::OnExitPolicy>;
+
+  template <typename EFP, typename = internal::enable_scope_guard_t<scope_exit, EF, EFP>>
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 explicit scope_exit(EFP&& f) noexcept(
+      __is_nothrow_constructible(EF, EFP) || __is_nothrow_constructible(EF, EFP&))
+      DEFERRAL_SCOPE_TRY : base_t{static_cast<EFP&&>(f)} {}
+  DEFERRAL_SCOPE_CATCH_ALL(f())
+
+  DEFERRAL_ALWAYS_INLINE scope_exit(scope_exit&&) = default;
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 ~scope_exit() noexcept {}
+}; // struct scope_exit
+
+/**
+ * @brief `std::experimental::scope_fail`: calls the exit function when the scope exits by an
+ * exception, unless released.
+ *
+ * A `DeferFail` with the TS constructor: if storing the exit function throws, the function is
+ * called before the exception propagates. The destructor is `noexcept`.
+ *
+ * @tparam EF The type of the exit function, or an lvalue reference to a function object.
+ */
+template <typename EF>
+struct DEFERRAL_NODISCARD scope_fail
+    : internal::DeferBase<typename internal::scope_storage<EF>::type, internal::OnFailPolicy> {
+  using base_t =
+      internal::DeferBase<typename internal::scope_storage<EF>::type, internal::OnFailPolicy>;
+
+  template <typename EFP, typename = internal::enable_scope_guard_t<scope_fail, EF, EFP>>
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 explicit scope_fail(EFP&& f) noexcept(
+      __is_nothrow_constructible(EF, EFP) || __is_nothrow_constructible(EF, EFP&))
+      DEFERRAL_SCOPE_TRY : base_t{static_cast<EFP&&>(f)} {}
+  DEFERRAL_SCOPE_CATCH_ALL(f())
+
+  DEFERRAL_ALWAYS_INLINE scope_fail(scope_fail&&) = default;
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 ~scope_fail() noexcept {}
+}; // struct scope_fail
+
+/**
+ * @brief `std::experimental::scope_success`: calls the exit function when the scope exits without
+ * an exception, unless released.
+ *
+ * A `DeferSuccess` with the TS constructor. If storing the exit function throws, the function is
+ * not called. The destructor is `noexcept` if the exit function is.
+ *
+ * @tparam EF The type of the exit function, or an lvalue reference to a function object.
+ */
+template <typename EF>
+struct DEFERRAL_NODISCARD scope_success
+    : internal::DeferBase<typename internal::scope_storage<EF>::type, internal::OnSuccessPolicy> {
+  using base_t =
+      internal::DeferBase<typename internal::scope_storage<EF>::type, internal::OnSuccessPolicy>;
+
+  template <typename EFP, typename = internal::enable_scope_guard_t<scope_success, EF, EFP>>
+  DEFERRAL_ALWAYS_INLINE DEFERRAL_CONSTEXPR20 explicit scope_success(EFP&& f) noexcept(
+      __is_nothrow_constructible(EF, EFP) || __is_nothrow_constructible(EF, EFP&)) :
+      base_t{static_cast<EFP&&>(f)} {}
+
+  DEFERRAL_ALWAYS_INLINE scope_success(scope_success&&) = default;
+  DEFERRAL_ALWAYS_INLINE ~scope_success()               = default;
+}; // struct scope_success
+
+template <typename EF>
+scope_exit(EF) -> scope_exit<EF>;
+
+template <typename EF>
+scope_fail(EF) -> scope_fail<EF>;
+
+template <typename EF>
+scope_success(EF) -> scope_success<EF>;
+
+/**
+ * @brief `std::experimental::unique_resource`: owns a resource handle and calls the deleter on it
+ * when destroyed or reset, unless released.
+ *
+ * The "execute on reset" flag is deferral's `OnExitPolicy`, and an empty deleter takes no storage.
+ *
+ * @code
+ * auto fd = deferral::make_unique_resource_checked(::open(path, O_RDONLY), -1, &::close);
+ * @endcode
+ *
+ * @tparam R The type of the resource handle, or an lvalue reference to the resource.
+ * @tparam D The type of the deleter, called as `d(resource)`.
+ */
+template <typename R, typename D>
+class unique_resource : internal::OnExitPolicy {
+  using policy_t   = internal::OnExitPolicy;
+  using resource_t = typename internal::scope_storage<R>::type;
+
+  resource_t resource;
+  DEFERRAL_NO_UNIQUE_ADDRESS D deleter;
+
+  // `execute` is the initial "execute on reset" state: the deleter is only called on the resource
+  // when storing fails if the resource would have been owned.
+  template <typename RR, typename DD>
+  DEFERRAL_ALWAYS_INLINE static resource_t make_resource(
+      RR&& r, [[maybe_unused]] DD& d, [[maybe_unused]] bool execute) {
+    if constexpr(__is_nothrow_constructible(resource_t, RR)) {
+      return resource_t(static_cast<RR&&>(r));
+    } else {
+      DEFERRAL_SCOPE_TRY { return resource_t(r); }
+      DEFERRAL_SCOPE_CATCH_ALL(if(execute) { d(r); } throw)
+    }
+  }
+
+  template <typename DD>
+  DEFERRAL_ALWAYS_INLINE static D make_deleter(
+      DD&& d, [[maybe_unused]] resource_t& resource, [[maybe_unused]] bool execute) {
+    if constexpr(__is_nothrow_constructible(D, DD)) {
+      return D(static_cast<DD&&>(d));
+    } else {
+      DEFERRAL_SCOPE_TRY { return D(d); }
+      DEFERRAL_SCOPE_CATCH_ALL(if(execute) { d(value(resource)); } throw)
+    }
+  }
+
+  DEFERRAL_ALWAYS_INLINE static resource_t move_resource(unique_resource& rhs) noexcept(
+      __is_nothrow_constructible(resource_t, resource_t&&) ||
+      __is_nothrow_constructible(resource_t, resource_t&)) {
+    if constexpr(__is_nothrow_constructible(resource_t, resource_t&&)) {
+      return static_cast<resource_t&&>(rhs.resource);
+    } else {
+      return rhs.resource;
+    }
+  }
+
+  // If the deleter cannot be moved without throwing and copying it throws after the resource was
+  // moved, `rhs` deletes the resource in its new place and gives up ownership.
+  DEFERRAL_ALWAYS_INLINE static D move_deleter(
+      unique_resource& rhs, [[maybe_unused]] resource_t& resource) {
+    if constexpr(__is_nothrow_constructible(D, D&&)) {
+      return static_cast<D&&>(rhs.deleter);
+    } else {
+      DEFERRAL_SCOPE_TRY { return rhs.deleter; }
+      DEFERRAL_SCOPE_CATCH_ALL(
+          if constexpr(__is_nothrow_constructible(resource_t, resource_t&&)) {
+            if(rhs.should_execute()) {
+              rhs.deleter(value(resource));
+              rhs.release();
+            }
+          } throw)
+    }
+  }
+
+  DEFERRAL_ALWAYS_INLINE static constexpr R& value(resource_t& r) noexcept {
+    if constexpr(internal::is_lvalue_reference<R>::value) {
+      return r.get();
+    } else {
+      return r;
+    }
+  }
+  DEFERRAL_ALWAYS_INLINE static constexpr const R& value(const resource_t& r) noexcept {
+    if constexpr(internal::is_lvalue_reference<R>::value) {
+      return r.get();
+    } else {
+      return r;
+    }
+  }
+
+public:
+  /**
+   * @brief Constructs a `unique_resource` that owns nothing, with value-initialized resource and
+   * deleter.
+   */
+  template <typename RR = resource_t, typename = typename internal::enable_if<
+                                          __is_constructible(RR) && __is_constructible(D)>::type>
+  DEFERRAL_ALWAYS_INLINE unique_resource() noexcept(
+      __is_nothrow_constructible(resource_t) && __is_nothrow_constructible(D)) :
+      policy_t{}, resource(), deleter() {
+    policy_t::release();
+  }
+
+  /**
+   * @brief Takes ownership of `r`, to be deleted with `d`.
+   *
+   * If storing the resource throws, `d(r)` is called. If storing the deleter throws, `d` is called
+   * on the stored resource. The exception then propagates.
+   *
+   * @param r The resource handle.
+   * @param d The deleter.
+   */
+  template <typename RR, typename DD,
+      typename = typename internal::enable_if<__is_constructible(resource_t, RR) &&
+                                              __is_constructible(D, DD) &&
+                                              (__is_nothrow_constructible(resource_t, RR) ||
+                                                  __is_constructible(resource_t, RR&)) &&
+                                              (__is_nothrow_constructible(D, DD) ||
+                                                  __is_constructible(D, DD&))>::type>
+  DEFERRAL_ALWAYS_INLINE unique_resource(RR&& r, DD&& d) noexcept(
+      (__is_nothrow_constructible(resource_t, RR) ||
+          __is_nothrow_constructible(resource_t, RR&)) &&
+      (__is_nothrow_constructible(D, DD) || __is_nothrow_constructible(D, DD&))) :
+      policy_t{},
+      resource(make_resource(static_cast<RR&&>(r), d, true)),
+      deleter(make_deleter(static_cast<DD&&>(d), resource, true)) {}
+
+  /**
+   * @brief The constructor of `make_unique_resource_checked`. Like the one above, but owns `r`
+   * only if `execute_on_reset` is true, and otherwise does not call `d(r)` when storing fails.
+   */
+  template <typename RR, typename DD>
+  DEFERRAL_ALWAYS_INLINE unique_resource(
+      internal::CheckedResourceTag, RR&& r, DD&& d, bool execute_on_reset) :
+      policy_t{},
+      resource(make_resource(static_cast<RR&&>(r), d, execute_on_reset)),
+      deleter(make_deleter(static_cast<DD&&>(d), resource, execute_on_reset)) {
+    if(!execute_on_reset) { policy_t::release(); }
+  }
+
+  /**
+   * @brief Move constructs a `unique_resource`, taking over ownership from `rhs`.
+   */
+  DEFERRAL_ALWAYS_INLINE unique_resource(unique_resource&& rhs) noexcept(
+      __is_nothrow_constructible(resource_t, resource_t&&) &&
+      __is_nothrow_constructible(D, D&&)) :
+      policy_t{static_cast<const policy_t&>(rhs)},
+      resource(move_resource(rhs)),
+      deleter(move_deleter(rhs, resource)) {
+    rhs.release();
+  }
+
+  unique_resource(const unique_resource&)            = delete;
+  unique_resource& operator=(const unique_resource&) = delete;
+
+  /**
+   * @brief Deletes the owned resource, if any.
+   */
+  DEFERRAL_ALWAYS_INLINE ~unique_resource() { reset(); }
+
+  /**
+   * @brief Deletes the owned resource, if any, then takes over the resource, deleter and ownership
+   * of `rhs`.
+   */
+  DEFERRAL_ALWAYS_INLINE unique_resource& operator=(unique_resource&& rhs) noexcept(
+      __is_nothrow_assignable(resource_t&, resource_t&&) && __is_nothrow_assignable(D&, D&&)) {
+    reset();
+    if constexpr(__is_nothrow_assignable(resource_t&, resource_t&&)) {
+      if constexpr(__is_nothrow_assignable(D&, D&&)) {
+        resource = static_cast<resource_t&&>(rhs.resource);
+        deleter  = static_cast<D&&>(rhs.deleter);
+      } else {
+        deleter  = rhs.deleter;
+        resource = static_cast<resource_t&&>(rhs.resource);
+      }
+    } else {
+      if constexpr(__is_nothrow_assignable(D&, D&&)) {
+        resource = rhs.resource;
+        deleter  = static_cast<D&&>(rhs.deleter);
+      } else {
+        resource = rhs.resource;
+        deleter  = rhs.deleter;
+      }
+    }
+    if(rhs.should_execute()) { policy_t::arm(); }
+    rhs.release();
+    return *this;
+  }
+
+  /**
+   * @brief Deletes the owned resource, if any, and gives up ownership.
+   */
+  DEFERRAL_ALWAYS_INLINE void reset() noexcept {
+    if(policy_t::should_execute()) {
+      policy_t::release();
+      deleter(value(resource));
+    }
+  }
+
+  /**
+   * @brief Deletes the owned resource, if any, and takes ownership of `r`.
+   *
+   * If assigning `r` throws, the deleter is called on `r` and the exception propagates.
+   *
+   * @param r The new resource handle.
+   */
+  template <typename RR,
+      typename = typename internal::enable_if<__is_assignable(resource_t&, RR) ||
+                                              __is_assignable(resource_t&,
+                                                  const typename internal::remove_reference<
+                                                      RR>::type&)>::type>
+  DEFERRAL_ALWAYS_INLINE void reset(RR&& r) {
+    reset();
+    if constexpr(__is_nothrow_assignable(resource_t&, RR)) {
+      resource = static_cast<RR&&>(r);
+    } else {
+      DEFERRAL_SCOPE_TRY {
+        resource = static_cast<const typename internal::remove_reference<RR>::type&>(r);
+      }
+      DEFERRAL_SCOPE_CATCH_ALL(deleter(r); throw)
+    }
+    policy_t::arm();
+  }
+
+  /**
+   * @brief Gives up ownership without deleting the resource.
+   */
+  using policy_t::release;
+
+  /**
+   * @brief Returns the resource handle.
+   */
+  DEFERRAL_ALWAYS_INLINE const R& get() const noexcept { return value(resource); }
+
+  /**
+   * @brief Dereferences the resource handle. Only for pointers to a complete type.
+   */
+  template <typename RR = R,
+      typename = typename internal::enable_if<internal::is_pointer<RR>::value>::type>
+  DEFERRAL_ALWAYS_INLINE auto operator*() const noexcept -> decltype(*internal::declval<RR>()) {
+    return *get();
+  }
+
+  /**
+   * @brief Returns the resource handle. Only for pointers.
+   */
+  template <typename RR = R,
+      typename = typename internal::enable_if<internal::is_pointer<RR>::value>::type>
+  DEFERRAL_ALWAYS_INLINE R operator->() const noexcept {
+    return get();
+  }
+
+  /**
+   * @brief Returns the deleter.
+   */
+  DEFERRAL_ALWAYS_INLINE const D& get_deleter() const noexcept { return deleter; }
+}; // class unique_resource
+
+template <typename R, typename D>
+unique_resource(R, D) -> unique_resource<R, D>;
+
+/**
+ * @brief Creates a `unique_resource` that owns `resource` unless it compares equal to `invalid`,
+ * for handles with a sentinel value such as `-1` or `nullptr`.
+ *
+ * @param resource The resource handle.
+ * @param invalid The value that `resource` has if acquiring it failed.
+ * @param d The deleter.
+ * @return A `unique_resource` that deletes `resource` unless it is invalid.
+ */
+template <typename R, typename D, typename S = typename internal::decay<R>::type>
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE
+    unique_resource<typename internal::decay<R>::type, typename internal::decay<D>::type>
+    make_unique_resource_checked(R&& resource, const S& invalid, D&& d) noexcept(
+        __is_nothrow_constructible(typename internal::decay<R>::type, R) &&
+        __is_nothrow_constructible(typename internal::decay<D>::type, D)) {
+  const bool execute_on_reset{!static_cast<bool>(resource == invalid)};
+  return unique_resource<typename internal::decay<R>::type, typename internal::decay<D>::type>(
+      internal::CheckedResourceTag{}, static_cast<R&&>(resource), static_cast<D&&>(d),
+      execute_on_reset);
+}
+
+} // namespace deferral
+
+#undef DEFERRAL_SCOPE_TRY
+#undef DEFERRAL_SCOPE_CATCH_ALL
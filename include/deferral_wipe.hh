@@ -0,0 +1,229 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Guards that zero a buffer on scope exit, for key material and other secrets.
+//
+// `defer { memset(buf, 0, n); };` is not enough: a store to memory that is never read again (the
+// buffer goes out of scope or is freed right after) is dead, and the optimizer may remove it.
+// `secure_wipe` zeroes the buffer with `explicit_bzero` semantics instead. Large buffers are
+// written with non-temporal stores, so wiping them does not evict the rest of the working set from
+// the cache; on x86 the widest available stores (AVX-512, AVX2 or SSE2) are picked at run time.
+
+#pragma once
+
+#include "deferral_core.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// SSE2 is the fallback of the non-temporal path, so 32-bit x86 only takes it when SSE2 is part of
+// the target baseline; otherwise every buffer is wiped with plain stores.
+#if(defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))) && defined(__GNUC__)
+#define DEFERRAL_WIPE_X86 1
+#include <immintrin.h>
+#endif // (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))) && defined(__GNUC__)
+
+// Buffers of at least this many bytes are wiped with non-temporal stores, where available. Below
+// it, a buffer is likely to fit in the last-level cache, where plain stores are faster; above it,
+// plain stores are bound by memory bandwidth and evict the rest of the working set.
+#if !defined(DEFERRAL_WIPE_NONTEMPORAL_THRESHOLD)
+#define DEFERRAL_WIPE_NONTEMPORAL_THRESHOLD (8 * 1024 * 1024)
+#endif // !defined(DEFERRAL_WIPE_NONTEMPORAL_THRESHOLD)
+
+namespace deferral {
+namespace internal {
+
+/**
+ * @brief Zeroes `n` bytes at `p` with ordinary stores that the optimizer cannot remove.
+ */
+inline void wipe_plain(void* p, std::size_t n) noexcept {
+#if defined(__GNUC__)
+  std::memset(p, 0, n);
+  // The compiler must assume that the asm reads the memory behind `p`, so the stores are live.
+  __asm__ __volatile__("" : : "r"(p) : "memory");
+#else
+  volatile unsigned char* q = static_cast<volatile unsigned char*>(p);
+  while(n--) { *q++ = 0; }
+#endif // defined(__GNUC__)
+}
+
+#if defined(DEFERRAL_WIPE_X86)
+
+// Non-temporal stores of 64 bytes per iteration. `p` is 64-byte aligned and `n` a multiple of 64.
+
+__attribute__((target("avx512f"))) inline void wipe_stream_avx512(char* p, std::size_t n) noexcept {
+  const __m512i zero = _mm512_setzero_si512();
+  for(char* end = p + n; p != end; p += 64) {
+    _mm512_stream_si512(reinterpret_cast<__m512i*>(p), zero);
+  }
+}
+
+__attribute__((target("avx2"))) inline void wipe_stream_avx2(char* p, std::size_t n) noexcept {
+  const __m256i zero = _mm256_setzero_si256();
+  for(char* end = p + n; p != end; p += 64) {
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(p), zero);
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(p + 32), zero);
+  }
+}
+
+inline void wipe_stream_sse2(char* p, std::size_t n) noexcept {
+  const __m128i zero = _mm_setzero_si128();
+  for(char* end = p + n; p != end; p += 64) {
+    _mm_stream_si128(reinterpret_cast<__m128i*>(p), zero);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(p + 16), zero);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(p + 32), zero);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(p + 48), zero);
+  }
+}
+
+/**
+ * @brief Zeroes `n` bytes at `p` with non-temporal stores, picking the widest stores the CPU
+ * supports. The unaligned head and the tail are zeroed with plain stores.
+ */
+inline void wipe_nontemporal(void* p, std::size_t n) noexcept {
+  char* begin = static_cast<char*>(p);
+  const std::size_t head = static_cast<std::size_t>(-reinterpret_cast<std::uintptr_t>(begin) & 63);
+  if(n < head + 64) {
+    wipe_plain(p, n);
+    return;
+  }
+  char* body             = begin + head;
+  const std::size_t size = (n - head) & ~static_cast<std::size_t>(63);
+
+  wipe_plain(begin, head);
+  if(__builtin_cpu_supports("avx512f")) {
+    wipe_stream_avx512(body, size);
+  } else if(__builtin_cpu_supports("avx2")) {
+    wipe_stream_avx2(body, size);
+  } else {
+    wipe_stream_sse2(body, size);
+  }
+  // Orders the non-temporal stores before any later store, e.g. by the allocator reusing the
+  // memory on another thread.
+  _mm_sfence();
+  wipe_plain(body + size, n - head - size);
+}
+
+#endif // defined(DEFERRAL_WIPE_X86)
+
+} // namespace internal
+
+/**
+ * @brief Zeroes `n` bytes at `p`, even if the memory is never read again.
+ *
+ * Like `explicit_bzero`, the stores are not removed as dead stores before the buffer is freed or
+ * goes out of scope. Buffers of at least `DEFERRAL_WIPE_NONTEMPORAL_THRESHOLD` bytes are written
+ * with non-temporal stores on x86-64, and on 32-bit x86 targets with SSE2.
+ *
+ * @param p The buffer to zero.
+ * @param n The size of the buffer in bytes.
+ */
+inline void secure_wipe(void* p, std::size_t n) noexcept {
+#if defined(DEFERRAL_WIPE_X86)
+  if(n >= DEFERRAL_WIPE_NONTEMPORAL_THRESHOLD) {
+    internal::wipe_nontemporal(p, n);
+    return;
+  }
+#endif // defined(DEFERRAL_WIPE_X86)
+  internal::wipe_plain(p, n);
+}
+
+namespace internal {
+
+// The function of the wipe guards.
+struct DEFERRAL_VISIBILITY_HIDDEN Wipe {
+  void* data;
+  std::size_t size;
+
+  DEFERRAL_ALWAYS_INLINE void operator()() const noexcept { secure_wipe(data, size); }
+}; // struct Wipe
+
+} // namespace internal
+
+/**
+ * @brief A guard that zeroes a buffer with `secure_wipe` when it goes out of scope, if `policyT`
+ * says so. See `DeferWipe` and `DeferWipeFail`.
+ *
+ * @tparam policyT The policy that decides whether the buffer is wiped.
+ */
+template <typename policyT>
+struct DEFERRAL_NODISCARD DEFERRAL_VISIBILITY_HIDDEN BasicDeferWipe
+    : internal::DeferBase<internal::Wipe, policyT> {
+  using base_t = internal::DeferBase<internal::Wipe, policyT>;
+
+  /**
+   * @brief Constructs a guard that wipes `n` bytes at `p`.
+   *
+   * @param p The buffer to wipe.
+   * @param n The size of the buffer in bytes.
+   */
+  DEFERRAL_ALWAYS_INLINE BasicDeferWipe(void* p, std::size_t n) noexcept :
+      base_t{internal::Wipe{p, n}} {}
+  DEFERRAL_ALWAYS_INLINE BasicDeferWipe(BasicDeferWipe&&) = default;
+  DEFERRAL_ALWAYS_INLINE ~BasicDeferWipe()                = default;
+}; // struct BasicDeferWipe
+
+/**
+ * @brief Wipes the buffer on every scope exit, unless released.
+ *
+ * @code
+ * unsigned char key[32];
+ * deferral::DeferWipe wipe_key(key, sizeof(key));
+ * derive_key(key);
+ * @endcode
+ */
+using DeferWipe = BasicDeferWipe<internal::OnExitPolicy>;
+
+/**
+ * @brief Wipes the buffer only if the scope exits by an exception, e.g. a partially filled output
+ * buffer that is handed to the caller on success.
+ */
+using DeferWipeFail = BasicDeferWipe<internal::OnFailPolicy>;
+
+/**
+ * @brief Creates a `DeferWipe` object.
+ *
+ * @param p The buffer to wipe.
+ * @param n The size of the buffer in bytes.
+ * @return A `DeferWipe` object.
+ */
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DeferWipe make_defer_wipe(
+    void* p, std::size_t n) noexcept {
+  return DeferWipe{p, n};
+}
+
+/**
+ * @brief Creates a `DeferWipeFail` object.
+ *
+ * @param p The buffer to wipe if the scope exits by an exception.
+ * @param n The size of the buffer in bytes.
+ * @return A `DeferWipeFail` object.
+ */
+DEFERRAL_VISIBILITY_HIDDEN DEFERRAL_ALWAYS_INLINE DeferWipeFail make_defer_wipe_fail(
+    void* p, std::size_t n) noexcept {
+  return DeferWipeFail{p, n};
+}
+
+} // namespace deferral
@@ -0,0 +1,47 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 Justus Calvin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// The `deferral` C++20 named module. It exports everything declared by deferral.hh, including the
+// `internal` tag types and `operator+` overloads the macros expand to. Macros cannot be exported
+// from a named module, so importers that want `DEFER`/`defer` also include (or import as a header
+// unit) deferral_macros.hh:
+//
+//   import deferral;
+//   #include <deferral_macros.hh>
+
+module;
+
+#include <exception>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+export module deferral;
+
+#define DEFERRAL_BEGIN_EXPORT export {
+#define DEFERRAL_END_EXPORT   }
+
+extern "C++" {
+#include "deferral.hh"
+}
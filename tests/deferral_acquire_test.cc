@@ -0,0 +1,126 @@
+#include "deferral_acquire.hh"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <type_traits>
+
+namespace {
+
+// Appends a character to a log: lower case for an acquire, upper case for a release.
+struct Append {
+  std::string* log;
+  char c;
+  void operator()() const { *log += c; }
+};
+
+struct ThrowingAcquire {
+  void operator()() const { throw 1; }
+};
+
+struct RefusingAcquire {
+  bool operator()() const { return false; }
+};
+
+struct NoexceptRelease {
+  void operator()() const noexcept {}
+};
+
+} // namespace
+
+static_assert(std::is_nothrow_destructible<deferral::AcquireAll<NoexceptRelease>>::value, "");
+static_assert(!std::is_nothrow_destructible<deferral::AcquireAll<Append>>::value, "");
+static_assert(!std::is_copy_constructible<deferral::AcquireAll<Append>>::value, "");
+
+TEST(DeferralAcquireTest, TestCommit) {
+  std::string log;
+  {
+    auto g = deferral::acquire_all(deferral::step(Append{&log, 'a'}, Append{&log, 'A'}),
+        deferral::step(Append{&log, 'b'}, Append{&log, 'B'}),
+        deferral::step(Append{&log, 'c'}, Append{&log, 'C'}));
+    EXPECT_TRUE(g.acquired());
+    g.commit();
+  }
+  EXPECT_EQ(log, "abc");
+}
+
+TEST(DeferralAcquireTest, TestReleaseOnExit) {
+  std::string log;
+  {
+    auto g = deferral::acquire_all(deferral::step(Append{&log, 'a'}, Append{&log, 'A'}),
+        deferral::step(Append{&log, 'b'}, Append{&log, 'B'}),
+        deferral::step(Append{&log, 'c'}, Append{&log, 'C'}));
+    EXPECT_TRUE(g.acquired());
+  }
+  EXPECT_EQ(log, "abcCBA");
+}
+
+TEST(DeferralAcquireTest, TestReleaseOnThrowAfterAcquire) {
+  std::string log;
+  try {
+    auto g = deferral::acquire_all(deferral::step(Append{&log, 'a'}, Append{&log, 'A'}),
+        deferral::step(Append{&log, 'b'}, Append{&log, 'B'}));
+    log += '-';
+    throw 0;
+  } catch(...) {}
+  EXPECT_EQ(log, "ab-BA");
+}
+
+TEST(DeferralAcquireTest, TestAcquireThrows) {
+  // Only the steps before the failed one are released, last to first.
+  std::string log;
+  bool caught = false;
+  try {
+    auto g = deferral::acquire_all(deferral::step(Append{&log, 'a'}, Append{&log, 'A'}),
+        deferral::step(Append{&log, 'b'}, Append{&log, 'B'}),
+        deferral::step(ThrowingAcquire{}, Append{&log, 'C'}),
+        deferral::step(Append{&log, 'd'}, Append{&log, 'D'}));
+    log += '-';
+  } catch(int) { caught = true; }
+  EXPECT_TRUE(caught);
+  EXPECT_EQ(log, "abBA");
+}
+
+TEST(DeferralAcquireTest, TestAcquireReturnsFalse) {
+  std::string log;
+  {
+    bool second = false;
+    auto g      = deferral::acquire_all(deferral::step(Append{&log, 'a'}, Append{&log, 'A'}),
+        deferral::step([&]() { return second; }, Append{&log, 'B'}),
+        deferral::step(RefusingAcquire{}, Append{&log, 'C'}));
+    EXPECT_FALSE(g.acquired());
+    EXPECT_EQ(log, "aA");
+    log += '-';
+  }
+  EXPECT_EQ(log, "aA-");
+
+  {
+    bool second = true;
+    auto g      = deferral::acquire_all(deferral::step(Append{&log, 'a'}, Append{&log, 'A'}),
+        deferral::step([&]() { return second; }, Append{&log, 'B'}));
+    EXPECT_TRUE(g.acquired());
+  }
+  EXPECT_EQ(log, "aA-aBA");
+}
+
+TEST(DeferralAcquireTest, TestMove) {
+  std::string log;
+  {
+    auto g = deferral::acquire_all(deferral::step(Append{&log, 'a'}, Append{&log, 'A'}));
+    auto h = std::move(g);
+    EXPECT_FALSE(g.acquired());
+    EXPECT_TRUE(h.acquired());
+  }
+  EXPECT_EQ(log, "aA");
+}
+
+TEST(DeferralAcquireTest, TestSize) {
+  // One mask for all steps: three `[&]` releases take three pointers and the mask one byte.
+  int a = 0, b = 0, c = 0;
+  auto g = deferral::acquire_all(deferral::step([&]() { ++a; }, [&]() { --a; }),
+      deferral::step([&]() { ++b; }, [&]() { --b; }),
+      deferral::step([&]() { ++c; }, [&]() { --c; }));
+  EXPECT_EQ(sizeof(g), 4 * sizeof(void*));
+  EXPECT_EQ(a + b + c, 3);
+  g.commit();
+}
@@ -0,0 +1,122 @@
+#include "deferral_any.hh"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct Count {
+  int* n;
+  void operator()() const noexcept { ++*n; }
+};
+
+struct Big {
+  char data[64];
+  void operator()() const noexcept {}
+};
+
+struct ThrowingMove {
+  ThrowingMove() = default;
+  ThrowingMove(ThrowingMove&&) {}
+  void operator()() const noexcept {}
+};
+
+// Owns a heap object, so that moving and destroying the stored function are observable.
+struct Owner {
+  std::unique_ptr<int> value;
+  std::string* log;
+  void operator()() const { *log += std::to_string(*value); }
+};
+
+} // namespace
+
+// A class member of a fixed type, assigned after construction. At namespace scope with default
+// visibility, so that a hidden `DeferAny` would fail the build with a -Wattributes warning.
+struct Connection {
+  deferral::DeferAny<> on_close;
+};
+
+static_assert(sizeof(deferral::DeferAny<>) == 4 * sizeof(void*), "one pointer plus the storage");
+static_assert(std::is_nothrow_move_constructible<deferral::DeferAny<>>::value, "");
+static_assert(std::is_nothrow_move_assignable<deferral::DeferAny<>>::value, "");
+static_assert(!std::is_copy_constructible<deferral::DeferAny<>>::value, "");
+static_assert(!std::is_constructible<deferral::DeferAny<>, deferral::DeferAny<>&>::value, "");
+static_assert(deferral::DeferAny<>::fits<Count>(), "");
+static_assert(!deferral::DeferAny<>::fits<Big>(), "too large");
+static_assert(deferral::DeferAny<64>::fits<Big>(), "");
+static_assert(!deferral::DeferAny<64>::fits<ThrowingMove>(), "moves are noexcept");
+
+TEST(DeferralAnyTest, TestExit) {
+  int n = 0;
+  {
+    deferral::DeferAny<> g{Count{&n}};
+    EXPECT_TRUE(static_cast<bool>(g));
+    EXPECT_EQ(n, 0);
+  }
+  EXPECT_EQ(n, 1);
+  {
+    deferral::DeferAny<> g;
+    EXPECT_FALSE(static_cast<bool>(g));
+  }
+}
+
+TEST(DeferralAnyTest, TestReleaseExecute) {
+  int n = 0;
+  {
+    deferral::DeferAny<> g{Count{&n}};
+    g.release();
+    EXPECT_FALSE(static_cast<bool>(g));
+  }
+  EXPECT_EQ(n, 0);
+  {
+    deferral::DeferAny<> g{[&]() { ++n; }};
+    g.execute();
+    EXPECT_EQ(n, 1);
+  }
+  EXPECT_EQ(n, 1);
+}
+
+TEST(DeferralAnyTest, TestMove) {
+  std::string log;
+  {
+    deferral::DeferAny<> a{Owner{std::unique_ptr<int>(new int(1)), &log}};
+    deferral::DeferAny<> b{std::move(a)};
+    EXPECT_FALSE(static_cast<bool>(a));
+    EXPECT_TRUE(static_cast<bool>(b));
+  }
+  EXPECT_EQ(log, "1");
+
+  {
+    deferral::DeferAny<> a{Owner{std::unique_ptr<int>(new int(2)), &log}};
+    deferral::DeferAny<> b{Owner{std::unique_ptr<int>(new int(3)), &log}};
+    // Assignment executes the pending function of the target first.
+    b = std::move(a);
+    EXPECT_EQ(log, "13");
+    EXPECT_FALSE(static_cast<bool>(a));
+  }
+  EXPECT_EQ(log, "132");
+
+  {
+    deferral::DeferAny<> a{Owner{std::unique_ptr<int>(new int(4)), &log}};
+    a.release();
+  }
+  EXPECT_EQ(log, "132");
+}
+
+TEST(DeferralAnyTest, TestMemberAndVector) {
+  int n = 0;
+  {
+    Connection c;
+    c.on_close = deferral::DeferAny<>{Count{&n}};
+    std::vector<deferral::DeferAny<>> guards;
+    for(int i = 0; i < 10; ++i) { guards.emplace_back(Count{&n}); }
+    guards.erase(guards.begin(), guards.begin() + 4);
+    EXPECT_EQ(n, 4);
+  }
+  EXPECT_EQ(n, 11);
+}
@@ -0,0 +1,124 @@
+#include "deferral_breadcrumb.hh"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+std::vector<std::string> trail() {
+  std::vector<std::string> messages;
+  for(const char* m : deferral::breadcrumbs()) { messages.emplace_back(m); }
+  return messages;
+}
+
+void parse_record(int record, const char* file, bool fail) {
+  DEFER_BREADCRUMB("while parsing record {} of {}", record, file);
+  if(fail) { throw std::runtime_error("bad record"); }
+}
+
+void parse_file(const char* file, int records, int bad) {
+  DEFER_BREADCRUMB("while loading {}", file);
+  for(int i = 0; i < records; ++i) { parse_record(i, file, i == bad); }
+}
+
+enum Color { red, green };
+
+} // namespace
+
+static_assert(std::is_nothrow_move_constructible<deferral::DeferBreadcrumb<int>>::value, "");
+static_assert(!std::is_copy_constructible<deferral::DeferBreadcrumb<int>>::value, "");
+static_assert(deferral::internal::is_breadcrumb_arg<Color>::value, "");
+static_assert(deferral::internal::is_breadcrumb_arg<const char*>::value, "");
+static_assert(!deferral::internal::is_breadcrumb_arg<double>::value, "");
+static_assert(!deferral::internal::is_breadcrumb_arg<std::string>::value, "");
+static_assert(!deferral::internal::is_breadcrumb_arg<void (*)()>::value, "");
+
+TEST(DeferralBreadcrumbTest, TestSuccessAddsNothing) {
+  deferral::clear_breadcrumbs();
+  parse_file("a.csv", 8, -1);
+  EXPECT_TRUE(deferral::breadcrumbs().empty());
+  EXPECT_EQ(deferral::breadcrumbs().size(), 0u);
+  EXPECT_TRUE(trail().empty());
+}
+
+TEST(DeferralBreadcrumbTest, TestUnwindingOrder) {
+  deferral::clear_breadcrumbs();
+  try {
+    parse_file("a.csv", 8, 5);
+    FAIL();
+  } catch(const std::runtime_error&) {
+    EXPECT_EQ(deferral::breadcrumbs().size(), 2u);
+    EXPECT_EQ(trail(), (std::vector<std::string>{
+                           "while parsing record 5 of a.csv", "while loading a.csv"}));
+    deferral::clear_breadcrumbs();
+  }
+  EXPECT_TRUE(deferral::breadcrumbs().empty());
+}
+
+TEST(DeferralBreadcrumbTest, TestFormatting) {
+  deferral::clear_breadcrumbs();
+  const int* const p = reinterpret_cast<const int*>(static_cast<std::uintptr_t>(0x1f00));
+  const char* none   = nullptr;
+  try {
+    DEFER_BREADCRUMB("no arguments");
+    DEFER_BREADCRUMB("{} {} {} {} {}", -42, 7u, -9223372036854775807ll - 1, 18446744073709551615ull,
+        static_cast<short>(-3));
+    DEFER_BREADCRUMB("{}{}{} {} {}", 'x', true, false, green, static_cast<unsigned char>(200));
+    DEFER_BREADCRUMB("{} {} {}", p, none, "text");
+    DEFER_BREADCRUMB("{} {} {}", 1);
+    throw std::runtime_error("fail");
+  } catch(const std::runtime_error&) {
+    EXPECT_EQ(trail(), (std::vector<std::string>{"1 {} {}", "0x1f00 (null) text",
+                           "xtruefalse 1 200",
+                           "-42 7 -9223372036854775808 18446744073709551615 -3", "no arguments"}));
+  }
+  deferral::clear_breadcrumbs();
+}
+
+TEST(DeferralBreadcrumbTest, TestReleaseAndNoFailure) {
+  deferral::clear_breadcrumbs();
+  try {
+    auto released = deferral::make_breadcrumb("released {}", 1);
+    released.release();
+    DEFER_BREADCRUMB("kept {}", 2);
+    throw std::runtime_error("fail");
+  } catch(const std::runtime_error&) {
+    EXPECT_EQ(trail(), (std::vector<std::string>{"kept 2"}));
+  }
+  deferral::clear_breadcrumbs();
+
+  // A guard created while an exception is in flight only fires for a new exception.
+  try {
+    DEFERRAL_MAYBE_UNUSED auto outer = deferral::make_breadcrumb("outer");
+    throw std::runtime_error("fail");
+  } catch(const std::runtime_error&) {
+    deferral::clear_breadcrumbs();
+    DEFER_BREADCRUMB("inside the handler");
+  }
+  EXPECT_TRUE(deferral::breadcrumbs().empty());
+}
+
+TEST(DeferralBreadcrumbTest, TestTruncation) {
+  deferral::clear_breadcrumbs();
+  const std::string big(DEFERRAL_BREADCRUMB_CAPACITY / 2, 'a');
+  try {
+    DEFER_BREADCRUMB("dropped");
+    DEFER_BREADCRUMB("second {}", big.c_str());
+    DEFER_BREADCRUMB("first {}", big.c_str());
+    throw std::runtime_error("fail");
+  } catch(const std::runtime_error&) {
+    const std::vector<std::string> messages = trail();
+    ASSERT_EQ(messages.size(), 2u);
+    EXPECT_EQ(messages[0], "first " + big);
+    EXPECT_LT(messages[1].size(), ("second " + big).size());
+    EXPECT_EQ(messages[1].compare(0, 7, "second "), 0);
+    EXPECT_EQ(deferral::breadcrumbs().dropped(), 1u);
+  }
+  deferral::clear_breadcrumbs();
+  EXPECT_EQ(deferral::breadcrumbs().dropped(), 0u);
+}
@@ -0,0 +1,286 @@
+#include "deferral_execution.hh"
+
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace ex = deferral::execution;
+
+namespace {
+
+// A sender that completes inline with a value.
+template <typename T>
+struct Just {
+  using sender_concept        = ex::sender_t;
+  using completion_signatures = ex::completion_signatures<ex::set_value_t(T)>;
+  T value;
+
+  template <typename R>
+  struct Operation {
+    using operation_state_concept = ex::operation_state_t;
+    T value;
+    R receiver;
+    void start() & noexcept { ex::set_value(std::move(receiver), std::move(value)); }
+  };
+
+  template <typename R>
+  Operation<R> connect(R r) && {
+    return {std::move(value), std::move(r)};
+  }
+};
+
+// A sender that completes inline with an exception.
+struct JustError {
+  using sender_concept        = ex::sender_t;
+  using completion_signatures = ex::completion_signatures<ex::set_value_t(int),
+      ex::set_error_t(std::exception_ptr)>;
+  std::string what;
+
+  template <typename R>
+  struct Operation {
+    using operation_state_concept = ex::operation_state_t;
+    std::string what;
+    R receiver;
+    void start() & noexcept {
+      ex::set_error(std::move(receiver), std::make_exception_ptr(std::runtime_error(what)));
+    }
+  };
+
+  template <typename R>
+  Operation<R> connect(R r) && {
+    return {std::move(what), std::move(r)};
+  }
+};
+
+// A sender that completes inline with stopped.
+struct JustStopped {
+  using sender_concept        = ex::sender_t;
+  using completion_signatures = ex::completion_signatures<ex::set_value_t(int), ex::set_stopped_t()>;
+
+  template <typename R>
+  struct Operation {
+    using operation_state_concept = ex::operation_state_t;
+    R receiver;
+    void start() & noexcept { ex::set_stopped(std::move(receiver)); }
+  };
+
+  template <typename R>
+  Operation<R> connect(R r) && {
+    return {std::move(r)};
+  }
+};
+
+// A thread pool whose senders run a function on a worker thread, then complete with no value.
+class ThreadPool {
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<std::function<void()>> tasks;
+  bool stopping = false;
+  std::vector<std::thread> workers;
+
+  void work() {
+    for(;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock{mutex};
+        ready.wait(lock, [this]() { return stopping || !tasks.empty(); });
+        if(tasks.empty()) { return; }
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+public:
+  explicit ThreadPool(int threads) {
+    for(int i = 0; i < threads; ++i) { workers.emplace_back([this]() { work(); }); }
+  }
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      stopping = true;
+    }
+    ready.notify_all();
+    for(auto& w : workers) { w.join(); }
+  }
+
+  void post(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      tasks.push_back(std::move(task));
+    }
+    ready.notify_one();
+  }
+
+  struct Run {
+    using sender_concept        = ex::sender_t;
+    using completion_signatures = ex::completion_signatures<ex::set_value_t()>;
+    ThreadPool* pool;
+    std::function<void()> f;
+
+    template <typename R>
+    struct Operation {
+      using operation_state_concept = ex::operation_state_t;
+      ThreadPool* pool;
+      std::function<void()> f;
+      R receiver;
+      void start() & noexcept {
+        pool->post([this]() {
+          f();
+          ex::set_value(std::move(receiver));
+        });
+      }
+    };
+
+    template <typename R>
+    Operation<R> connect(R r) && {
+      return {pool, std::move(f), std::move(r)};
+    }
+  };
+
+  Run run(std::function<void()> f) { return {this, std::move(f)}; }
+};
+
+// A sender that runs a function inline, then completes with no value.
+struct RunInline {
+  using sender_concept        = ex::sender_t;
+  using completion_signatures = ex::completion_signatures<ex::set_value_t()>;
+  std::function<void()> f;
+
+  template <typename R>
+  struct Operation {
+    using operation_state_concept = ex::operation_state_t;
+    std::function<void()> f;
+    R receiver;
+    void start() & noexcept {
+      f();
+      ex::set_value(std::move(receiver));
+    }
+  };
+
+  template <typename R>
+  Operation<R> connect(R r) && {
+    return {std::move(f), std::move(r)};
+  }
+};
+
+// How a sender completed, collected by `wait`.
+struct Completion {
+  std::string channel;
+  int value = 0;
+  std::string error;
+};
+
+struct State {
+  std::mutex mutex;
+  std::condition_variable done_cv;
+  bool done = false;
+  Completion completion;
+
+  void finish(Completion c) {
+    std::lock_guard<std::mutex> lock{mutex};
+    completion = std::move(c);
+    done       = true;
+    done_cv.notify_all();
+  }
+};
+
+struct WaitReceiver {
+  using receiver_concept = ex::receiver_t;
+  State* state;
+
+  void set_value(int v) && noexcept { state->finish({"value", v, {}}); }
+  void set_error(std::exception_ptr e) && noexcept {
+    try {
+      std::rethrow_exception(e);
+    } catch(const std::exception& x) { state->finish({"error", 0, x.what()}); }
+  }
+  void set_stopped() && noexcept { state->finish({"stopped", 0, {}}); }
+};
+
+// Connects `sndr`, starts it and waits for it to complete, like `sync_wait`.
+template <typename S>
+Completion wait(S&& sndr) {
+  State state;
+  auto op = ex::connect(std::forward<S>(sndr), WaitReceiver{&state});
+  ex::start(op);
+  std::unique_lock<std::mutex> lock{state.mutex};
+  state.done_cv.wait(lock, [&]() { return state.done; });
+  return state.completion;
+}
+
+} // namespace
+
+TEST(DeferralExecutionTest, TestLetDeferAllChannels) {
+  std::string log;
+  auto cleanup = [&]() { return RunInline{[&]() { log += "cleanup;"; }}; };
+
+  Completion c = wait(deferral::let_defer(Just<int>{7}, cleanup()));
+  EXPECT_EQ(c.channel, "value");
+  EXPECT_EQ(c.value, 7);
+
+  c = wait(deferral::let_defer(JustError{"boom"}, cleanup()));
+  EXPECT_EQ(c.channel, "error");
+  EXPECT_EQ(c.error, "boom");
+
+  c = wait(deferral::let_defer(JustStopped{}, cleanup()));
+  EXPECT_EQ(c.channel, "stopped");
+
+  EXPECT_EQ(log, "cleanup;cleanup;cleanup;");
+}
+
+TEST(DeferralExecutionTest, TestLetDeferFailSuccess) {
+  std::string log;
+  auto cleanup = [&](const char* name) { return RunInline{[&log, name]() { log += name; }}; };
+
+  EXPECT_EQ(wait(deferral::let_defer_fail(Just<int>{1}, cleanup("f1;"))).channel, "value");
+  EXPECT_EQ(wait(deferral::let_defer_fail(JustError{"x"}, cleanup("f2;"))).channel, "error");
+  EXPECT_EQ(wait(deferral::let_defer_fail(JustStopped{}, cleanup("f3;"))).channel, "stopped");
+  EXPECT_EQ(wait(deferral::let_defer_success(Just<int>{1}, cleanup("s1;"))).channel, "value");
+  EXPECT_EQ(wait(deferral::let_defer_success(JustError{"x"}, cleanup("s2;"))).channel, "error");
+  EXPECT_EQ(wait(deferral::let_defer_success(JustStopped{}, cleanup("s3;"))).channel, "stopped");
+
+  EXPECT_EQ(log, "f2;s1;");
+}
+
+TEST(DeferralExecutionTest, TestCleanupOnThreadPool) {
+  // The cleanup completes on a worker thread; the value of the main sender is held in the
+  // operation state until then and forwarded from that thread.
+  ThreadPool pool{2};
+  std::thread::id cleanup_thread;
+  bool cleaned = false;
+  Completion c = wait(deferral::let_defer(Just<int>{42}, pool.run([&]() {
+    cleanup_thread = std::this_thread::get_id();
+    cleaned        = true;
+  })));
+  EXPECT_TRUE(cleaned);
+  EXPECT_NE(cleanup_thread, std::this_thread::get_id());
+  EXPECT_EQ(c.channel, "value");
+  EXPECT_EQ(c.value, 42);
+
+  // Nested adapters run their cleanups innermost first.
+  std::string log;
+  c = wait(deferral::let_defer(
+      deferral::let_defer_fail(JustError{"inner"}, pool.run([&]() { log += "fail;"; })),
+      pool.run([&]() { log += "exit;"; })));
+  EXPECT_EQ(c.channel, "error");
+  EXPECT_EQ(c.error, "inner");
+  EXPECT_EQ(log, "fail;exit;");
+}
+
+TEST(DeferralExecutionTest, TestCleanupErrorReplacesCompletion) {
+  Completion c = wait(deferral::let_defer(Just<int>{1}, JustError{"cleanup failed"}));
+  EXPECT_EQ(c.channel, "error");
+  EXPECT_EQ(c.error, "cleanup failed");
+}
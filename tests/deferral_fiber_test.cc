@@ -0,0 +1,78 @@
+#include "deferral.hh"
+#include "deferral_fiber.hh"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+ucontext_t main_context;
+ucontext_t fiber_context;
+deferral::fiber::ExceptionState main_exceptions;
+deferral::fiber::ExceptionState fiber_exceptions;
+char fiber_stack[256 * 1024];
+
+int fail_count    = 0;
+int success_count = 0;
+
+void fiber_main() {
+  {
+    defer_fail { ++fail_count; };
+    defer_success { ++success_count; };
+
+    // Suspend; the main fiber resumes this one while it is unwinding an exception.
+    deferral::fiber::swap_context(&fiber_context, fiber_exceptions, &main_context, main_exceptions);
+  }
+  deferral::fiber::swap_context(&fiber_context, fiber_exceptions, &main_context, main_exceptions);
+}
+
+struct ResumeFiberOnUnwind {
+  ~ResumeFiberOnUnwind() {
+    EXPECT_EQ(deferral::internal::uncaught_exceptions(), 1);
+    deferral::fiber::swap_context(&main_context, main_exceptions, &fiber_context, fiber_exceptions);
+    EXPECT_EQ(deferral::internal::uncaught_exceptions(), 1);
+  }
+};
+
+struct CountSource {
+  static int count;
+  static int uncaught_exceptions() noexcept { return count; }
+};
+int CountSource::count = 0;
+
+} // namespace
+
+TEST(DeferralFiberTest, TestSwapContextKeepsExceptionStatePerFiber) {
+  fail_count    = 0;
+  success_count = 0;
+
+  getcontext(&fiber_context);
+  fiber_context.uc_stack.ss_sp   = fiber_stack;
+  fiber_context.uc_stack.ss_size = sizeof(fiber_stack);
+  fiber_context.uc_link          = nullptr;
+  makecontext(&fiber_context, fiber_main, 0);
+
+  deferral::fiber::swap_context(&main_context, main_exceptions, &fiber_context, fiber_exceptions);
+  try {
+    ResumeFiberOnUnwind resume;
+    throw 0;
+  } catch(...) {}
+
+  // The fiber's scope exited normally, although this thread was unwinding when it ran.
+  EXPECT_EQ(fail_count, 0);
+  EXPECT_EQ(success_count, 1);
+  EXPECT_EQ(deferral::internal::uncaught_exceptions(), 0);
+}
+
+TEST(DeferralFiberTest, TestExceptionSource) {
+  int x = 0;
+  int y = 0;
+  CountSource::count = 2;
+  {
+    auto f = deferral::make_defer_with(
+        deferral::FailPolicy<CountSource>{}, [&]() noexcept { x = 1; });
+    defer_with(deferral::SuccessPolicy<CountSource>{}) { y = 1; };
+    CountSource::count = 3;
+  }
+  EXPECT_EQ(x, 1);
+  EXPECT_EQ(y, 0);
+}
@@ -0,0 +1,120 @@
+#include "deferral_fpenv.hh"
+
+#include <gtest/gtest.h>
+
+#include <cfenv>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace {
+
+// Kept out of line and fed through volatiles, so that nothing is folded at compile time with the
+// default rounding mode.
+__attribute__((noinline)) float multiply(float a, float b) {
+  volatile float x = a;
+  volatile float y = b;
+  return x * y;
+}
+
+__attribute__((noinline)) float divide(float a, float b) {
+  volatile float x = a;
+  volatile float y = b;
+  return x / y;
+}
+
+// The rounding mode of SSE arithmetic, from the rounding of 1/3 and -1/3. On x86, `fegetround()`
+// reports the x87 mode instead.
+int rounding_mode() {
+  const float hi = 1.0f / 3.0f; // rounded to nearest, above 1/3
+  const float lo = std::nextafter(hi, 0.0f);
+  const float a  = divide(1.0f, 3.0f);
+  const float b  = divide(-1.0f, 3.0f);
+  if(a == hi && b == -hi) { return FE_TONEAREST; }
+  if(a == lo && b == -hi) { return FE_DOWNWARD; }
+  if(a == hi && b == -lo) { return FE_UPWARD; }
+  if(a == lo && b == -lo) { return FE_TOWARDZERO; }
+  return -1;
+}
+
+void throw_with_flush() {
+  deferral::DeferFloatMode ftz{deferral::FloatMode::flush_denormals()};
+  throw std::runtime_error("kernel failed");
+}
+
+} // namespace
+
+static_assert(std::is_nothrow_move_constructible<deferral::DeferFloatMode>::value, "");
+static_assert(!std::is_copy_constructible<deferral::DeferFloatMode>::value, "");
+
+TEST(DeferralFpenvTest, TestFlushDenormals) {
+  if(!deferral::FloatMode::flush_denormals_supported()) { GTEST_SKIP(); }
+  const float denormal = FLT_MIN / 4;
+  EXPECT_GT(multiply(denormal, 1.0f), 0.0f);
+  {
+    deferral::DeferFloatMode ftz{deferral::FloatMode::flush_denormals()};
+    EXPECT_EQ(multiply(denormal, 1.0f), 0.0f);
+    EXPECT_EQ(multiply(FLT_MIN, 0.25f), 0.0f);
+    {
+      // Already in effect: nothing is written, and nothing restored.
+      deferral::DeferFloatMode again{deferral::FloatMode::flush_denormals()};
+      EXPECT_EQ(multiply(denormal, 1.0f), 0.0f);
+    }
+    EXPECT_EQ(multiply(denormal, 1.0f), 0.0f);
+  }
+  EXPECT_GT(multiply(denormal, 1.0f), 0.0f);
+
+  EXPECT_THROW(throw_with_flush(), std::runtime_error);
+  EXPECT_GT(multiply(denormal, 1.0f), 0.0f);
+}
+
+TEST(DeferralFpenvTest, TestRounding) {
+  ASSERT_EQ(rounding_mode(), FE_TONEAREST);
+  {
+    deferral::DeferFloatMode down{deferral::FloatMode::round_down()};
+    EXPECT_EQ(rounding_mode(), FE_DOWNWARD);
+    {
+      deferral::DeferFloatMode up{deferral::FloatMode::round_up()};
+      EXPECT_EQ(rounding_mode(), FE_UPWARD);
+    }
+    EXPECT_EQ(rounding_mode(), FE_DOWNWARD);
+  }
+  EXPECT_EQ(rounding_mode(), FE_TONEAREST);
+}
+
+TEST(DeferralFpenvTest, TestCombineAndRelease) {
+  constexpr auto mode =
+      deferral::FloatMode::round_up() | deferral::FloatMode::round_toward_zero();
+  {
+    deferral::DeferFloatMode g{mode};
+    EXPECT_EQ(rounding_mode(), FE_TOWARDZERO);
+    auto moved = std::move(g);
+    EXPECT_EQ(rounding_mode(), FE_TOWARDZERO);
+  }
+  EXPECT_EQ(rounding_mode(), FE_TONEAREST);
+
+  {
+    auto g = deferral::make_defer_float_mode(deferral::FloatMode::round_toward_zero());
+    g.release();
+  }
+  EXPECT_EQ(rounding_mode(), FE_TOWARDZERO);
+  {
+    deferral::DeferFloatMode nearest{deferral::FloatMode::round_nearest()};
+    nearest.release();
+  }
+  EXPECT_EQ(rounding_mode(), FE_TONEAREST);
+}
+
+TEST(DeferralFpenvTest, TestExceptionFlagsKept) {
+  std::feclearexcept(FE_ALL_EXCEPT);
+  {
+    deferral::DeferFloatMode down{deferral::FloatMode::round_down()};
+    EXPECT_TRUE(std::isinf(divide(1.0f, 0.0f)));
+    EXPECT_TRUE(std::fetestexcept(FE_DIVBYZERO));
+  }
+  EXPECT_EQ(rounding_mode(), FE_TONEAREST);
+  EXPECT_TRUE(std::fetestexcept(FE_DIVBYZERO));
+  std::feclearexcept(FE_ALL_EXCEPT);
+}
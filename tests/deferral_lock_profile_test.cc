@@ -0,0 +1,181 @@
+#include "deferral_lock_profile.hh"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace profile = deferral::profile;
+
+namespace {
+
+// A mutex that counts its calls.
+struct CountingMutex {
+  int locks   = 0;
+  int unlocks = 0;
+  bool held   = false;
+
+  void lock() {
+    ++locks;
+    held = true;
+  }
+  bool try_lock() {
+    if(held) { return false; }
+    lock();
+    return true;
+  }
+  void unlock() {
+    ++unlocks;
+    held = false;
+  }
+};
+
+void spin_for(std::chrono::microseconds d) {
+  const auto until = std::chrono::steady_clock::now() + d;
+  while(std::chrono::steady_clock::now() < until) {}
+}
+
+const profile::LockSiteReport* find(
+    const std::vector<profile::LockSiteReport>& r, const char* name) {
+  for(const auto& s : r) {
+    if(std::strcmp(s.name, name) == 0) { return &s; }
+  }
+  return nullptr;
+}
+
+// Takes a profiled lock in its destructor, at thread exit.
+struct LockAtExit {
+  std::mutex* m;
+  ~LockAtExit() { DEFER_PROFILE_LOCK("at.exit", *m); }
+};
+
+} // namespace
+
+static_assert(!std::is_copy_constructible<profile::ProfiledLock<std::mutex>>::value, "");
+static_assert(!std::is_copy_constructible<profile::PlainLock<std::mutex>>::value, "");
+
+TEST(DeferralLockProfileTest, TestLockUnlock) {
+  CountingMutex m;
+  {
+    DEFER_PROFILE_LOCK("lock.unlock", m);
+    EXPECT_EQ(m.locks, 1);
+    EXPECT_EQ(m.unlocks, 0);
+  }
+  EXPECT_EQ(m.unlocks, 1);
+
+  {
+    profile::PlainLock<CountingMutex> g{m};
+    EXPECT_EQ(m.locks, 2);
+  }
+  EXPECT_EQ(m.unlocks, 2);
+
+  {
+    // A released guard leaves the mutex locked.
+    defer_profile_lock("lock.release", m);
+    static profile::LockSite site{"lock.named", __FILE__, __LINE__};
+    CountingMutex other;
+    profile::ProfiledLock<CountingMutex> g{site, other};
+    g.release();
+    EXPECT_TRUE(other.held);
+  }
+  EXPECT_EQ(m.unlocks, 3);
+}
+
+// Bucket 0 is zero, bucket i > 0 is [2^(i-1), 2^i) ns, and the last bucket takes the rest.
+TEST(DeferralLockProfileTest, TestBuckets) {
+  using profile::internal::lock_bucket;
+  EXPECT_EQ(lock_bucket(0), 0u);
+  EXPECT_EQ(lock_bucket(1), 1u);
+  EXPECT_EQ(lock_bucket(2), 2u);
+  EXPECT_EQ(lock_bucket(3), 2u);
+  EXPECT_EQ(lock_bucket(4), 3u);
+  EXPECT_EQ(lock_bucket(1000), 10u);
+  EXPECT_EQ(lock_bucket(std::uint64_t{1} << 46), profile::internal::lock_buckets - 1);
+  EXPECT_EQ(lock_bucket(~std::uint64_t{0}), profile::internal::lock_buckets - 1);
+}
+
+TEST(DeferralLockProfileTest, TestUncontended) {
+  std::mutex m;
+  for(int i = 0; i < 100; ++i) {
+    DEFER_PROFILE_LOCK("uncontended", m);
+    spin_for(std::chrono::microseconds(10));
+  }
+
+  const auto r  = profile::lock_report();
+  const auto* s = find(r, "uncontended");
+  ASSERT_NE(s, nullptr);
+  EXPECT_STREQ(s->file, __FILE__);
+  EXPECT_EQ(s->acquisitions, 100u);
+  EXPECT_EQ(s->contended, 0u);
+  EXPECT_EQ(s->wait_total_ns, 0u);
+  EXPECT_EQ(s->wait_histogram[0], 100u);
+  EXPECT_EQ(s->wait_p99_ns, 0u);
+  EXPECT_GE(s->hold_total_ns, 100u * 10000u);
+  EXPECT_GE(s->hold_p50_ns, 10000u);
+  std::uint64_t holds = 0;
+  for(auto n : s->hold_histogram) { holds += n; }
+  EXPECT_EQ(holds, 100u);
+}
+
+TEST(DeferralLockProfileTest, TestContendedFirst) {
+  std::mutex quiet, busy;
+  for(int i = 0; i < 10; ++i) { DEFER_PROFILE_LOCK("quiet", quiet); }
+
+  // The threads start while the lock is held, so each of them waits at least once.
+  std::atomic<int> started{0};
+  std::vector<std::thread> threads;
+  {
+    std::lock_guard<std::mutex> hold{busy};
+    for(int t = 0; t < 4; ++t) {
+      threads.emplace_back([&]() {
+        ++started;
+        for(int i = 0; i < 20; ++i) { DEFER_PROFILE_LOCK("busy", busy); }
+      });
+    }
+    while(started < 4) { std::this_thread::yield(); }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  for(auto& t : threads) { t.join(); }
+
+  // The threads have exited, so their counts come from the merged table.
+  const auto r = profile::lock_report();
+  ASSERT_GE(r.size(), 2u);
+  EXPECT_STREQ(r[0].name, "busy");
+  for(std::size_t i = 1; i < r.size(); ++i) {
+    EXPECT_GE(r[i - 1].wait_total_ns, r[i].wait_total_ns);
+  }
+  const auto* s = find(r, "busy");
+  ASSERT_NE(s, nullptr);
+  EXPECT_EQ(s->acquisitions, 80u);
+  EXPECT_GE(s->contended, 4u);
+  EXPECT_GE(s->wait_max_ns, 1000000u);
+  EXPECT_GE(s->wait_max_ns, s->wait_p99_ns / 2);
+  EXPECT_EQ(find(r, "quiet")->acquisitions, 10u);
+}
+
+TEST(DeferralLockProfileTest, TestLockAfterThreadExit) {
+  // Constructed before the first profiled lock of each thread, so destroyed after the table of
+  // the thread is merged: the locks still work, and are not recorded.
+  std::mutex m;
+  std::vector<std::thread> threads;
+  for(int t = 0; t < 4; ++t) {
+    threads.emplace_back([&]() {
+      static thread_local LockAtExit at_exit{&m};
+      DEFER_PROFILE_LOCK("before.exit", m);
+    });
+  }
+  for(auto& t : threads) { t.join(); }
+
+  const auto r = profile::lock_report();
+  ASSERT_NE(find(r, "before.exit"), nullptr);
+  EXPECT_EQ(find(r, "before.exit")->acquisitions, 4u);
+  const auto* s = find(r, "at.exit");
+  if(s != nullptr) { EXPECT_EQ(s->acquisitions, 0u); }
+  EXPECT_TRUE(m.try_lock());
+  m.unlock();
+}
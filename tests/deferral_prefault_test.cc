@@ -0,0 +1,109 @@
+#include "deferral_prefault.hh"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstring>
+#include <sys/mman.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const std::size_t kPage = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+
+// A private anonymous mapping, unmapped at the end of the test.
+struct Mapping {
+  std::size_t size;
+  unsigned char* data;
+
+  explicit Mapping(std::size_t pages) :
+      size{pages * kPage},
+      data{static_cast<unsigned char*>(
+          mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))} {}
+  ~Mapping() { munmap(data, size); }
+
+  // The number of resident pages in [first, first + count).
+  std::size_t resident(std::size_t first, std::size_t count) const {
+    std::vector<unsigned char> vec(count);
+    mincore(data + first * kPage, count * kPage, vec.data());
+    std::size_t n = 0;
+    for(unsigned char v : vec) { n += v & 1; }
+    return n;
+  }
+};
+
+} // namespace
+
+static_assert(std::is_nothrow_move_constructible<deferral::DeferPrefault>::value, "");
+static_assert(!std::is_copy_constructible<deferral::DeferPrefault>::value, "");
+
+TEST(DeferralPrefaultTest, TestPopulateKeep) {
+  Mapping m{64};
+  ASSERT_NE(m.data, MAP_FAILED);
+  EXPECT_EQ(m.resident(0, 64), 0u);
+  {
+    deferral::DeferPrefault g{m.data, m.size};
+    EXPECT_FALSE(g.locked());
+    EXPECT_EQ(m.resident(0, 64), 64u);
+  }
+  EXPECT_EQ(m.resident(0, 64), 64u);
+}
+
+TEST(DeferralPrefaultTest, TestDontNeed) {
+  Mapping m{64};
+  ASSERT_NE(m.data, MAP_FAILED);
+  {
+    deferral::DeferPrefault g{
+        m.data, m.size, deferral::Prefault::populate, deferral::PageRelease::dont_need};
+    std::memset(m.data, 0xab, m.size);
+    EXPECT_EQ(m.resident(0, 64), 64u);
+  }
+  EXPECT_EQ(m.resident(0, 64), 0u);
+  EXPECT_EQ(m.data[0], 0);
+}
+
+TEST(DeferralPrefaultTest, TestPartialPagesKept) {
+  // The range starts and ends in the middle of a page; those two pages hold other data and are
+  // faulted in, but not given back.
+  Mapping m{8};
+  ASSERT_NE(m.data, MAP_FAILED);
+  m.data[0]          = 1;
+  m.data[m.size - 1] = 2;
+  {
+    deferral::DeferPrefault g{m.data + kPage / 2, m.size - kPage, deferral::Prefault::populate,
+        deferral::PageRelease::dont_need};
+    EXPECT_EQ(m.resident(0, 8), 8u);
+  }
+  EXPECT_EQ(m.data[0], 1);
+  EXPECT_EQ(m.data[m.size - 1], 2);
+  EXPECT_EQ(m.resident(0, 1), 1u);
+  EXPECT_EQ(m.resident(1, 6), 0u);
+  EXPECT_EQ(m.resident(7, 1), 1u);
+}
+
+TEST(DeferralPrefaultTest, TestLockFreeRelease) {
+  Mapping m{16};
+  ASSERT_NE(m.data, MAP_FAILED);
+  {
+    // Falls back to populating if the lock is refused.
+    deferral::DeferPrefault g{
+        m.data, m.size, deferral::Prefault::lock, deferral::PageRelease::free};
+    EXPECT_EQ(m.resident(0, 16), 16u);
+    deferral::DeferPrefault moved{std::move(g)};
+    EXPECT_EQ(moved.locked(), g.locked());
+  }
+  {
+    deferral::DeferPrefault g{m.data, m.size, deferral::Prefault::populate,
+        deferral::PageRelease::dont_need};
+    g.release();
+  }
+  EXPECT_EQ(m.resident(0, 16), 16u);
+  {
+    deferral::DeferPrefault g{m.data, 0, deferral::Prefault::lock, deferral::PageRelease::dont_need};
+    EXPECT_FALSE(g.locked());
+  }
+  EXPECT_EQ(m.resident(0, 16), 16u);
+}
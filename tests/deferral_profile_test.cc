@@ -0,0 +1,133 @@
+#include "deferral_profile.hh"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace profile = deferral::profile;
+
+namespace {
+
+__attribute__((noinline)) void cheap(int& n) {
+  DEFER_PROFILE("cheap") { ++n; };
+}
+
+__attribute__((noinline)) void expensive(int& n) {
+  DEFER_PROFILE("expensive") { ++n; };
+  const auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+  while(std::chrono::steady_clock::now() < until) {}
+}
+
+__attribute__((noinline)) void counted(int& n) {
+  defer_profile("counted") { ++n; };
+}
+
+// Sets the sampling period, then runs one span so that a thread that has not sampled before has
+// seeded its generator, and clears the samples.
+void start_profiling(std::uint32_t period) {
+  profile::set_sample_period(period);
+  int n = 0;
+  cheap(n);
+  profile::set_sample_period(period);
+  profile::reset();
+}
+
+const profile::SiteReport* find(const std::vector<profile::SiteReport>& r, const char* name) {
+  for(const auto& s : r) {
+    if(std::strcmp(s.name, name) == 0) { return &s; }
+  }
+  return nullptr;
+}
+
+} // namespace
+
+TEST(DeferralProfileTest, TestRunsCleanup) {
+  int n = 0;
+  {
+    DEFER_PROFILE("cleanup") { ++n; };
+    EXPECT_EQ(n, 0);
+  }
+  EXPECT_EQ(n, 1);
+}
+
+TEST(DeferralProfileTest, TestEverySpan) {
+  start_profiling(1);
+  int n = 0;
+  for(int i = 0; i < 1000; ++i) { counted(n); }
+  EXPECT_EQ(n, 1000);
+
+  const auto r  = profile::report();
+  const auto* s = find(r, "counted");
+  ASSERT_NE(s, nullptr);
+  EXPECT_EQ(s->samples, 1000u);
+  EXPECT_EQ(s->estimated_calls, 1000u);
+  EXPECT_STREQ(s->file, __FILE__);
+  EXPECT_GT(s->line, 0u);
+  EXPECT_LE(s->p50_ns, s->p99_ns);
+
+  profile::reset();
+  EXPECT_EQ(find(profile::report(), "counted"), nullptr);
+  profile::set_sample_period(1000);
+}
+
+TEST(DeferralProfileTest, TestEstimate) {
+  start_profiling(10);
+  EXPECT_EQ(profile::sample_period(), 10u);
+  int n = 0;
+  for(int i = 0; i < 100000; ++i) { counted(n); }
+
+  const auto* s = find(profile::report(), "counted");
+  ASSERT_NE(s, nullptr);
+  EXPECT_NEAR(static_cast<double>(s->samples), 10000.0, 1000.0);
+  EXPECT_EQ(s->estimated_calls, 10 * s->samples);
+  EXPECT_NEAR(static_cast<double>(s->estimated_calls), 100000.0, 10000.0);
+  profile::set_sample_period(1000);
+}
+
+TEST(DeferralProfileTest, TestRanking) {
+  start_profiling(4);
+  int n = 0;
+  for(int i = 0; i < 2000; ++i) {
+    cheap(n);
+    cheap(n);
+    expensive(n);
+  }
+
+  const auto r = profile::report();
+  ASSERT_GE(r.size(), 2u);
+  EXPECT_STREQ(r[0].name, "expensive");
+  for(std::size_t i = 1; i < r.size(); ++i) {
+    EXPECT_GE(r[i - 1].estimated_total_ns, r[i].estimated_total_ns);
+  }
+  const auto* e = find(r, "expensive");
+  const auto* c = find(r, "cheap");
+  ASSERT_NE(e, nullptr);
+  ASSERT_NE(c, nullptr);
+  EXPECT_GE(e->p50_ns, 20000u);
+  EXPECT_GT(c->estimated_calls, e->estimated_calls);
+  profile::set_sample_period(1000);
+}
+
+TEST(DeferralProfileTest, TestThreads) {
+  start_profiling(1);
+  std::vector<std::thread> threads;
+  int counts[4] = {};
+  for(int t = 0; t < 4; ++t) {
+    threads.emplace_back([&counts, t]() {
+      // The first span of a thread seeds its generator and is not sampled.
+      for(int i = 0; i < 1001; ++i) { counted(counts[t]); }
+    });
+  }
+  for(auto& t : threads) { t.join(); }
+
+  const auto* s = find(profile::report(), "counted");
+  ASSERT_NE(s, nullptr);
+  EXPECT_EQ(s->samples, 4000u);
+  for(int c : counts) { EXPECT_EQ(c, 1001); }
+  profile::set_sample_period(1000);
+}
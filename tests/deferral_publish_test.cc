@@ -0,0 +1,171 @@
+#include "deferral_publish.hh"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// A version that counts live instances, to detect leaks.
+struct Table {
+  static int live;
+
+  std::map<int, int> routes;
+  int version{0};
+
+  Table() { ++live; }
+  Table(const Table& other) : routes(other.routes), version{other.version + 1} { ++live; }
+  ~Table() { --live; }
+};
+
+int Table::live = 0;
+
+// Deletes reclaimed versions at the end of the test rather than at once.
+struct Retired {
+  std::vector<Table*> tables;
+
+  ~Retired() {
+    for(Table* t : tables) { delete t; }
+  }
+};
+
+struct Retire {
+  Retired* retired;
+  void operator()(Table* old) const noexcept { retired->tables.push_back(old); }
+};
+
+using Publish = deferral::DeferPublish<Table, Retire>;
+
+// A callback whose move constructor throws once `armed` is set.
+struct ThrowOnMove {
+  bool* armed;
+
+  explicit ThrowOnMove(bool* a) noexcept : armed{a} {}
+  ThrowOnMove(const ThrowOnMove&) = default;
+  ThrowOnMove(ThrowOnMove&& other) : armed{other.armed} {
+    if(*armed) { throw std::runtime_error("move"); }
+  }
+  void operator()(Table* old) const noexcept { delete old; }
+};
+
+using ThrowingPublish = deferral::DeferPublish<Table, ThrowOnMove>;
+
+} // namespace
+
+static_assert(std::is_nothrow_move_constructible<Publish>::value, "");
+static_assert(!std::is_copy_constructible<Publish>::value, "");
+static_assert(!std::is_nothrow_move_constructible<ThrowingPublish>::value, "");
+
+TEST(DeferralPublishTest, TestPublishOnSuccess) {
+  Retired retired;
+  Table* const first = new Table{};
+  std::atomic<Table*> shared{first};
+  {
+    auto next = deferral::make_defer_publish(shared, Retire{&retired});
+    next->routes[1] = 10;
+    EXPECT_EQ(next->version, 1);
+    EXPECT_EQ(shared.load(), first);
+    EXPECT_TRUE(shared.load()->routes.empty());
+  }
+  ASSERT_NE(shared.load(), first);
+  EXPECT_EQ(shared.load()->routes.at(1), 10);
+  ASSERT_EQ(retired.tables.size(), 1u);
+  EXPECT_EQ(retired.tables[0], first);
+  delete shared.load();
+}
+
+TEST(DeferralPublishTest, TestDiscardOnFailure) {
+  const int live = Table::live;
+  Retired retired;
+  Table* const first = new Table{};
+  std::atomic<Table*> shared{first};
+  try {
+    auto next = deferral::make_defer_publish(shared, Retire{&retired});
+    next->routes[1] = 10;
+    throw std::runtime_error("fail");
+  } catch(const std::runtime_error&) {
+    EXPECT_EQ(shared.load(), first);
+    EXPECT_EQ(Table::live, live + 1);
+  }
+  EXPECT_TRUE(shared.load()->routes.empty());
+  EXPECT_TRUE(retired.tables.empty());
+  delete first;
+  EXPECT_EQ(Table::live, live);
+}
+
+// The callback is moved into the guard before the copy is made, so a throwing move leaks nothing.
+TEST(DeferralPublishTest, TestCallbackMoveThrows) {
+  const int live = Table::live;
+  bool armed     = false;
+  Table* const first = new Table{};
+  std::atomic<Table*> shared{first};
+  const ThrowOnMove reclaim{&armed};
+  armed = true;
+  EXPECT_THROW({ ThrowingPublish next(shared, reclaim); }, std::runtime_error);
+  EXPECT_EQ(shared.load(), first);
+  EXPECT_EQ(Table::live, live + 1);
+  delete first;
+}
+
+TEST(DeferralPublishTest, TestReleaseAndMove) {
+  const int live = Table::live;
+  Retired retired;
+  std::atomic<Table*> shared{new Table{}};
+  Table* const first = shared.load();
+  {
+    auto next = deferral::make_defer_publish(shared, Retire{&retired});
+    next.release();
+  }
+  EXPECT_EQ(shared.load(), first);
+  EXPECT_EQ(Table::live, live + 1);
+  {
+    auto next = deferral::make_defer_publish(shared, Retire{&retired});
+    Table* const copy = next.get();
+    Publish moved{std::move(next)};
+    EXPECT_EQ(next.get(), nullptr);
+    EXPECT_EQ(moved.get(), copy);
+  }
+  EXPECT_NE(shared.load(), first);
+  EXPECT_EQ(retired.tables.size(), 1u);
+  delete shared.load();
+}
+
+TEST(DeferralPublishTest, TestFirstPublish) {
+  Retired retired;
+  std::atomic<Table*> shared{nullptr};
+  Table* const first = new Table{};
+  { Publish init{shared, first, Retire{&retired}}; }
+  EXPECT_EQ(shared.load(), first);
+  EXPECT_TRUE(retired.tables.empty());
+  delete first;
+}
+
+TEST(DeferralPublishTest, TestReadersSeeWholeVersions) {
+  Retired retired;
+  std::atomic<Table*> shared{new Table{}};
+  std::atomic<bool> done{false};
+  std::thread reader{[&] {
+    int last = 0;
+    while(!done.load(std::memory_order_acquire)) {
+      const Table* t = shared.load(std::memory_order_acquire);
+      // Every published version holds one route per version.
+      EXPECT_EQ(static_cast<int>(t->routes.size()), t->version);
+      EXPECT_GE(t->version, last);
+      last = t->version;
+    }
+  }};
+  for(int i = 0; i < 200; ++i) {
+    auto next = deferral::make_defer_publish(shared, Retire{&retired});
+    next->routes[i] = i;
+  }
+  done.store(true, std::memory_order_release);
+  reader.join();
+  EXPECT_EQ(shared.load()->version, 200);
+  delete shared.load();
+}
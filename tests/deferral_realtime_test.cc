@@ -0,0 +1,123 @@
+#include "deferral_realtime.hh"
+
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct Scheduling {
+  int policy;
+  int priority;
+};
+
+Scheduling current_scheduling() {
+  Scheduling s{};
+  sched_param param{};
+  pthread_getschedparam(pthread_self(), &s.policy, &param);
+  s.priority = param.sched_priority;
+  return s;
+}
+
+cpu_set_t current_cpus() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+  return set;
+}
+
+} // namespace
+
+static_assert(std::is_nothrow_move_constructible<deferral::RealtimeSection>::value, "");
+static_assert(!std::is_copy_constructible<deferral::RealtimeSection>::value, "");
+
+TEST(DeferralRealtimeTest, TestUnchangedIsSkipped) {
+  const Scheduling before = current_scheduling();
+  const cpu_set_t cpus    = current_cpus();
+  {
+    deferral::RealtimeSection rt{
+        deferral::RealtimeConfig{}.cpus(cpus).scheduling(before.policy, before.priority)};
+    EXPECT_EQ(rt.applied(), 0u);
+    EXPECT_EQ(rt.error(), 0);
+  }
+  {
+    deferral::RealtimeSection rt{deferral::RealtimeConfig{}};
+    EXPECT_EQ(rt.applied(), 0u);
+  }
+  EXPECT_EQ(current_scheduling().policy, before.policy);
+}
+
+TEST(DeferralRealtimeTest, TestSchedulingRestored) {
+  // Switching between SCHED_OTHER and SCHED_BATCH needs no privileges.
+  const Scheduling before = current_scheduling();
+  ASSERT_EQ(before.policy, SCHED_OTHER);
+  {
+    deferral::RealtimeSection rt{deferral::RealtimeConfig{}.scheduling(SCHED_BATCH, 0)};
+    EXPECT_EQ(rt.applied(), deferral::RealtimeSection::scheduling);
+    EXPECT_EQ(current_scheduling().policy, SCHED_BATCH);
+  }
+  EXPECT_EQ(current_scheduling().policy, SCHED_OTHER);
+
+  // A released guard keeps the change.
+  {
+    deferral::RealtimeSection rt{deferral::RealtimeConfig{}.scheduling(SCHED_BATCH, 0)};
+    rt.release();
+  }
+  EXPECT_EQ(current_scheduling().policy, SCHED_BATCH);
+  {
+    deferral::RealtimeSection rt{deferral::RealtimeConfig{}.scheduling(SCHED_OTHER, 0)};
+    deferral::RealtimeSection moved{std::move(rt)};
+    EXPECT_EQ(moved.applied(), deferral::RealtimeSection::scheduling);
+    rt.release();
+    moved.release();
+  }
+  EXPECT_EQ(current_scheduling().policy, SCHED_OTHER);
+}
+
+TEST(DeferralRealtimeTest, TestFifoOrDegrade) {
+  // Without CAP_SYS_NICE or an RLIMIT_RTPRIO, the change fails with EPERM and is skipped.
+  const Scheduling before = current_scheduling();
+  {
+    deferral::RealtimeSection rt{deferral::RealtimeConfig{}.scheduling(SCHED_FIFO, 1)};
+    if(rt.applied() & deferral::RealtimeSection::scheduling) {
+      EXPECT_EQ(rt.error(), 0);
+      EXPECT_EQ(current_scheduling().policy, SCHED_FIFO);
+      EXPECT_EQ(current_scheduling().priority, 1);
+    } else {
+      EXPECT_EQ(rt.error(), EPERM);
+      EXPECT_EQ(current_scheduling().policy, before.policy);
+    }
+  }
+  EXPECT_EQ(current_scheduling().policy, before.policy);
+  EXPECT_EQ(current_scheduling().priority, before.priority);
+}
+
+TEST(DeferralRealtimeTest, TestAffinityAndMemory) {
+  const cpu_set_t before = current_cpus();
+  int first              = 0;
+  while(!CPU_ISSET(first, &before)) { ++first; }
+
+  std::vector<char> buffer(16 * 1024);
+  {
+    deferral::RealtimeSection rt{
+        deferral::RealtimeConfig{}.cpu(first).lock_memory(buffer.data(), buffer.size())};
+    if(CPU_COUNT(&before) > 1) {
+      EXPECT_TRUE(rt.applied() & deferral::RealtimeSection::affinity);
+      const cpu_set_t pinned = current_cpus();
+      EXPECT_EQ(CPU_COUNT(&pinned), 1);
+      EXPECT_TRUE(CPU_ISSET(first, &pinned));
+    } else {
+      EXPECT_FALSE(rt.applied() & deferral::RealtimeSection::affinity);
+    }
+    if(!(rt.applied() & deferral::RealtimeSection::memory)) {
+      EXPECT_TRUE(rt.error() == ENOMEM || rt.error() == EPERM);
+    }
+  }
+  const cpu_set_t after = current_cpus();
+  EXPECT_TRUE(CPU_EQUAL(&before, &after));
+}
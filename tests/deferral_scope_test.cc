@@ -0,0 +1,265 @@
+#include "deferral_scope.hh"
+
+#include <gtest/gtest.h>
+
+#include <type_traits>
+#include <utility>
+
+namespace {
+
+struct Count {
+  int* n;
+  void operator()() const noexcept { ++*n; }
+};
+
+struct Throwing {
+  void operator()() const {}
+};
+
+// A function object whose copy throws, and which cannot be moved without throwing either.
+struct ThrowOnCopy {
+  int* n;
+  explicit ThrowOnCopy(int* p) : n{p} {}
+  ThrowOnCopy(const ThrowOnCopy&) { throw 0; }
+  void operator()() const noexcept { ++*n; }
+};
+
+struct CountingDeleter {
+  int* n;
+  void operator()(int) const noexcept { ++*n; }
+};
+
+struct Resource {
+  int value;
+};
+
+struct ThrowOnCopyResource {
+  int value;
+  explicit ThrowOnCopyResource(int v) : value{v} {}
+  ThrowOnCopyResource(const ThrowOnCopyResource&) { throw 0; }
+  bool operator==(const ThrowOnCopyResource& other) const { return value == other.value; }
+};
+
+int deleted_value = 0;
+void record_delete(int v) noexcept {
+  deleted_value = v;
+}
+
+} // namespace
+
+// The guards and `unique_resource` are usable as members of a class with default visibility, at
+// namespace scope, without a -Wattributes visibility warning.
+struct ScopeMembers {
+  deferral::unique_resource<int, void (*)(int)> fd;
+  deferral::scope_exit<void (*)()> on_exit;
+  deferral::scope_fail<void (*)()> on_fail;
+  deferral::scope_success<void (*)()> on_success;
+};
+
+// The TS interface: class template argument deduction, non-copyable and non-assignable guards,
+// and the exception specifications of the destructors.
+static_assert(std::is_same<decltype(deferral::scope_exit{Count{nullptr}}),
+                  deferral::scope_exit<Count>>::value,
+    "");
+static_assert(!std::is_copy_constructible<deferral::scope_exit<Count>>::value, "");
+static_assert(!std::is_move_assignable<deferral::scope_exit<Count>>::value, "");
+static_assert(std::is_nothrow_move_constructible<deferral::scope_exit<Count>>::value, "");
+static_assert(std::is_nothrow_destructible<deferral::scope_exit<Throwing>>::value, "");
+static_assert(std::is_nothrow_destructible<deferral::scope_fail<Throwing>>::value, "");
+static_assert(!std::is_nothrow_destructible<deferral::scope_success<Throwing>>::value, "");
+static_assert(std::is_nothrow_destructible<deferral::scope_success<Count>>::value, "");
+static_assert(!std::is_constructible<deferral::scope_exit<Count&>, Count>::value,
+    "a reference exit function cannot bind to an rvalue");
+static_assert(
+    !std::is_nothrow_constructible<deferral::scope_exit<ThrowOnCopy>, ThrowOnCopy&>::value, "");
+static_assert(sizeof(deferral::scope_exit<Count>) == sizeof(deferral::DeferExit<Count>), "");
+static_assert(sizeof(deferral::scope_fail<Count>) == sizeof(deferral::DeferFail<Count>), "");
+static_assert(!std::is_copy_constructible<deferral::unique_resource<int, CountingDeleter>>::value,
+    "");
+static_assert(sizeof(deferral::unique_resource<int, void (*)(int)>) == 2 * sizeof(void*), "");
+
+TEST(DeferralScopeTest, TestScopeExit) {
+  int n = 0;
+  {
+    deferral::scope_exit g{Count{&n}};
+    EXPECT_EQ(n, 0);
+  }
+  EXPECT_EQ(n, 1);
+
+  try {
+    deferral::scope_exit g{Count{&n}};
+    throw 0;
+  } catch(...) {}
+  EXPECT_EQ(n, 2);
+
+  {
+    deferral::scope_exit g{Count{&n}};
+    g.release();
+  }
+  EXPECT_EQ(n, 2);
+}
+
+TEST(DeferralScopeTest, TestScopeFailSuccess) {
+  int fail    = 0;
+  int success = 0;
+  {
+    deferral::scope_fail f{Count{&fail}};
+    deferral::scope_success s{Count{&success}};
+  }
+  EXPECT_EQ(fail, 0);
+  EXPECT_EQ(success, 1);
+
+  try {
+    deferral::scope_fail f{Count{&fail}};
+    deferral::scope_success s{Count{&success}};
+    throw 0;
+  } catch(...) {}
+  EXPECT_EQ(fail, 1);
+  EXPECT_EQ(success, 1);
+
+  try {
+    deferral::scope_fail f{Count{&fail}};
+    f.release();
+    throw 0;
+  } catch(...) {}
+  EXPECT_EQ(fail, 1);
+}
+
+TEST(DeferralScopeTest, TestScopeGuardMove) {
+  int n = 0;
+  {
+    deferral::scope_exit g{Count{&n}};
+    deferral::scope_exit<Count> moved{std::move(g)};
+  }
+  EXPECT_EQ(n, 1);
+}
+
+TEST(DeferralScopeTest, TestScopeGuardReference) {
+  int n = 0;
+  int m = 0;
+  Count f{&n};
+  {
+    // The guard calls `f` itself, not a copy taken at construction.
+    deferral::scope_exit<Count&> g{f};
+    f.n = &m;
+  }
+  EXPECT_EQ(n, 0);
+  EXPECT_EQ(m, 1);
+}
+
+TEST(DeferralScopeTest, TestScopeGuardConstructorThrows) {
+  int n = 0;
+  ThrowOnCopy f{&n};
+  EXPECT_THROW(deferral::scope_exit<ThrowOnCopy>{f}, int);
+  EXPECT_EQ(n, 1);
+  EXPECT_THROW(deferral::scope_fail<ThrowOnCopy>{f}, int);
+  EXPECT_EQ(n, 2);
+  EXPECT_THROW(deferral::scope_success<ThrowOnCopy>{f}, int);
+  EXPECT_EQ(n, 2);
+}
+
+TEST(DeferralScopeTest, TestUniqueResource) {
+  int n = 0;
+  {
+    deferral::unique_resource r{7, CountingDeleter{&n}};
+    EXPECT_EQ(r.get(), 7);
+    EXPECT_EQ(r.get_deleter().n, &n);
+  }
+  EXPECT_EQ(n, 1);
+
+  {
+    deferral::unique_resource r{7, CountingDeleter{&n}};
+    r.release();
+  }
+  EXPECT_EQ(n, 1);
+
+  {
+    deferral::unique_resource<int, CountingDeleter> r;
+    EXPECT_EQ(r.get(), 0);
+  }
+  EXPECT_EQ(n, 1);
+}
+
+TEST(DeferralScopeTest, TestUniqueResourceReset) {
+  deleted_value = 0;
+  {
+    deferral::unique_resource r{1, &record_delete};
+    r.reset(2);
+    EXPECT_EQ(deleted_value, 1);
+    EXPECT_EQ(r.get(), 2);
+    r.reset();
+    EXPECT_EQ(deleted_value, 2);
+    deleted_value = 0;
+  }
+  EXPECT_EQ(deleted_value, 0);
+}
+
+TEST(DeferralScopeTest, TestUniqueResourceMove) {
+  deleted_value = 0;
+  {
+    deferral::unique_resource a{1, &record_delete};
+    auto b = std::move(a);
+    EXPECT_EQ(b.get(), 1);
+    EXPECT_EQ(deleted_value, 0);
+
+    deferral::unique_resource c{2, &record_delete};
+    c = std::move(b);
+    EXPECT_EQ(deleted_value, 2);
+    EXPECT_EQ(c.get(), 1);
+    deleted_value = 0;
+  }
+  EXPECT_EQ(deleted_value, 1);
+}
+
+TEST(DeferralScopeTest, TestUniqueResourcePointerAndReference) {
+  Resource res{5};
+  int n = 0;
+  {
+    auto deleter = [&n](Resource* p) { n += p->value; };
+    deferral::unique_resource r{&res, deleter};
+    EXPECT_EQ((*r).value, 5);
+    EXPECT_EQ(r->value, 5);
+  }
+  EXPECT_EQ(n, 5);
+
+  {
+    auto deleter = [&n](Resource& x) { n += x.value; };
+    deferral::unique_resource<Resource&, decltype(deleter)> r{res, deleter};
+    res.value = 6;
+    EXPECT_EQ(&r.get(), &res);
+  }
+  EXPECT_EQ(n, 11);
+}
+
+TEST(DeferralScopeTest, TestMakeUniqueResourceChecked) {
+  deleted_value = 0;
+  {
+    auto r = deferral::make_unique_resource_checked(-1, -1, &record_delete);
+  }
+  EXPECT_EQ(deleted_value, 0);
+  {
+    auto r = deferral::make_unique_resource_checked(3, -1, &record_delete);
+  }
+  EXPECT_EQ(deleted_value, 3);
+}
+
+TEST(DeferralScopeTest, TestUniqueResourceConstructorThrows) {
+  int n = 0;
+  ThrowOnCopyResource res{1};
+  auto deleter = [&n](const ThrowOnCopyResource& x) { n += x.value; };
+  using resource_t = deferral::unique_resource<ThrowOnCopyResource, decltype(deleter)>;
+  EXPECT_THROW((resource_t{res, deleter}), int);
+  EXPECT_EQ(n, 1);
+}
+
+TEST(DeferralScopeTest, TestUniqueResourceCheckedConstructorThrows) {
+  // The deleter is never called on an invalid resource, even when storing it throws.
+  int n = 0;
+  auto deleter = [&n](const ThrowOnCopyResource& x) { n += x.value; };
+  const ThrowOnCopyResource invalid{-1};
+  EXPECT_THROW(deferral::make_unique_resource_checked(invalid, invalid, deleter), int);
+  EXPECT_EQ(n, 0);
+  const ThrowOnCopyResource valid{2};
+  EXPECT_THROW(deferral::make_unique_resource_checked(valid, invalid, deleter), int);
+  EXPECT_EQ(n, 2);
+}
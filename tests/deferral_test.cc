@@ -173,6 +173,312 @@ TEST_F(DeferralTest, TestTypeDeductionGuidesWithThrow) {
 
 #endif // __cplusplus >= 201703L
 
+TEST_F(DeferralTest, TestDeferCapture) {
+  int x = 0;
+  int y = 1;
+  {
+    defer_capture(&x, y) { x = y; };
+    y = 2;
+    EXPECT_EQ(x, 0);
+  }
+  EXPECT_EQ(x, 1);
+}
+
+namespace {
+
+void add_to(int* target, int a, int b) {
+  *target += a + b;
+}
+
+struct PlainCall {
+  int* target;
+  int a;
+  int b;
+  void (*func)(int*, int, int);
+};
+
+} // namespace
+
+TEST_F(DeferralTest, TestDeferCall) {
+  int x = 0;
+  {
+    int a  = 1;
+    auto d = deferral::defer_call(&add_to, &x, a, 2);
+    a      = 10;
+    EXPECT_EQ(x, 0);
+  }
+  EXPECT_EQ(x, 3);
+
+  try {
+    auto d = deferral::defer_call([](int* t, int v) { *t = v; }, &x, 5);
+    throw 0;
+  } catch(...) {}
+  EXPECT_EQ(x, 5);
+
+  {
+    auto d = deferral::defer_call(&add_to, &x, 1, 1);
+    d.release();
+  }
+  EXPECT_EQ(x, 5);
+
+  using bound_t = deferral::internal::bound_call_t<void (*)(int*, int, int), int*, int, int>;
+  static_assert(sizeof(bound_t) == sizeof(PlainCall), "bound arguments are laid out like a struct");
+}
+
+TEST_F(DeferralTest, TestRearmableExit) {
+  int x = 0;
+  {
+    auto g = deferral::make_rearmable_exit([&]() { ++x; });
+    for(int i = 0; i < 3; ++i) {
+      g.arm();
+      g.disarm();
+    }
+    EXPECT_EQ(x, 0);
+    g.arm();
+  }
+  EXPECT_EQ(x, 1);
+
+  {
+    auto g = deferral::make_rearmable_exit([&]() { ++x; });
+    g.disarm();
+  }
+  EXPECT_EQ(x, 1);
+}
+
+TEST_F(DeferralTest, TestRearmableFailSuccessThrow) {
+  int x = 0;
+  int y = 0;
+  int i = 0;
+  try {
+    auto f = deferral::make_rearmable_fail([&]() noexcept { x = i; });
+    auto s = deferral::make_rearmable_success([&]() noexcept { y = 1; });
+    for(i = 0; i < 5; ++i) {
+      f.arm();
+      if(i == 3) throw 0;
+      f.disarm();
+    }
+  } catch(...) {}
+  EXPECT_EQ(x, 3);
+  EXPECT_EQ(y, 0);
+
+  {
+    auto f = deferral::make_rearmable_fail([&]() noexcept { x = -1; });
+    auto s = deferral::make_rearmable_success([&]() noexcept { y = 1; });
+    s.disarm();
+    s.arm();
+  }
+  EXPECT_EQ(x, 3);
+  EXPECT_EQ(y, 1);
+}
+
+namespace {
+
+struct SetTo {
+  int* target;
+  int value;
+  void operator()() const noexcept { *target = value; }
+};
+
+} // namespace
+
+TEST_F(DeferralTest, TestRearmableReset) {
+  int x = 0;
+  {
+    auto g = deferral::make_rearmable_exit(SetTo{&x, 1});
+    g.disarm();
+    g.reset(SetTo{&x, 2});
+  }
+  EXPECT_EQ(x, 2);
+
+  int a = 0;
+  int b = 0;
+  auto set = [](int* p) { return [p]() { *p = 1; }; };
+  {
+    auto g = deferral::make_rearmable_exit(set(&a));
+    g.reset(set(&b));
+  }
+  EXPECT_EQ(a, 0);
+  EXPECT_EQ(b, 1);
+}
+
+namespace {
+
+struct OnStatusPolicy {
+  static constexpr bool expect_execute{false};
+  static constexpr bool require_noexcept{false};
+
+  const int* status;
+
+  void release() noexcept { status = nullptr; }
+  bool should_execute() const noexcept { return status && *status != 0; }
+};
+
+struct OnFlagNoexceptPolicy {
+  static constexpr bool expect_execute{true};
+  static constexpr bool require_noexcept{true};
+
+  const bool* flag;
+  bool released;
+
+  void release() noexcept { released = true; }
+  bool should_execute() const noexcept { return !released && *flag; }
+};
+
+} // namespace
+
+static_assert(deferral::internal::is_policy<OnStatusPolicy>(nullptr), "");
+static_assert(!deferral::internal::is_policy<int>(nullptr), "");
+#if defined(__cpp_concepts) && __cpp_concepts >= 201907L
+static_assert(deferral::Policy<OnStatusPolicy>);
+static_assert(!deferral::Policy<int>);
+#endif
+
+TEST_F(DeferralTest, TestDeferWith) {
+  int x      = 0;
+  int status = 0;
+  {
+    defer_with(OnStatusPolicy{&status}) { x = 1; };
+  }
+  EXPECT_EQ(x, 0);
+
+  {
+    defer_with(OnStatusPolicy{&status}) { x = 1; };
+    status = 5;
+  }
+  EXPECT_EQ(x, 1);
+
+  {
+    defer_with_(d, OnStatusPolicy{&status}) { x = 2; };
+    d.release();
+  }
+  EXPECT_EQ(x, 1);
+
+  bool flag = true;
+  {
+    defer_with_(d, OnFlagNoexceptPolicy{&flag, false}) { x = 3; };
+    using guard_t = decltype(d);
+    static_assert(noexcept(d.~guard_t()), "require_noexcept makes the deferred code noexcept");
+  }
+  EXPECT_EQ(x, 3);
+
+  {
+    auto d = deferral::make_defer_with(OnStatusPolicy{&status}, [&]() { x = 4; });
+  }
+  EXPECT_EQ(x, 4);
+}
+
+TEST_F(DeferralTest, TestEmptyFunctionStorage) {
+  auto f = []() {};
+  auto d = deferral::make_defer_exit(f);
+  EXPECT_EQ(sizeof(d), sizeof(bool));
+}
+
+#if defined(DEFERRAL_HAS_CONSTEXPR_GUARDS)
+
+namespace {
+
+constexpr int constexpr_exit() {
+  int x = 0;
+  {
+    defer { x += 1; };
+    defer_(d) { x *= 10; };
+    auto e = deferral::make_defer_exit([&]() { x += 100; });
+    e.release();
+  }
+  return x;
+}
+
+constexpr int constexpr_fail_success() {
+  int x = 0;
+  {
+    defer_fail { x += 1; };
+    defer_success { x += 10; };
+  }
+  return x;
+}
+
+constexpr int constexpr_rearm() {
+  int x = 0;
+  {
+    auto g = deferral::make_rearmable_exit([&]() { ++x; });
+    g.disarm();
+    g.arm();
+  }
+  return x;
+}
+
+} // namespace
+
+TEST_F(DeferralTest, TestConstexpr) {
+  static_assert(constexpr_exit() == 1, "guards run in reverse order during constant evaluation");
+  static_assert(constexpr_fail_success() == 10, "no exception is in flight in constant evaluation");
+  static_assert(constexpr_rearm() == 1, "");
+  EXPECT_EQ(constexpr_exit(), 1);
+}
+
+#endif // defined(DEFERRAL_HAS_CONSTEXPR_GUARDS)
+
+#if defined(__cpp_nontype_template_parameter_auto)
+
+namespace {
+
+int closed_handle = 0;
+int close_count   = 0;
+
+int close_handle(int h) {
+  closed_handle = h;
+  ++close_count;
+  return 0;
+}
+
+} // namespace
+
+TEST_F(DeferralTest, TestDeferFn) {
+  closed_handle = 0;
+  close_count   = 0;
+  {
+    int h  = 42;
+    auto d = deferral::defer_fn<&close_handle>(h);
+    h      = 7;
+    EXPECT_EQ(close_count, 0);
+  }
+  EXPECT_EQ(closed_handle, 42);
+  EXPECT_EQ(close_count, 1);
+
+  static_assert(sizeof(deferral::DeferFn<&close_handle, int>) == 2 * sizeof(int),
+      "DeferFn stores only the argument and the active flag");
+}
+
+TEST_F(DeferralTest, TestDeferFnThrow) {
+  closed_handle = 0;
+  close_count   = 0;
+  try {
+    auto d = deferral::defer_fn<&close_handle>(3);
+    throw 0;
+  } catch(...) {}
+  EXPECT_EQ(closed_handle, 3);
+  EXPECT_EQ(close_count, 1);
+}
+
+TEST_F(DeferralTest, TestDeferFnRelease) {
+  closed_handle = 0;
+  close_count   = 0;
+  {
+    auto d = deferral::defer_fn<&close_handle>(5);
+    d.release();
+  }
+  EXPECT_EQ(close_count, 0);
+
+  {
+    auto d = deferral::defer_fn<&close_handle>(6);
+    auto e = static_cast<decltype(d)&&>(d);
+  }
+  EXPECT_EQ(closed_handle, 6);
+  EXPECT_EQ(close_count, 1);
+}
+
+#endif // defined(__cpp_nontype_template_parameter_auto)
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
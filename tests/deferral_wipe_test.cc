@@ -0,0 +1,93 @@
+#include "deferral_wipe.hh"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace {
+
+bool all_zero(const unsigned char* p, std::size_t n) {
+  for(std::size_t i = 0; i < n; ++i) {
+    if(p[i] != 0) { return false; }
+  }
+  return true;
+}
+
+// Fills a buffer on its own stack frame and wipes it on the way out. Zeroing a local array right
+// before it goes out of scope is a dead store that the optimizer removes, unless it is a secure
+// wipe. The buffer's address is left in `secret_frame_buffer` so that the caller can inspect the
+// popped frame.
+const unsigned char* volatile secret_frame_buffer = nullptr;
+
+__attribute__((noinline)) void secret_frame(unsigned seed) {
+  unsigned char secret[256];
+  for(unsigned i = 0; i < sizeof(secret); ++i) {
+    secret[i] = static_cast<unsigned char>((seed + i) | 1);
+  }
+  secret_frame_buffer = secret;
+  deferral::DeferWipe g(secret, sizeof(secret));
+  // Keeps the stores above from being removed as well.
+  __asm__ __volatile__("" : : "r"(secret) : "memory");
+}
+
+} // namespace
+
+TEST(DeferralWipeTest, TestWipe) {
+  unsigned char key[48];
+  for(auto& c : key) { c = 0xa5; }
+  {
+    deferral::DeferWipe g(key, sizeof(key));
+    EXPECT_EQ(key[0], 0xa5);
+  }
+  EXPECT_TRUE(all_zero(key, sizeof(key)));
+}
+
+TEST(DeferralWipeTest, TestWipeRelease) {
+  unsigned char key[16];
+  for(auto& c : key) { c = 0xa5; }
+  {
+    auto g = deferral::make_defer_wipe(key, sizeof(key));
+    g.release();
+  }
+  EXPECT_EQ(key[0], 0xa5);
+}
+
+TEST(DeferralWipeTest, TestWipeFail) {
+  unsigned char out[16];
+  for(auto& c : out) { c = 0xa5; }
+  {
+    auto g = deferral::make_defer_wipe_fail(out, sizeof(out));
+  }
+  EXPECT_EQ(out[0], 0xa5);
+
+  try {
+    deferral::DeferWipeFail g(out, sizeof(out));
+    throw 0;
+  } catch(...) {}
+  EXPECT_TRUE(all_zero(out, sizeof(out)));
+}
+
+TEST(DeferralWipeTest, TestSecureWipeLarge) {
+  // Unaligned starts and odd sizes around the non-temporal threshold; the bytes around the wiped
+  // range must be left alone.
+  const std::size_t threshold = DEFERRAL_WIPE_NONTEMPORAL_THRESHOLD;
+  for(std::size_t size : {threshold - 1, threshold, threshold + 65, 4 * threshold + 7}) {
+    for(std::size_t offset : {0, 1, 33}) {
+      std::vector<unsigned char> buffer(size + offset + 1, 0xa5);
+      deferral::secure_wipe(buffer.data() + offset, size);
+      EXPECT_TRUE(all_zero(buffer.data() + offset, size)) << size << " " << offset;
+      if(offset > 0) { EXPECT_EQ(buffer[offset - 1], 0xa5); }
+      EXPECT_EQ(buffer[offset + size], 0xa5);
+    }
+  }
+}
+
+TEST(DeferralWipeTest, TestWipeNotElided) {
+  // Reads the popped frame of `secret_frame` before any other call can reuse it. This is built with
+  // -O3 and LTO as deferral_wipe_test_lto.
+  secret_frame(0x5a);
+  const volatile unsigned char* p = secret_frame_buffer;
+  std::size_t nonzero             = 0;
+  for(std::size_t i = 0; i < 256; ++i) { nonzero += p[i] != 0 ? 1 : 0; }
+  EXPECT_EQ(nonzero, 0u);
+}